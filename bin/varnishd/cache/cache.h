@@ -192,6 +192,14 @@ enum httpwhence {
  * Ban info event types
  */
 
+/* Well-known headers, indexed in struct http */
+enum http_hdx {
+#define HTTPH(a, b, c) HDX_##b,
+#include "tbl/http_headers.h"
+#undef HTTPH
+	HDX__MAX
+};
+
 /* NB: remember to update http_Copy() if you add fields */
 struct http {
 	unsigned		magic;
@@ -209,6 +217,8 @@ struct http {
 	uint16_t		status;
 	uint8_t			protover;
 	uint8_t			conds;		/* If-* headers present */
+
+	uint8_t			*hdx;		/* See cache_http.c */
 };
 
 /*--------------------------------------------------------------------
@@ -250,7 +260,7 @@ struct dstat {
 
 /* Fetch processors --------------------------------------------------*/
 
-void VFP_update_length(const struct busyobj *, ssize_t);
+void VFP_update_length(struct busyobj *, ssize_t);
 
 typedef void vfp_begin_f(struct busyobj *, size_t );
 typedef int vfp_bytes_f(struct busyobj *, struct http_conn *, ssize_t);
@@ -313,6 +323,7 @@ struct pool_task {
 	VTAILQ_ENTRY(pool_task)		list;
 	pool_func_t			*func;
 	void				*priv;
+	double				t_queued;
 };
 
 enum pool_how {
@@ -333,6 +344,7 @@ struct worker {
 	struct busyobj		*nbo;
 	void			*nhashpriv;
 	struct dstat		stats;
+	double			t_stats;	/* See Pool_Work_Thread() */
 
 	struct pool_task	task;
 
@@ -407,13 +419,18 @@ struct objcore {
 	struct objhead		*objhead;
 	struct busyobj		*busyobj;
 	double			timer_when;
+	double			cool_when;	/* See hsh_cooler() */
 	unsigned		flags;
 #define OC_F_BUSY		(1<<1)
 #define OC_F_PASS		(1<<2)
+#define OC_F_SNAP		(1<<3)		/* Has been oh->snap_oc */
 #define OC_F_LRUDONTMOVE	(1<<4)
 #define OC_F_PRIV		(1<<5)		/* Stevedore private flag */
 #define OC_F_LURK		(3<<6)		/* Ban-lurker-color */
 	unsigned		timer_idx;
+	uint32_t		vary_skel;	/* See cache_vary.c */
+	uint32_t		vary_sig;
+	VTAILQ_ENTRY(objcore)	timer_list;	/* expiry_wheel */
 	VTAILQ_ENTRY(objcore)	list;
 	VTAILQ_ENTRY(objcore)	lru_list;
 	VTAILQ_ENTRY(objcore)	ban_list;
@@ -491,6 +508,7 @@ struct busyobj {
 	unsigned		magic;
 #define BUSYOBJ_MAGIC		0x23b95567
 	struct lock		mtx;
+	pthread_cond_t		cond;	/* Fetch progress, see VBO_extend */
 	char			*end;
 
 	/*
@@ -510,9 +528,12 @@ struct busyobj {
 
 	struct ws		ws[1];
 	struct vbc		*vbc;
+	const struct director	*retry_dir;	/* See FetchHdr() */
 	struct http		*bereq;
 	struct http		*beresp;
 	struct object		*fetch_obj;
+	struct object		*ims_obj;	/* Stale copy, see cnt_miss */
+	struct storage		*trim_st;	/* See vfp_nop_end() */
 	struct exp		exp;
 	struct http_conn	htc;
 
@@ -601,11 +622,28 @@ struct req {
 	struct objhead		*hash_objhead;
 	struct busyobj		*busyobj;
 
+	/* Refresh of the graced object we deliver, see HSH_Lookup() */
+	struct objcore		*bg_objcore;
+	uint8_t			bgfetch;
+
+	/* Stale object to revalidate on a miss, see HSH_Lookup() */
+	struct objcore		*ims_oc;
+
 	/* Built Vary string */
 	uint8_t			*vary_b;
 	uint8_t			*vary_l;
 	uint8_t			*vary_e;
 
+	/* Vary signature memo, see cache_vary.c */
+#define VRY_NMEMO		4
+	unsigned		vary_nmemo;
+	uint32_t		vary_mskel[VRY_NMEMO];
+	const uint8_t		*vary_mvary[VRY_NMEMO];
+	uint32_t		vary_msig[VRY_NMEMO];
+
+	/* Regexp set results, see cache_vrt_re.c */
+	struct vrt_re_memo	*re_memo;
+
 	unsigned char		digest[DIGEST_LEN];
 
 	enum sess_close		doclose;
@@ -724,6 +762,7 @@ void VCA_FailSess(struct worker *w);
 /* cache_backend.c */
 void VBE_UseHealth(const struct director *vdi);
 void VBE_DiscardHealth(const struct director *vdi);
+const struct director *VBE_Director(const struct vbc *vc);
 
 
 struct vbc *VDI_GetFd(const struct director *, struct req *);
@@ -751,6 +790,7 @@ void BAN_Init(void);
 void BAN_NewObjCore(struct objcore *oc);
 void BAN_DestroyObj(struct objcore *oc);
 int BAN_CheckObject(struct object *o, struct req *sp);
+int BAN_Fresh(const struct objcore *oc);
 void BAN_Reload(const uint8_t *ban, unsigned len);
 struct ban *BAN_TailRef(void);
 void BAN_Compile(void);
@@ -763,6 +803,10 @@ void VBO_Init(void);
 struct busyobj *VBO_GetBusyObj(struct worker *wrk);
 void VBO_DerefBusyObj(struct worker *wrk, struct busyobj **busyobj);
 void VBO_Free(struct busyobj **vbo);
+void VBO_extend(struct busyobj *, ssize_t);
+void VBO_setstate(struct busyobj *bo, enum busyobj_state_e next);
+void VBO_waitstate(struct busyobj *bo, enum busyobj_state_e want);
+void VBO_waitlast(struct busyobj *bo);
 
 /* cache_http1_fsm.c [HTTP1] */
 void HTTP1_Session(struct worker *, struct req *);
@@ -788,6 +832,7 @@ void EXP_Set_keep(struct exp *e, double v);
 
 double EXP_Ttl(const struct req *, const struct object*);
 double EXP_Grace(const struct req *, const struct object*);
+double EXP_Keep(const struct req *, const struct object*);
 void EXP_Insert(struct object *o);
 void EXP_Inject(struct objcore *oc, struct lru *lru, double when);
 void EXP_Init(void);
@@ -834,9 +879,9 @@ enum vgzret_e VGZ_WrwGunzip(struct req *, struct vgz *, const void *ibuf,
 void VGZ_WrwFlush(struct req *, struct vgz *vg);
 
 /* cache_http.c */
-unsigned HTTP_estimate(unsigned nhttp);
+unsigned HTTP_estimate(unsigned nhttp, int hdx);
 void HTTP_Copy(struct http *to, const struct http * const fm);
-struct http *HTTP_create(void *p, uint16_t nhttp);
+struct http *HTTP_create(void *p, uint16_t nhttp, int hdx);
 const char *http_StatusMessage(unsigned);
 unsigned http_EstimateWS(const struct http *fm, unsigned how, uint16_t *nhd);
 void HTTP_Init(void);
@@ -868,9 +913,10 @@ int http_HdrIs(const struct http *hp, const char *hdr, const char *val);
 uint16_t http_DissectRequest(struct req *);
 uint16_t http_DissectResponse(struct http *sp, const struct http_conn *htc);
 enum sess_close http_DoConnection(const struct http *);
-void http_CopyHome(const struct http *hp);
+void http_CopyHome(struct http *hp);
 void http_Unset(struct http *hp, const char *hdr);
 void http_CollectHdr(struct http *hp, const char *hdr);
+void http_Merge(const struct http *fm, struct http *to);
 
 /* cache_httpconn.c */
 enum htc_status_e {
@@ -937,11 +983,14 @@ void PAN_Init(void);
 
 /* cache_pipe.c */
 void PipeRequest(struct req *req);
+void Pipe_Init(void);
 
 /* cache_pool.c */
 void Pool_Init(void);
 void Pool_Work_Thread(void *priv, struct worker *w);
 int Pool_Task(struct pool *pp, struct pool_task *task, enum pool_how how);
+unsigned Pool_No(const struct pool *pp);
+void Pool_SumStat(struct worker *w);
 
 #define WRW_IsReleased(w)	((w)->wrw == NULL)
 int WRW_Error(const struct worker *w);
@@ -951,17 +1000,23 @@ void WRW_Reserve(struct worker *w, int *fd, struct vsl_log *, double t0);
 unsigned WRW_Flush(const struct worker *w);
 unsigned WRW_FlushRelease(struct worker *w);
 unsigned WRW_Write(const struct worker *w, const void *ptr, int len);
+#ifdef SENDFILE_WORKS
+void WRW_Sendfile(const struct worker *w, int fd, off_t off, unsigned len);
+#endif
 unsigned WRW_WriteH(const struct worker *w, const txt *hh, const char *suf);
 
 /* cache_session.c [SES] */
 void SES_Close(struct sess *sp, enum sess_close reason);
 void SES_Delete(struct sess *sp, enum sess_close reason, double now);
+struct sess *SES_Clone(const struct sess *sp);
+void SES_Free(struct sess *sp);
 void SES_Charge(struct worker *, struct req *);
 struct sesspool *SES_NewPool(struct pool *pp, unsigned pool_no);
 void SES_DeletePool(struct sesspool *sp);
 int SES_ScheduleReq(struct req *);
 struct req *SES_GetReq(struct worker *, struct sess *);
 void SES_Handle(struct sess *sp, double now);
+void SES_Wait(struct sess *sp);
 void SES_ReleaseReq(struct req *);
 pool_func_t SES_pool_accept_task;
 
@@ -990,6 +1045,7 @@ void RES_WriteObj(struct req *);
 /* cache_vary.c */
 struct vsb *VRY_Create(struct req *sp, const struct http *hp);
 int VRY_Match(struct req *, const uint8_t *vary);
+int VRY_MatchObj(struct req *, struct objcore *, const uint8_t *vary);
 void VRY_Validate(const uint8_t *vary);
 void VRY_Prep(struct req *);
 void VRY_Finish(struct req *req, struct busyobj *bo);
@@ -997,6 +1053,7 @@ void VRY_Finish(struct req *req, struct busyobj *bo);
 /* cache_vcl.c */
 void VCL_Init(void);
 void VCL_Refresh(struct VCL_conf **vcc);
+void VCL_Ref(struct VCL_conf *vc);
 void VCL_Rel(struct VCL_conf **vcc);
 void VCL_Poll(void);
 const char *VCL_Return_Name(unsigned method);
@@ -1017,14 +1074,14 @@ void ESI_DeliverChild(struct req *);
 void VMOD_Init(void);
 
 /* cache_waiter.c */
-void WAIT_Enter(struct sess *sp);
+void *WAIT_NewPool(unsigned pool_no);
+void WAIT_Enter(void *priv, struct sess *sp);
 void WAIT_Init(void);
 const char *WAIT_GetName(void);
 
 /* cache_wrk.c */
 
 void WRK_Init(void);
-int WRK_TrySumStat(struct worker *w);
 void WRK_SumStat(struct worker *w);
 void *WRK_thread(void *priv);
 typedef void *bgthread_t(struct worker *, void *priv);
@@ -1048,17 +1105,21 @@ void RFC2616_Ttl(struct busyobj *);
 enum body_status RFC2616_Body(struct busyobj *, struct dstat *);
 unsigned RFC2616_Req_Gzip(const struct http *);
 int RFC2616_Do_Cond(const struct req *sp);
+int RFC2616_Do_IfRange(const struct req *req);
 
 /* stevedore.c */
 struct object *STV_NewObject(struct busyobj *, struct objcore **,
     const char *hint, unsigned len, uint16_t nhttp);
 struct storage *STV_alloc(struct busyobj *, size_t size);
 void STV_trim(struct storage *st, size_t size, int move_ok);
+struct storage *STV_trimcopy(const struct storage *st);
 void STV_free(struct storage *st);
+int STV_Sendfile(const struct storage *st, off_t *where);
 void STV_open(void);
 void STV_close(void);
 void STV_Freestore(struct object *o);
 void STV_BanInfo(enum baninfo event, const uint8_t *ban, unsigned len);
+void STV_Idle(void);
 
 /* storage_synth.c */
 struct vsb *SMS_Makesynth(struct object *obj);
@@ -40,8 +40,10 @@
 #include "cache.h"
 
 #include "cache_backend.h"
+#include "vatomic.h"
 #include "vrt.h"
 #include "vtcp.h"
+#include "vtim.h"
 
 static struct mempool	*vbcpool;
 
@@ -99,29 +101,18 @@ VBE_ReleaseConn(struct vbc *vc)
 
 /*--------------------------------------------------------------------
  * Attempt to connect to a given addrinfo entry.
- *
- * Must be called with locked backend, but will release the backend
- * lock during the slow/sleeping stuff, so that other worker threads
- * can have a go, while we ponder.
- *
  */
 
 static int
-vbe_TryConnect(const struct req *req, int pf, const struct sockaddr_storage *sa,
-    socklen_t salen, const struct vdi_simple *vs)
+vbe_TryConnect(int pf, const struct sockaddr_storage *sa, socklen_t salen,
+    double tmod)
 {
 	int s, i, tmo;
-	double tmod;
-
-	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	CHECK_OBJ_NOTNULL(vs, VDI_SIMPLE_MAGIC);
 
 	s = socket(pf, SOCK_STREAM, 0);
 	if (s < 0)
 		return (s);
 
-	FIND_TMO(connect_timeout, tmod, req, vs->vrt);
-
 	tmo = (int)(tmod * 1000.0);
 
 	i = VTCP_connect(s, sa, salen, tmo);
@@ -134,54 +125,73 @@ vbe_TryConnect(const struct req *req, int pf, const struct sockaddr_storage *sa,
 	return (s);
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Open a connection to the backend, in order of preference of address
+ * families.  The caller accounts for n_conn.
+ */
 
 static void
-bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
+vbe_Connect(const struct backend *bp, struct vbc *vc, double tmod)
 {
 	int s;
-	struct backend *bp = vs->backend;
-	char abuf1[VTCP_ADDRBUFSIZE];
-	char pbuf1[VTCP_PORTBUFSIZE];
-
-	CHECK_OBJ_NOTNULL(vs, VDI_SIMPLE_MAGIC);
-
-	Lck_Lock(&bp->mtx);
-	bp->refcount++;
-	bp->n_conn++;		/* It mostly works */
-	Lck_Unlock(&bp->mtx);
 
 	s = -1;
 	assert(bp->ipv6 != NULL || bp->ipv4 != NULL);
 
-	/* release lock during stuff that can take a long time */
-
 	if (cache_param->prefer_ipv6 && bp->ipv6 != NULL) {
-		s = vbe_TryConnect(req, PF_INET6, bp->ipv6, bp->ipv6len, vs);
+		s = vbe_TryConnect(PF_INET6, bp->ipv6, bp->ipv6len, tmod);
 		vc->addr = bp->ipv6;
 		vc->addrlen = bp->ipv6len;
 	}
 	if (s == -1 && bp->ipv4 != NULL) {
-		s = vbe_TryConnect(req, PF_INET, bp->ipv4, bp->ipv4len, vs);
+		s = vbe_TryConnect(PF_INET, bp->ipv4, bp->ipv4len, tmod);
 		vc->addr = bp->ipv4;
 		vc->addrlen = bp->ipv4len;
 	}
 	if (s == -1 && !cache_param->prefer_ipv6 && bp->ipv6 != NULL) {
-		s = vbe_TryConnect(req, PF_INET6, bp->ipv6, bp->ipv6len, vs);
+		s = vbe_TryConnect(PF_INET6, bp->ipv6, bp->ipv6len, tmod);
 		vc->addr = bp->ipv6;
 		vc->addrlen = bp->ipv6len;
 	}
 
 	vc->fd = s;
 	if (s < 0) {
+		vc->addr = NULL;
+		vc->addrlen = 0;
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
+{
+	struct backend *bp = vs->backend;
+	double tmod;
+	char abuf1[VTCP_ADDRBUFSIZE];
+	char pbuf1[VTCP_PORTBUFSIZE];
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(vs, VDI_SIMPLE_MAGIC);
+
+	FIND_TMO(connect_timeout, tmod, req, vs->vrt);
+
+	Lck_Lock(&bp->mtx);
+	(void)VATOMIC_ADD(&bp->refcount, 1);
+	bp->n_conn++;		/* It mostly works */
+	Lck_Unlock(&bp->mtx);
+
+	/* No lock held during stuff that can take a long time */
+	vbe_Connect(bp, vc, tmod);
+
+	if (vc->fd < 0) {
 		Lck_Lock(&bp->mtx);
 		bp->n_conn--;
-		bp->refcount--;		/* Only keep ref on success */
+		/* Only keep ref on success */
+		(void)VATOMIC_SUB(&bp->refcount, 1);
 		Lck_Unlock(&bp->mtx);
-		vc->addr = NULL;
-		vc->addrlen = 0;
 	} else {
-		VTCP_myname(s, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
+		VTCP_myname(vc->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
 		VSLb(req->vsl, SLT_BackendOpen, "%d %s %s %s ",
 		    vc->fd, vs->backend->display_name, abuf1, pbuf1);
 	}
@@ -189,9 +199,52 @@ bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
 }
 
 /*--------------------------------------------------------------------
- * Check that there is still something at the far end of a given socket.
- * We poll the fd with instant timeout, if there are any events we can't
- * use it (backends are not allowed to pipeline).
+ * Manage a pool of vbc structures.
+ * XXX: as an experiment, make this caching controled by a parameter
+ * XXX: so we can see if it has any effect.
+ */
+
+static struct vbc *
+vbe_NewConn(void)
+{
+	struct vbc *vc;
+
+	vc = MPL_Get(vbcpool, NULL);
+	XXXAN(vc);
+	vc->magic = VBC_MAGIC;
+	vc->fd = -1;
+	return (vc);
+}
+
+/*--------------------------------------------------------------------
+ * Idle connections.
+ *
+ * A recycled connection is parked in a free slot of the shard belonging
+ * to the thread pool which last used it, and requests look in their own
+ * shard first.  Slots are claimed and released with CAS, a slot holds
+ * either NULL or a vbc we own, so there is no ABA problem.
+ *
+ * Idle connections hold no reference on the backend.
+ *
+ * A background thread weeds out the connections the backend closed while
+ * they sat idle, and opens connections to keep backend_idle_min idle ones
+ * around, within the backends max_connections.  A connection can still
+ * die between two sweeps, and then FetchHdr() retries the request on a
+ * new connection to the same backend, see vdi_simple_getfd().
+ */
+
+#define VBE_NIDLE	(2 * VBE_NSHARD * VBE_NSLOT)
+#define VBE_SWEEP	0.1
+
+static struct lock			vbe_idle_mtx;
+static VTAILQ_HEAD(, backend)		vbe_idle_backends =
+    VTAILQ_HEAD_INITIALIZER(vbe_idle_backends);
+static pthread_t			vbe_idle_thread;
+
+/*--------------------------------------------------------------------
+ * It would be nice to have the portable poll() return a POLLHUP here,
+ * but we cannot count on it, so any event means the backend closed
+ * the connection, or is about to.
  */
 
 static int
@@ -205,22 +258,321 @@ vbe_CheckFd(int fd)
 	return(poll(&pfd, 1, 0) == 0);
 }
 
+static unsigned
+vbe_shard(const struct worker *wrk)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	if (wrk->pool == NULL)
+		return (0);
+	return (Pool_No(wrk->pool) % VBE_NSHARD);
+}
+
+static int
+vbe_idle_push(struct backend *bp, struct vbc *vc)
+{
+	struct vbe_shard *sh;
+	unsigned u;
+
+	assert(vc->shard < VBE_NSHARD);
+	sh = &bp->shard[vc->shard];
+	for (u = 0; u < VBE_NSLOT; u++)
+		if (sh->slot[u] == NULL &&
+		    VATOMIC_CAS(&sh->slot[u], NULL, vc)) {
+			sh->fd[u] = vc->fd;
+			return (1);
+		}
+	return (0);
+}
+
+static struct vbc *
+vbe_idle_pop(struct backend *bp, unsigned shard)
+{
+	struct vbe_shard *sh;
+	struct vbc *vc;
+	unsigned n, u;
+
+	for (n = 0; n < VBE_NSHARD; n++) {
+		sh = &bp->shard[(shard + n) % VBE_NSHARD];
+		for (u = 0; u < VBE_NSLOT; u++) {
+			vc = sh->slot[u];
+			if (vc != NULL && VATOMIC_CAS(&sh->slot[u], vc, NULL))
+				return (vc);
+		}
+	}
+	if (VTAILQ_EMPTY(&bp->connlist))
+		return (NULL);
+	Lck_Lock(&bp->mtx);
+	vc = VTAILQ_FIRST(&bp->connlist);
+	if (vc != NULL)
+		VTAILQ_REMOVE(&bp->connlist, vc, list);
+	Lck_Unlock(&bp->mtx);
+	return (vc);
+}
+
+void
+VBE_RecycleConn(struct vbc *vc)
+{
+	struct backend *bp;
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	bp = vc->backend;
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	assert(vc->fd >= 0);
+	AZ(vc->vsl);
+
+	if (vbe_idle_push(bp, vc))
+		return;
+	Lck_Lock(&bp->mtx);
+	VTAILQ_INSERT_HEAD(&bp->connlist, vc, list);
+	Lck_Unlock(&bp->mtx);
+}
+
 /*--------------------------------------------------------------------
- * Manage a pool of vbc structures.
- * XXX: as an experiment, make this caching controled by a parameter
- * XXX: so we can see if it has any effect.
+ * Grab a reference, unless the backend is already on its way out.
+ * Should ours be the last one, VBE_DropRef() leaves the backend to
+ * VBE_Poll() in the CLI thread.
  */
 
-static struct vbc *
-vbe_NewConn(void)
+static int
+vbe_idle_ref(struct backend *bp)
+{
+	int i;
+
+	do {
+		i = bp->refcount;
+		if (i <= 0)
+			return (0);
+	} while (!VATOMIC_CAS(&bp->refcount, i, i + 1));
+	return (1);
+}
+
+static void
+vbe_idle_close(struct backend *bp, struct vbc *vc)
+{
+
+	Lck_AssertHeld(&bp->mtx);
+	VSC_C_main->backend_toolate++;
+	VSL(SLT_BackendClose, 0, "%d %s toolate", vc->fd, bp->display_name);
+	VTCP_close(&vc->fd);
+	assert(bp->n_conn > 0);
+	bp->n_conn--;
+	vc->backend = NULL;
+	VBE_ReleaseConn(vc);
+}
+
+static void
+vbe_idle_prewarm(struct backend *bp, unsigned nidle)
 {
 	struct vbc *vc;
+	char abuf1[VTCP_ADDRBUFSIZE];
+	char pbuf1[VTCP_PORTBUFSIZE];
 
-	vc = MPL_Get(vbcpool, NULL);
-	XXXAN(vc);
-	vc->magic = VBC_MAGIC;
-	vc->fd = -1;
-	return (vc);
+	if (bp->vsc->vcls == 0 || bp->admin_health == ah_sick ||
+	    (bp->admin_health == ah_probe && !bp->healthy))
+		return;
+	for (; nidle < cache_param->backend_idle_min; nidle++) {
+		Lck_Lock(&bp->mtx);
+		if (bp->max_conn > 0 && bp->n_conn >= bp->max_conn) {
+			Lck_Unlock(&bp->mtx);
+			return;
+		}
+		bp->n_conn++;
+		Lck_Unlock(&bp->mtx);
+		vc = vbe_NewConn();
+		vbe_Connect(bp, vc, cache_param->connect_timeout);
+		if (vc->fd < 0) {
+			Lck_Lock(&bp->mtx);
+			bp->n_conn--;
+			Lck_Unlock(&bp->mtx);
+			VBE_ReleaseConn(vc);
+			return;
+		}
+		VTCP_myname(vc->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
+		VSL(SLT_BackendOpen, 0, "%d %s %s %s ",
+		    vc->fd, bp->display_name, abuf1, pbuf1);
+		VSC_C_main->backend_prewarm++;
+		vc->backend = bp;
+		vc->shard = nidle % VBE_NSHARD;
+		VBE_RecycleConn(vc);
+	}
+}
+
+/*
+ * Idle connections are checked where they sit, so that requests can
+ * still pick them up meanwhile.  Backends are not allowed to pipeline,
+ * so any event on an idle connection means that it is closed or about
+ * to be, and only such connections are taken out and closed.
+ *
+ * We do not own a vbc in a slot, so we poll the fd recorded next to
+ * the slot.  By the time we have claimed the vbc, a request may have
+ * used and recycled it, so we check it again before closing it, and
+ * if it is fine now, it goes back in.
+ */
+
+static unsigned
+vbe_idle_sweep_slots(struct backend *bp)
+{
+	struct vbc *vca[VBE_NSHARD * VBE_NSLOT], *vc;
+	struct pollfd pfd[VBE_NSHARD * VBE_NSLOT];
+	struct vbe_shard *sh;
+	unsigned n, u, nidle;
+
+	for (n = 0; n < VBE_NSHARD * VBE_NSLOT; n++) {
+		sh = &bp->shard[n / VBE_NSLOT];
+		vca[n] = sh->slot[n % VBE_NSLOT];
+		pfd[n].fd = vca[n] == NULL ? -1 : sh->fd[n % VBE_NSLOT];
+		pfd[n].events = POLLIN;
+		pfd[n].revents = 0;
+	}
+	(void)poll(pfd, n, 0);
+
+	nidle = 0;
+	for (u = 0; u < n; u++) {
+		vc = vca[u];
+		if (vc == NULL)
+			continue;
+		if (pfd[u].revents == 0) {
+			nidle++;
+			continue;
+		}
+		sh = &bp->shard[u / VBE_NSLOT];
+		if (!VATOMIC_CAS(&sh->slot[u % VBE_NSLOT], vc, NULL))
+			continue;
+		CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+		assert(vc->backend == bp);
+		if (vbe_CheckFd(vc->fd)) {
+			VBE_RecycleConn(vc);
+			nidle++;
+			continue;
+		}
+		Lck_Lock(&bp->mtx);
+		vbe_idle_close(bp, vc);
+		Lck_Unlock(&bp->mtx);
+	}
+	return (nidle);
+}
+
+static unsigned
+vbe_idle_sweep_list(struct backend *bp)
+{
+	struct vbc *vca[VBE_NIDLE], *vc;
+	struct pollfd pfd[VBE_NIDLE];
+	unsigned n, u, nidle;
+
+	if (VTAILQ_EMPTY(&bp->connlist))
+		return (0);
+	Lck_Lock(&bp->mtx);
+	n = 0;
+	VTAILQ_FOREACH(vc, &bp->connlist, list) {
+		if (n == VBE_NIDLE)
+			break;
+		CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+		assert(vc->backend == bp);
+		vca[n] = vc;
+		pfd[n].fd = vc->fd;
+		pfd[n].events = POLLIN;
+		pfd[n].revents = 0;
+		n++;
+	}
+	if (n > 0)
+		(void)poll(pfd, n, 0);
+	nidle = 0;
+	for (u = 0; u < n; u++) {
+		if (pfd[u].revents == 0) {
+			nidle++;
+			continue;
+		}
+		VTAILQ_REMOVE(&bp->connlist, vca[u], list);
+		vbe_idle_close(bp, vca[u]);
+	}
+	Lck_Unlock(&bp->mtx);
+	return (nidle);
+}
+
+static void
+vbe_idle_sweep(struct backend *bp)
+{
+	unsigned nidle;
+
+	nidle = vbe_idle_sweep_slots(bp);
+	nidle += vbe_idle_sweep_list(bp);
+	vbe_idle_prewarm(bp, nidle);
+}
+
+static void * __match_proto__(bgthread_t)
+vbe_idle_thread_f(struct worker *wrk, void *priv)
+{
+	struct backend *bp, **bpa = NULL;
+	unsigned l = 0, n, u;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	while (1) {
+		VTIM_sleep(VBE_SWEEP);
+		Lck_Lock(&vbe_idle_mtx);
+		n = 0;
+		VTAILQ_FOREACH(bp, &vbe_idle_backends, idle_list)
+			n++;
+		if (n > l) {
+			l = n;
+			bpa = realloc(bpa, l * sizeof *bpa);
+			XXXAN(bpa);
+		}
+		n = 0;
+		VTAILQ_FOREACH(bp, &vbe_idle_backends, idle_list)
+			if (vbe_idle_ref(bp))
+				bpa[n++] = bp;
+		Lck_Unlock(&vbe_idle_mtx);
+
+		for (u = 0; u < n; u++) {
+			vbe_idle_sweep(bpa[u]);
+			VBE_DropRef(bpa[u]);
+		}
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Backends are added to and removed from the sweepers list by the
+ * CLI thread.  When a backend goes away we close its idle connections.
+ */
+
+void
+VBE_IdleAdd(struct backend *b)
+{
+
+	ASSERT_CLI();
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	Lck_Lock(&vbe_idle_mtx);
+	VTAILQ_INSERT_TAIL(&vbe_idle_backends, b, idle_list);
+	Lck_Unlock(&vbe_idle_mtx);
+}
+
+void
+VBE_IdleDel(struct backend *b)
+{
+	struct vbc *vc;
+
+	ASSERT_CLI();
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	AZ(b->refcount);
+	Lck_Lock(&vbe_idle_mtx);
+	VTAILQ_REMOVE(&vbe_idle_backends, b, idle_list);
+	Lck_Unlock(&vbe_idle_mtx);
+
+	while (1) {
+		vc = vbe_idle_pop(b, 0);
+		if (vc == NULL)
+			break;
+		CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+		if (vc->fd >= 0) {
+			AZ(close(vc->fd));
+			vc->fd = -1;
+		}
+		vc->backend = NULL;
+		VBE_ReleaseConn(vc);
+	}
 }
 
 /*--------------------------------------------------------------------
@@ -309,10 +661,13 @@ vbe_Healthy(const struct vdi_simple *vs, const struct req *req)
 
 /*--------------------------------------------------------------------
  * Get a connection to a particular backend.
+ *
+ * Idle connections are not checked here, that is left to the sweeper,
+ * so a recycled one may turn out to be closed when it is used.
  */
 
 static struct vbc *
-vbe_GetVbe(struct req *req, struct vdi_simple *vs)
+vbe_GetVbe(struct req *req, struct vdi_simple *vs, unsigned fresh)
 {
 	struct vbc *vc;
 	struct backend *bp;
@@ -323,41 +678,21 @@ vbe_GetVbe(struct req *req, struct vdi_simple *vs)
 	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
 
 	/* first look for vbc's we can recycle */
-	while (1) {
-		Lck_Lock(&bp->mtx);
-		vc = VTAILQ_FIRST(&bp->connlist);
-		if (vc != NULL) {
-			bp->refcount++;
-			assert(vc->backend == bp);
-			assert(vc->fd >= 0);
-			AN(vc->addr);
-			VTAILQ_REMOVE(&bp->connlist, vc, list);
-		}
-		Lck_Unlock(&bp->mtx);
-		if (vc == NULL)
-			break;
-		if (vbe_CheckFd(vc->fd)) {
-			/* XXX locking of stats */
-			VSC_C_main->backend_reuse += 1;
-			VSLb(req->vsl, SLT_Backend, "%d %s %s",
-			    vc->fd, req->director->vcl_name,
-			    bp->display_name);
-			vc->vdis = vs;
-			vc->recycled = 1;
-			return (vc);
-		}
-		VSC_C_main->backend_toolate++;
-		VSLb(req->vsl, SLT_BackendClose, "%d %s toolate",
-		    vc->fd, bp->display_name);
-
-		/* Checkpoint log to flush all info related to this connection
-		   before the OS reuses the FD */
-		VSL_Flush(req->vsl, 0);
-
-		VTCP_close(&vc->fd);
-		VBE_DropRefConn(bp);
-		vc->backend = NULL;
-		VBE_ReleaseConn(vc);
+	vc = fresh ? NULL : vbe_idle_pop(bp, vbe_shard(req->wrk));
+	if (vc != NULL) {
+		CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+		assert(vc->backend == bp);
+		assert(vc->fd >= 0);
+		AN(vc->addr);
+		(void)VATOMIC_ADD(&bp->refcount, 1);
+		/* XXX locking of stats */
+		VSC_C_main->backend_reuse += 1;
+		VSLb(req->vsl, SLT_Backend, "%d %s %s",
+		    vc->fd, req->director->vcl_name, bp->display_name);
+		vc->vdis = vs;
+		vc->recycled = 1;
+		vc->shard = vbe_shard(req->wrk);
+		return (vc);
 	}
 
 	if (!vbe_Healthy(vs, req)) {
@@ -381,6 +716,7 @@ vbe_GetVbe(struct req *req, struct vdi_simple *vs)
 		return (NULL);
 	}
 	vc->backend = bp;
+	vc->shard = vbe_shard(req->wrk);
 	VSC_C_main->backend_conn++;
 	VSLb(req->vsl, SLT_Backend, "%d %s %s",
 	    vc->fd, req->director->vcl_name, bp->display_name);
@@ -447,7 +783,23 @@ VBE_DiscardHealth(const struct director *vdi)
 }
 
 /*--------------------------------------------------------------------
- *
+ * The simple director a connection was handed out by, so FetchHdr()
+ * can retry on the same backend.
+ */
+
+const struct director *
+VBE_Director(const struct vbc *vc)
+{
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	CHECK_OBJ_NOTNULL(vc->vdis, VDI_SIMPLE_MAGIC);
+	return (&vc->vdis->dir);
+}
+
+/*--------------------------------------------------------------------
+ * When a recycled connection fails on first use, FetchHdr() retries on
+ * the same simple director, and we give it a new connection rather than
+ * another idle one, which may well be just as dead.
  */
 
 static struct vbc * __match_proto__(vdi_getfd_f)
@@ -459,7 +811,8 @@ vdi_simple_getfd(const struct director *d, struct req *req)
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CAST_OBJ_NOTNULL(vs, d->priv, VDI_SIMPLE_MAGIC);
-	vc = vbe_GetVbe(req, vs);
+	vc = vbe_GetVbe(req, vs,
+	    req->busyobj != NULL && req->busyobj->retry_dir == d);
 	if (vc != NULL) {
 		FIND_TMO(first_byte_timeout,
 		    vc->first_byte_timeout, req, vs->vrt);
@@ -530,4 +883,6 @@ VDI_Init(void)
 
 	vbcpool = MPL_New("vbc", &cache_param->vbc_pool, &vbcps);
 	AN(vbcpool);
+	Lck_New(&vbe_idle_mtx, lck_vbeidle);
+	WRK_BgThread(&vbe_idle_thread, "backend-idle", vbe_idle_thread_f, NULL);
 }
@@ -113,6 +113,22 @@ enum admin_health {
 	ah_probe
 };
 
+/*
+ * Idle connections are parked in per thread-pool shards of slots which
+ * are claimed and released with CAS, so that recycling a connection does
+ * not take the backend mutex.  When all slots of a shard are taken, the
+ * connection goes on the locked connlist instead.  The fd next to a slot
+ * is only a hint for the idle sweeper, see vbe_idle_sweep().
+ */
+
+#define VBE_NSHARD		8
+#define VBE_NSLOT		16
+
+struct vbe_shard {
+	struct vbc * volatile	slot[VBE_NSLOT];
+	volatile int		fd[VBE_NSLOT];
+};
+
 struct backend {
 	unsigned		magic;
 #define BACKEND_MAGIC		0x64c4c7c6
@@ -133,7 +149,10 @@ struct backend {
 	socklen_t		ipv6len;
 
 	unsigned		n_conn;
+	unsigned		max_conn;	/* From the latest VCL */
 	VTAILQ_HEAD(, vbc)	connlist;
+	struct vbe_shard	shard[VBE_NSHARD];
+	VTAILQ_ENTRY(backend)	idle_list;
 
 	struct vbp_target	*probe;
 	unsigned		healthy;
@@ -159,6 +178,7 @@ struct vbc {
 	socklen_t		addrlen;
 
 	uint8_t			recycled;
+	unsigned		shard;
 
 	/* Timeouts */
 	double			first_byte_timeout;
@@ -167,12 +187,16 @@ struct vbc {
 
 /* cache_backend.c */
 void VBE_ReleaseConn(struct vbc *vc);
+void VBE_RecycleConn(struct vbc *vc);
+void VBE_IdleAdd(struct backend *b);
+void VBE_IdleDel(struct backend *b);
 struct backend *vdi_get_backend_if_simple(const struct director *d);
 
 /* cache_backend_cfg.c */
 void VBE_DropRefConn(struct backend *);
 void VBE_DropRefVcl(struct backend *);
 void VBE_DropRefLocked(struct backend *b);
+void VBE_DropRef(struct backend *b);
 
 /* cache_backend_poll.c */
 void VBP_Insert(struct backend *b, struct vrt_backend_probe const *p,
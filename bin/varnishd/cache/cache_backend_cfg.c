@@ -39,6 +39,7 @@
 #include "cache.h"
 
 #include "cache_backend.h"
+#include "vatomic.h"
 #include "vcli.h"
 #include "vcli_priv.h"
 #include "vrt.h"
@@ -57,6 +58,7 @@ VBE_Nuke(struct backend *b)
 {
 
 	ASSERT_CLI();
+	VBE_IdleDel(b);
 	VTAILQ_REMOVE(&backends, b, list);
 	free(b->ipv4);
 	free(b->ipv4_addr);
@@ -90,37 +92,39 @@ VBE_Poll(void)
 
 /*--------------------------------------------------------------------
  * Drop a reference to a backend.
- * The last reference must come from the watcher in the CLI thread,
- * as only that thread is allowed to clean up the backend list.
+ * Only the CLI thread is allowed to clean up the backend list, if the
+ * last reference goes elsewhere, VBE_Poll() picks up the backend.
+ *
+ * The refcount is manipulated atomically, so that connection reuse
+ * and recycling does not need the backend mutex.
  */
 
 void
-VBE_DropRefLocked(struct backend *b)
+VBE_DropRef(struct backend *b)
 {
 	int i;
-	struct vbc *vbe, *vbe2;
 
 	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
-	assert(b->refcount > 0);
 
-	i = --b->refcount;
-	Lck_Unlock(&b->mtx);
+	i = VATOMIC_SUB(&b->refcount, 1);
+	assert(i >= 0);
 	if (i > 0)
 		return;
 
-	ASSERT_CLI();
-	VTAILQ_FOREACH_SAFE(vbe, &b->connlist, list, vbe2) {
-		VTAILQ_REMOVE(&b->connlist, vbe, list);
-		if (vbe->fd >= 0) {
-			AZ(close(vbe->fd));
-			vbe->fd = -1;
-		}
-		vbe->backend = NULL;
-		VBE_ReleaseConn(vbe);
-	}
+	if (!pthread_equal(pthread_self(), cli_thread))
+		return;
 	VBE_Nuke(b);
 }
 
+void
+VBE_DropRefLocked(struct backend *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	Lck_Unlock(&b->mtx);
+	VBE_DropRef(b);
+}
+
 void
 VBE_DropRefVcl(struct backend *b)
 {
@@ -190,8 +194,9 @@ VBE_AddBackend(struct cli *cli, const struct vrt_backend *vb)
 		    b->ipv6len != vb->ipv6_sockaddr[0] ||
 		    memcmp(b->ipv6, vb->ipv6_sockaddr + 1, b->ipv6len)))
 			continue;
-		b->refcount++;
+		(void)VATOMIC_ADD(&b->refcount, 1);
 		b->vsc->vcls++;
+		b->max_conn = vb->max_connections;
 		return (b);
 	}
 
@@ -235,8 +240,10 @@ VBE_AddBackend(struct cli *cli, const struct vrt_backend *vb)
 
 	b->healthy = 1;
 	b->admin_health = ah_probe;
+	b->max_conn = vb->max_connections;
 
 	VTAILQ_INSERT_TAIL(&backends, b, list);
+	VBE_IdleAdd(b);
 	VSC_C_main->n_backend++;
 	return (b);
 }
@@ -28,10 +28,14 @@
  *
  * Poll backends for collection of health statistics
  *
- * We co-opt threads from the worker pool for probing the backends,
- * but we want to avoid a potentially messy cleanup operation when we
- * retire the backend, so the thread owns the health information, which
- * the backend references, rather than the other way around.
+ * A single thread drives all the probes, using non-blocking sockets and
+ * poll(2), with a binary heap of targets ordered by when they next need
+ * attention, be it the start of the next probe or the timeout of the
+ * current one.
+ *
+ * The health information lives in the vbp_target, which the backend
+ * references.  The thread holds vbp_mtx except while it waits in poll(2),
+ * so the CLI thread can add and remove targets under that lock.
  *
  */
 
@@ -44,6 +48,7 @@
 
 #include "cache.h"
 
+#include "binary_heap.h"
 #include "cache_backend.h"
 #include "vcli_priv.h"
 #include "vrt.h"
@@ -63,15 +68,21 @@ struct vbp_vcl {
 	const char			*hosthdr;
 };
 
+enum vbp_state {
+	VBP_IDLE,
+	VBP_CONNECT,
+	VBP_RECV,
+};
+
 struct vbp_target {
 	unsigned			magic;
 #define VBP_TARGET_MAGIC		0x6b7cb656
 
 	struct backend			*backend;
 	VTAILQ_HEAD( ,vbp_vcl)		vcls;
+	const struct vbp_vcl		*vcl;
 
 	struct vrt_backend_probe	probe;
-	int				stop;
 	struct vsb			*vsb;
 	char				*req;
 	int				req_len;
@@ -89,144 +100,55 @@ struct vbp_target {
 	double				rate;
 
 	VTAILQ_ENTRY(vbp_target)	list;
-	pthread_t			thread;
+
+	/* The probe in progress */
+	enum vbp_state			state;
+	int				fd;
+	unsigned			attempt;
+	unsigned			rlen;
+	double				t_start;
+	double				due;
+	unsigned			heap_idx;
+	unsigned			poll_idx;
+	unsigned			poll_gen;
 };
 
 static VTAILQ_HEAD(, vbp_target)	vbp_list =
     VTAILQ_HEAD_INITIALIZER(vbp_list);
 
 static struct lock			vbp_mtx;
+static struct binheap			*vbp_heap;
+static pthread_t			vbp_thread;
+static int				vbp_pipe[2];
 
-/*--------------------------------------------------------------------
- * Poke one backend, once, but possibly at both IPv4 and IPv6 addresses.
- *
- * We do deliberately not use the stuff in cache_backend.c, because we
- * want to measure the backends response without local distractions.
- */
+/*--------------------------------------------------------------------*/
 
 static int
-vbp_connect(int pf, const struct sockaddr_storage *sa, socklen_t salen, int tmo)
+vbp_cmp(void *priv, void *a, void *b)
 {
-	int s, i;
-
-	s = socket(pf, SOCK_STREAM, 0);
-	if (s < 0)
-		return (s);
+	const struct vbp_target *aa, *bb;
 
-	i = VTCP_connect(s, sa, salen, tmo);
-	if (i == 0)
-		return (s);
-	VTCP_close(&s);
-	return (-1);
+	AZ(priv);
+	CAST_OBJ_NOTNULL(aa, a, VBP_TARGET_MAGIC);
+	CAST_OBJ_NOTNULL(bb, b, VBP_TARGET_MAGIC);
+	return (aa->due < bb->due);
 }
 
 static void
-vbp_poke(struct vbp_target *vt)
+vbp_update(void *priv, void *p, unsigned u)
 {
-	int s, tmo, i;
-	double t_start, t_now, t_end;
-	unsigned rlen, resp;
-	struct backend *bp;
-	char buf[8192], *p;
-	struct pollfd pfda[1], *pfd = pfda;
-
-	bp = vt->backend;
-	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
-
-	t_start = t_now = VTIM_real();
-	t_end = t_start + vt->probe.timeout;
-	tmo = (int)round((t_end - t_now) * 1e3);
-
-	s = -1;
-	if (cache_param->prefer_ipv6 && bp->ipv6 != NULL) {
-		s = vbp_connect(PF_INET6, bp->ipv6, bp->ipv6len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv6 |= 1;
-	}
-	if (tmo > 0 && s < 0 && bp->ipv4 != NULL) {
-		s = vbp_connect(PF_INET, bp->ipv4, bp->ipv4len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv4 |= 1;
-	}
-	if (tmo > 0 && s < 0 && bp->ipv6 != NULL) {
-		s = vbp_connect(PF_INET6, bp->ipv6, bp->ipv6len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv6 |= 1;
-	}
-	if (s < 0) {
-		/* Got no connection: failed */
-		return;
-	}
-	if (tmo <= 0) {
-		/* Spent too long time getting it */
-		VTCP_close(&s);
-		return;
-	}
-
-	/* Send the request */
-	i = write(s, vt->req, vt->req_len);
-	if (i != vt->req_len) {
-		if (i < 0)
-			vt->err_xmit |= 1;
-		VTCP_close(&s);
-		return;
-	}
-	vt->good_xmit |= 1;
-
-	pfd->fd = s;
-	rlen = 0;
-	do {
-		pfd->events = POLLIN;
-		pfd->revents = 0;
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (tmo > 0)
-			i = poll(pfd, 1, tmo);
-		if (i == 0 || tmo <= 0) {
-			VTCP_close(&s);
-			return;
-		}
-		if (rlen < sizeof vt->resp_buf)
-			i = read(s, vt->resp_buf + rlen,
-			    sizeof vt->resp_buf - rlen);
-		else
-			i = read(s, buf, sizeof buf);
-		rlen += i;
-	} while (i > 0);
-
-	VTCP_close(&s);
-
-	if (i < 0) {
-		vt->err_recv |= 1;
-		return;
-	}
-
-	if (rlen == 0)
-		return;
-
-	/* So we have a good receive ... */
-	t_now = VTIM_real();
-	vt->last = t_now - t_start;
-	vt->good_recv |= 1;
+	struct vbp_target *vt;
 
-	/* Now find out if we like the response */
-	vt->resp_buf[sizeof vt->resp_buf - 1] = '\0';
-	p = strchr(vt->resp_buf, '\r');
-	if (p != NULL)
-		*p = '\0';
-	p = strchr(vt->resp_buf, '\n');
-	if (p != NULL)
-		*p = '\0';
+	AZ(priv);
+	CAST_OBJ_NOTNULL(vt, p, VBP_TARGET_MAGIC);
+	vt->heap_idx = u;
+}
 
-	i = sscanf(vt->resp_buf, "HTTP/%*f %u %s", &resp, buf);
+static void
+vbp_wakeup(void)
+{
 
-	if (i == 2 && resp == vt->probe.exp_status)
-		vt->happy |= 1;
+	(void)write(vbp_pipe[1], "", 1);
 }
 
 /*--------------------------------------------------------------------
@@ -297,6 +219,155 @@ vbp_has_poked(struct vbp_target *vt)
 	vt->backend->vsc->happy = vt->happy;
 }
 
+/*--------------------------------------------------------------------
+ * Poke one backend, once, but possibly at both IPv4 and IPv6 addresses.
+ *
+ * We do deliberately not use the stuff in cache_backend.c, because we
+ * want to measure the backends response without local distractions.
+ */
+
+static int
+vbp_addr(const struct vbp_target *vt, unsigned n, int *pf,
+    const struct sockaddr_storage **sa, socklen_t *salen)
+{
+	const struct backend *bp;
+	int att[3];
+	unsigned u = 0;
+
+	bp = vt->backend;
+	if (cache_param->prefer_ipv6 && bp->ipv6 != NULL)
+		att[u++] = PF_INET6;
+	if (bp->ipv4 != NULL)
+		att[u++] = PF_INET;
+	if (bp->ipv6 != NULL)
+		att[u++] = PF_INET6;
+	if (n >= u)
+		return (0);
+	*pf = att[n];
+	if (*pf == PF_INET6) {
+		*sa = bp->ipv6;
+		*salen = bp->ipv6len;
+	} else {
+		*sa = bp->ipv4;
+		*salen = bp->ipv4len;
+	}
+	return (1);
+}
+
+static void
+vbp_done(struct vbp_target *vt, double now, int eof)
+{
+	unsigned resp;
+	char buf[128], *p;
+	int i;
+
+	if (vt->fd >= 0)
+		VTCP_close(&vt->fd);
+
+	if (eof && vt->rlen > 0) {
+		/* So we have a good receive ... */
+		vt->last = now - vt->t_start;
+		vt->good_recv |= 1;
+
+		/* Now find out if we like the response */
+		vt->resp_buf[sizeof vt->resp_buf - 1] = '\0';
+		p = strchr(vt->resp_buf, '\r');
+		if (p != NULL)
+			*p = '\0';
+		p = strchr(vt->resp_buf, '\n');
+		if (p != NULL)
+			*p = '\0';
+
+		i = sscanf(vt->resp_buf, "HTTP/%*f %u %127s", &resp, buf);
+
+		if (i == 2 && resp == vt->probe.exp_status)
+			vt->happy |= 1;
+	}
+
+	vbp_has_poked(vt);
+	vt->state = VBP_IDLE;
+	vt->due = now + vt->probe.interval;
+}
+
+static void
+vbp_connect(struct vbp_target *vt, double now)
+{
+	const struct sockaddr_storage *sa;
+	socklen_t salen;
+	int pf, i;
+
+	while (now < vt->due && vbp_addr(vt, vt->attempt++, &pf, &sa, &salen)) {
+		vt->fd = socket(pf, SOCK_STREAM, 0);
+		if (vt->fd < 0)
+			continue;
+		(void)VTCP_nonblocking(vt->fd);
+		i = connect(vt->fd, (const void *)sa, salen);
+		if (i == 0 || errno == EINPROGRESS) {
+			vt->state = VBP_CONNECT;
+			return;
+		}
+		VTCP_close(&vt->fd);
+	}
+	/* Got no connection: failed */
+	vbp_done(vt, now, 0);
+}
+
+static void
+vbp_connected(struct vbp_target *vt, double now)
+{
+	const struct sockaddr_storage *sa;
+	socklen_t l, salen;
+	int i, k, pf;
+
+	l = sizeof k;
+	AZ(getsockopt(vt->fd, SOL_SOCKET, SO_ERROR, &k, &l));
+	if (k) {
+		/* Try the next address, if we have time */
+		VTCP_close(&vt->fd);
+		vbp_connect(vt, now);
+		return;
+	}
+	AN(vbp_addr(vt, vt->attempt - 1, &pf, &sa, &salen));
+	if (pf == PF_INET6)
+		vt->good_ipv6 |= 1;
+	else
+		vt->good_ipv4 |= 1;
+
+	/* Send the request, it fits in any socket buffer */
+	i = write(vt->fd, vt->req, vt->req_len);
+	if (i != vt->req_len) {
+		if (i < 0)
+			vt->err_xmit |= 1;
+		vbp_done(vt, now, 0);
+		return;
+	}
+	vt->good_xmit |= 1;
+	vt->state = VBP_RECV;
+	vt->rlen = 0;
+}
+
+static void
+vbp_recv(struct vbp_target *vt, double now)
+{
+	char buf[8192];
+	int i;
+
+	if (vt->rlen < sizeof vt->resp_buf)
+		i = read(vt->fd, vt->resp_buf + vt->rlen,
+		    sizeof vt->resp_buf - vt->rlen);
+	else
+		i = read(vt->fd, buf, sizeof buf);
+	if (i > 0) {
+		vt->rlen += i;
+		return;
+	}
+	if (i < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (i < 0)
+		vt->err_recv |= 1;
+	vbp_done(vt, now, i == 0);
+}
+
 /*--------------------------------------------------------------------
  * Build request from probe spec
  */
@@ -322,39 +393,118 @@ vbp_build_req(struct vsb *vsb, const struct vbp_vcl *vcl)
 }
 
 /*--------------------------------------------------------------------
- * One thread per backend to be poked.
+ * A target is due: start the next probe, or time out the current one.
  */
 
-static void *
-vbp_wrk_poll_backend(void *priv)
+static void
+vbp_due(struct vbp_target *vt, double now)
 {
-	struct vbp_target *vt;
-	struct vbp_vcl *vcl = NULL;
 
-	THR_SetName("backend poll");
+	Lck_AssertHeld(&vbp_mtx);
+	if (vt->state != VBP_IDLE) {
+		vbp_done(vt, now, 0);
+		return;
+	}
+	if (VTAILQ_FIRST(&vt->vcls) != vt->vcl) {
+		vt->vcl = VTAILQ_FIRST(&vt->vcls);
+		vbp_build_req(vt->vsb, vt->vcl);
+		vt->probe = vt->vcl->probe;
+	}
+	vt->req = VSB_data(vt->vsb);
+	vt->req_len = VSB_len(vt->vsb);
+
+	vbp_start_poke(vt);
+	vt->t_start = now;
+	vt->due = now + vt->probe.timeout;
+	vt->attempt = 0;
+	vt->rlen = 0;
+	vbp_connect(vt, now);
+}
 
-	CAST_OBJ_NOTNULL(vt, priv, VBP_TARGET_MAGIC);
+static void
+vbp_event(struct vbp_target *vt, double now)
+{
 
-	while (!vt->stop) {
-		Lck_Lock(&vbp_mtx);
-		if (VTAILQ_FIRST(&vt->vcls) != vcl) {
-			vcl = VTAILQ_FIRST(&vt->vcls);
-			vbp_build_req(vt->vsb, vcl);
-			vt->probe = vcl->probe;
+	Lck_AssertHeld(&vbp_mtx);
+	if (vt->state == VBP_CONNECT)
+		vbp_connected(vt, now);
+	else if (vt->state == VBP_RECV)
+		vbp_recv(vt, now);
+}
+
+static void * __match_proto__(bgthread_t)
+vbp_poller(struct worker *wrk, void *priv)
+{
+	struct vbp_target *vt;
+	struct pollfd *pfd = NULL;
+	unsigned npfd = 0, n, gen = 0;
+	double now;
+	int tmo;
+	char buf[64];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	Lck_Lock(&vbp_mtx);
+	while (1) {
+		now = VTIM_real();
+		while (1) {
+			vt = binheap_root(vbp_heap);
+			if (vt == NULL || vt->due > now)
+				break;
+			vbp_due(vt, now);
+			binheap_reorder(vbp_heap, vt->heap_idx);
 		}
-		Lck_Unlock(&vbp_mtx);
 
-		vt->req = VSB_data(vt->vsb);
-		vt->req_len = VSB_len(vt->vsb);
+		gen++;
+		n = 1;
+		VTAILQ_FOREACH(vt, &vbp_list, list) {
+			if (vt->fd < 0)
+				continue;
+			if (n >= npfd) {
+				npfd = npfd * 2 + 16;
+				pfd = realloc(pfd, npfd * sizeof *pfd);
+				XXXAN(pfd);
+			}
+			pfd[n].fd = vt->fd;
+			pfd[n].events =
+			    vt->state == VBP_CONNECT ? POLLOUT : POLLIN;
+			pfd[n].revents = 0;
+			vt->poll_idx = n++;
+			vt->poll_gen = gen;
+		}
+		if (pfd == NULL) {
+			npfd = 16;
+			pfd = malloc(npfd * sizeof *pfd);
+			XXXAN(pfd);
+		}
+		pfd[0].fd = vbp_pipe[0];
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
 
-		vbp_start_poke(vt);
-		vbp_poke(vt);
-		vbp_has_poked(vt);
+		vt = binheap_root(vbp_heap);
+		if (vt == NULL)
+			tmo = -1;
+		else
+			tmo = (int)ceil((vt->due - now) * 1e3);
+
+		Lck_Unlock(&vbp_mtx);
+		(void)poll(pfd, n, tmo);
+		if (pfd[0].revents)
+			(void)read(vbp_pipe[0], buf, sizeof buf);
+		Lck_Lock(&vbp_mtx);
 
-		if (!vt->stop)
-			VTIM_sleep(vt->probe.interval);
+		now = VTIM_real();
+		VTAILQ_FOREACH(vt, &vbp_list, list) {
+			if (vt->fd < 0 || vt->poll_gen != gen)
+				continue;
+			assert(pfd[vt->poll_idx].fd == vt->fd);
+			if (pfd[vt->poll_idx].revents == 0)
+				continue;
+			vbp_event(vt, now);
+			binheap_reorder(vbp_heap, vt->heap_idx);
+		}
 	}
-	return (NULL);
+	NEEDLESS_RETURN(NULL);
 }
 
 /*--------------------------------------------------------------------
@@ -492,9 +642,9 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *p,
 		vt->backend = b;
 		vt->vsb = VSB_new_auto();
 		XXXAN(vt->vsb);
+		vt->fd = -1;
 		b->probe = vt;
 		startthread = 1;
-		VTAILQ_INSERT_TAIL(&vbp_list, vt, list);
 	} else {
 		vt = b->probe;
 	}
@@ -513,7 +663,12 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *p,
 			vt->happy |= 1;
 			vbp_has_poked(vt);
 		}
-		AZ(pthread_create(&vt->thread, NULL, vbp_wrk_poll_backend, vt));
+		Lck_Lock(&vbp_mtx);
+		vt->due = VTIM_real();
+		VTAILQ_INSERT_TAIL(&vbp_list, vt, list);
+		binheap_insert(vbp_heap, vt);
+		Lck_Unlock(&vbp_mtx);
+		vbp_wakeup();
 	}
 }
 
@@ -546,7 +701,6 @@ VBP_Remove(struct backend *b, struct vrt_backend_probe const *p)
 {
 	struct vbp_target *vt;
 	struct vbp_vcl *vcl;
-	void *ret;
 
 	ASSERT_CLI();
 	AN(p);
@@ -571,15 +725,14 @@ VBP_Remove(struct backend *b, struct vrt_backend_probe const *p)
 
 	/* No more polling for this backend */
 
-	b->healthy = 1;
-
-	vt->stop = 1;
-	AZ(pthread_cancel(vt->thread));
-	AZ(pthread_join(vt->thread, &ret));
+	Lck_Lock(&vbp_mtx);
+	if (vt->fd >= 0)
+		VTCP_close(&vt->fd);
+	binheap_delete(vbp_heap, vt->heap_idx);
+	VTAILQ_REMOVE(&vbp_list, vt, list);
+	Lck_Unlock(&vbp_mtx);
 
 	b->healthy = 1;
-
-	VTAILQ_REMOVE(&vbp_list, vt, list);
 	b->probe = NULL;
 	VSB_delete(vt->vsb);
 	FREE_OBJ(vt);
@@ -594,5 +747,11 @@ VBP_Init(void)
 {
 
 	Lck_New(&vbp_mtx, lck_vbp);
+	vbp_heap = binheap_new(NULL, vbp_cmp, vbp_update);
+	AN(vbp_heap);
+	AZ(pipe(vbp_pipe));
+	(void)VTCP_nonblocking(vbp_pipe[0]);
+	(void)VTCP_nonblocking(vbp_pipe[1]);
+	WRK_BgThread(&vbp_thread, "backend-poller", vbp_poller, NULL);
 	CLI_AddFuncs(debug_cmds);
 }
@@ -58,6 +58,25 @@
  * byte string, that would be a little bit artificial, so this is
  * the exception that confirmes the rule.
  *
+ * The objcores hanging off the bans are partitioned into ban_shards
+ * shards, each with its own lock, lists and lurker thread.  The ban
+ * list itself, the ban flags and the plain refcount (used to hold the
+ * list stable) are still protected by ban_mtx.  Lock order is ban_mtx
+ * before any shard lock, and shard locks in ascending order.
+ *
+ * When a ban is inserted, the spec is compiled into an array of struct
+ * ban_test, with the header names interned, so that a header tested by
+ * several bans is only looked up once per object.
+ *
+ * Runs of bans which consist of a single "==" test on the same field,
+ * (think "ban obj.http.x-tag == ...", many times over) are collected in
+ * a ban_group, where the values are kept in a hash table, so the entire
+ * group can be tested with a single lookup.  Entries are only ever added
+ * to a group, and the group is freed with the last of its bans.  Each
+ * entry carries the sequence number of its ban, so that a ban which is
+ * not newer than the objects ban (and may already be freed) is ignored
+ * without touching it.
+ *
  */
 
 #include "config.h"
@@ -69,11 +88,21 @@
 #include "storage/storage.h"
 
 #include "hash/hash_slinger.h"
+#include "vatomic.h"
 #include "vcli.h"
 #include "vcli_priv.h"
 #include "vend.h"
+#include "vmb.h"
 #include "vtim.h"
 
+/* The part of a ban which belongs to one shard, under its lock */
+struct ban_oclist {
+	VTAILQ_HEAD(,objcore)	objcore;
+	int			refcount;
+	unsigned		flags;		/* BAN_F_LURK */
+	unsigned		lurked;
+};
+
 struct ban {
 	unsigned		magic;
 #define BAN_MAGIC		0x700b08ea
@@ -83,9 +112,24 @@ struct ban {
 #define BAN_F_GONE		(1 << 0)
 #define BAN_F_REQ		(1 << 2)
 #define BAN_F_LURK		(3 << 6)	/* ban-lurker-color */
-	VTAILQ_HEAD(,objcore)	objcore;
+	unsigned		lurked;		/* shards done */
+	struct ban_oclist	*oclist;	/* [ban_nshard] */
 	struct vsb		*vsb;
 	uint8_t			*spec;
+	uint64_t		seq;
+	unsigned		ntest;
+	struct ban_test		*test;
+	struct ban_group	*group;
+};
+
+struct ban_shard {
+	unsigned		magic;
+#define BAN_SHARD_MAGIC		0x3d5a0c8b
+	unsigned		n;
+	struct lock		mtx;
+	pthread_t		thread;
+	char			name[20];
+	struct VSC_C_ban	*vsc;
 };
 
 #define LURK_SHIFT 6
@@ -96,14 +140,61 @@ struct ban_test {
 	uint8_t			oper;
 	const char		*arg2;
 	const void		*arg2_spec;
+	int			arg2_status;
+};
+
+/* Interned header name, shared by all tests on that header */
+struct ban_hdr {
+	unsigned		magic;
+#define BAN_HDR_MAGIC		0x1c6a90e3
+	unsigned		refcount;
+	VTAILQ_ENTRY(ban_hdr)	list;
+	char			*hdr;
+};
+
+struct ban_gentry {
+	struct ban_gentry	*next;
+	unsigned		hash;
+	uint64_t		seq;
+	struct ban		*ban;
+	const char		*val;
+};
+
+struct ban_group {
+	unsigned		magic;
+#define BAN_GROUP_MAGIC		0x4a1e7c2d
+	unsigned		refcount;
+	uint8_t			arg1;
+	const char		*arg1_spec;
+	unsigned		nentry;
+	unsigned		maxentry;	/* also # buckets, power of two */
+	struct ban_gentry	**bucket;
+	struct ban_gentry	*entry;
+};
+
+#define BAN_GROUP_MIN		16
+#define BAN_GROUP_MAX		65536
+
+/* Header lookups already done for the object being checked */
+#define BAN_HCACHE		8
+struct ban_hcache {
+	unsigned		n;
+	struct {
+		const struct http	*hp;
+		const char		*hdr;
+		char			*val;
+	}			e[BAN_HCACHE];
 };
 
 static VTAILQ_HEAD(banhead_s,ban) ban_head = VTAILQ_HEAD_INITIALIZER(ban_head);
 static struct lock ban_mtx;
 static struct ban *ban_magic;
-static pthread_t ban_thread;
 static struct ban * volatile ban_start;
 static bgthread_t ban_lurker;
+static struct ban_shard *ban_shards;
+static unsigned ban_nshard;
+static uint64_t ban_seq;
+static VTAILQ_HEAD(,ban_hdr) ban_hdrs = VTAILQ_HEAD_INITIALIZER(ban_hdrs);
 
 /*--------------------------------------------------------------------
  * BAN string magic markers
@@ -142,45 +233,89 @@ struct ban *
 BAN_New(void)
 {
 	struct ban *b;
+	unsigned u;
 
 	ALLOC_OBJ(b, BAN_MAGIC);
 	if (b == NULL)
 		return (b);
+	b->oclist = calloc(ban_nshard, sizeof *b->oclist);
+	if (b->oclist == NULL) {
+		FREE_OBJ(b);
+		return (NULL);
+	}
 	b->vsb = VSB_new_auto();
 	if (b->vsb == NULL) {
+		free(b->oclist);
 		FREE_OBJ(b);
 		return (NULL);
 	}
-	VTAILQ_INIT(&b->objcore);
+	for (u = 0; u < ban_nshard; u++)
+		VTAILQ_INIT(&b->oclist[u].objcore);
 	return (b);
 }
 
 void
 BAN_Free(struct ban *b)
 {
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 	AZ(b->refcount);
-	assert(VTAILQ_EMPTY(&b->objcore));
+	for (u = 0; u < ban_nshard; u++) {
+		AZ(b->oclist[u].refcount);
+		assert(VTAILQ_EMPTY(&b->oclist[u].objcore));
+	}
 
 	if (b->vsb != NULL)
 		VSB_delete(b->vsb);
+	AZ(b->group);
 	if (b->spec != NULL)
 		free(b->spec);
+	free(b->test);
+	free(b->oclist);
 	FREE_OBJ(b);
 }
 
+/*--------------------------------------------------------------------
+ * Find the shard of an objcore
+ */
+
+static struct ban_shard *
+ban_shard(const struct objcore *oc)
+{
+	uintptr_t u;
+
+	u = (uintptr_t)oc;
+	u ^= u >> 12;
+	return (&ban_shards[(u >> 6) % ban_nshard]);
+}
+
+/*--------------------------------------------------------------------
+ * Total number of references to a ban, across all shards
+ */
+
+static int
+ban_refcount(const struct ban *b)
+{
+	unsigned u;
+	int r;
+
+	r = b->refcount;
+	for (u = 0; u < ban_nshard; u++)
+		r += b->oclist[u].refcount;
+	return (r);
+}
+
 /*--------------------------------------------------------------------
  * Get & Release a tail reference, used to hold the list stable for
  * traversals etc.
  */
 
-struct ban *
-BAN_TailRef(void)
+static struct ban *
+ban_tailref(void)
 {
 	struct ban *b;
 
-	ASSERT_CLI();
 	Lck_Lock(&ban_mtx);
 	b = VTAILQ_LAST(&ban_head, banhead_s);
 	AN(b);
@@ -189,6 +324,14 @@ BAN_TailRef(void)
 	return (b);
 }
 
+struct ban *
+BAN_TailRef(void)
+{
+
+	ASSERT_CLI();
+	return (ban_tailref());
+}
+
 void
 BAN_TailDeref(struct ban **bb)
 {
@@ -367,6 +510,272 @@ BAN_AddTest(struct cli *cli, struct ban *b, const char *a1, const char *a2,
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Intern a header name
+ */
+
+static const char *
+ban_hdr_ref(const char *hdr)
+{
+	struct ban_hdr *bh;
+
+	Lck_AssertHeld(&ban_mtx);
+	VTAILQ_FOREACH(bh, &ban_hdrs, list) {
+		CHECK_OBJ_NOTNULL(bh, BAN_HDR_MAGIC);
+		/* Same length byte, so this compares the names */
+		if (!strcasecmp(bh->hdr, hdr)) {
+			bh->refcount++;
+			return (bh->hdr);
+		}
+	}
+	ALLOC_OBJ(bh, BAN_HDR_MAGIC);
+	XXXAN(bh);
+	REPLACE(bh->hdr, hdr);
+	XXXAN(bh->hdr);
+	bh->refcount = 1;
+	VTAILQ_INSERT_HEAD(&ban_hdrs, bh, list);
+	return (bh->hdr);
+}
+
+static void
+ban_hdr_deref(const char *hdr)
+{
+	struct ban_hdr *bh;
+
+	Lck_AssertHeld(&ban_mtx);
+	VTAILQ_FOREACH(bh, &ban_hdrs, list)
+		if (bh->hdr == hdr)
+			break;
+	CHECK_OBJ_NOTNULL(bh, BAN_HDR_MAGIC);
+	assert(bh->refcount > 0);
+	if (--bh->refcount > 0)
+		return;
+	VTAILQ_REMOVE(&ban_hdrs, bh, list);
+	free(bh->hdr);
+	FREE_OBJ(bh);
+}
+
+/*--------------------------------------------------------------------
+ * obj.status is only equal to strings which sprintf("%d") can produce
+ */
+
+static int
+ban_status(const char *s)
+{
+	const char *p;
+	unsigned u;
+
+	if (*s == '\0' || (s[0] == '0' && s[1] != '\0') || strlen(s) > 5)
+		return (-1);
+	u = 0;
+	for (p = s; *p != '\0'; p++) {
+		if (*p < '0' || *p > '9')
+			return (-1);
+		u = u * 10 + (*p - '0');
+	}
+	if (u > 65535)
+		return (-1);
+	return ((int)u);
+}
+
+/*--------------------------------------------------------------------
+ * Compile the spec into the test array, and undo it again.
+ */
+
+static void
+ban_compile(struct ban *b)
+{
+	struct ban_test bt, *t;
+	const uint8_t *bs, *be;
+	unsigned n;
+
+	Lck_AssertHeld(&ban_mtx);
+	AZ(b->test);
+	be = b->spec + ban_len(b->spec);
+	n = 0;
+	for (bs = b->spec + 13; bs < be; n++)
+		ban_iter(&bs, &bt);
+	b->ntest = n;
+	if (n == 0)
+		return;
+	b->test = calloc(n, sizeof *b->test);
+	XXXAN(b->test);
+	t = b->test;
+	for (bs = b->spec + 13; bs < be; t++) {
+		ban_iter(&bs, t);
+		if (t->arg1_spec != NULL)
+			t->arg1_spec = ban_hdr_ref(t->arg1_spec);
+		if (t->arg1 == BAN_ARG_OBJSTATUS)
+			t->arg2_status = ban_status(t->arg2);
+	}
+}
+
+static void
+ban_decompile(struct ban *b)
+{
+	unsigned u;
+
+	Lck_AssertHeld(&ban_mtx);
+	for (u = 0; u < b->ntest; u++)
+		if (b->test[u].arg1_spec != NULL)
+			ban_hdr_deref(b->test[u].arg1_spec);
+	if (b->group != NULL) {
+		CHECK_OBJ_NOTNULL(b->group, BAN_GROUP_MAGIC);
+		assert(b->group->refcount > 0);
+		if (--b->group->refcount == 0) {
+			free(b->group->bucket);
+			free(b->group->entry);
+			FREE_OBJ(b->group);
+		}
+		b->group = NULL;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Ban groups
+ */
+
+static unsigned
+ban_hash(const char *s)
+{
+	unsigned h = 2166136261U;		/* FNV-1a */
+
+	for (; *s != '\0'; s++)
+		h = (h ^ (uint8_t)*s) * 16777619U;
+	return (h);
+}
+
+static int
+ban_groupable(const struct ban *b)
+{
+
+	if (b->ntest != 1 || b->test[0].oper != BAN_OPER_EQ)
+		return (0);
+	return (b->test[0].arg1 == BAN_ARG_URL ||
+	    b->test[0].arg1 == BAN_ARG_REQHTTP ||
+	    b->test[0].arg1 == BAN_ARG_OBJHTTP);
+}
+
+static struct ban_group *
+ban_group_new(const struct ban *b, unsigned n)
+{
+	struct ban_group *g;
+
+	ALLOC_OBJ(g, BAN_GROUP_MAGIC);
+	XXXAN(g);
+	g->arg1 = b->test[0].arg1;
+	g->arg1_spec = b->test[0].arg1_spec;
+	g->maxentry = n;
+	g->bucket = calloc(n, sizeof *g->bucket);
+	XXXAN(g->bucket);
+	g->entry = calloc(n, sizeof *g->entry);
+	XXXAN(g->entry);
+	return (g);
+}
+
+/*
+ * Lookups run without locks, so the entry must be complete before
+ * it is linked into its bucket.
+ */
+
+static void
+ban_group_insert(struct ban_group *g, struct ban *b)
+{
+	struct ban_gentry *e;
+	unsigned u;
+
+	Lck_AssertHeld(&ban_mtx);
+	assert(g->nentry < g->maxentry);
+	e = &g->entry[g->nentry++];
+	e->seq = b->seq;
+	e->ban = b;
+	e->val = b->test[0].arg2;
+	e->hash = ban_hash(e->val);
+	u = e->hash & (g->maxentry - 1);
+	e->next = g->bucket[u];
+	VWMB();
+	g->bucket[u] = e;
+	g->refcount++;
+}
+
+/*
+ * Put a new ban in the group of the ban in front of it, if they test
+ * the same field.
+ */
+
+static void
+ban_group_add(struct ban *b, struct ban *bp)
+{
+	struct ban_group *g;
+	unsigned n;
+
+	Lck_AssertHeld(&ban_mtx);
+	AZ(b->group);
+	if (bp == NULL || !ban_groupable(b) || !ban_groupable(bp))
+		return;
+	if (bp->test[0].arg1 != b->test[0].arg1 ||
+	    bp->test[0].arg1_spec != b->test[0].arg1_spec)
+		return;
+	g = bp->group;
+	if (g == NULL) {
+		g = ban_group_new(b, BAN_GROUP_MIN);
+		ban_group_insert(g, bp);
+		VWMB();
+		bp->group = g;
+	} else if (g->nentry == g->maxentry) {
+		n = g->maxentry * 2;
+		if (n > BAN_GROUP_MAX)
+			n = BAN_GROUP_MAX;
+		g = ban_group_new(b, n);
+	}
+	ban_group_insert(g, b);
+	b->group = g;
+}
+
+/*
+ * Has the lurker already tested this ban against the object ?
+ */
+
+static int
+ban_lurked(const struct ban *b, const struct ban_shard *bs,
+    const struct objcore *oc)
+{
+	const struct ban_oclist *bo;
+
+	bo = &b->oclist[bs->n];
+	if (!(bo->flags & BAN_F_LURK) ||
+	    (bo->flags & BAN_F_LURK) != (oc->flags & OC_F_LURK))
+		return (0);
+	AZ(b->flags & BAN_F_REQ);
+	return (1);
+}
+
+/*
+ * Find a ban in the group which is newer than the object's ban, matches
+ * val and has not already been tested against the object by the lurker.
+ */
+
+static struct ban *
+ban_group_match(const struct ban_group *g, const char *val,
+    const struct ban_shard *bs, const struct objcore *oc)
+{
+	const struct ban_gentry *e;
+	unsigned h;
+
+	h = ban_hash(val);
+	for (e = g->bucket[h & (g->maxentry - 1)]; e != NULL; e = e->next) {
+		if (e->hash != h || e->seq <= oc->ban->seq)
+			continue;
+		if (e->ban->flags & BAN_F_GONE)
+			continue;
+		if (ban_lurked(e->ban, bs, oc))
+			continue;
+		if (!strcmp(e->val, val))
+			return (e->ban);
+	}
+	return (NULL);
+}
+
 /*--------------------------------------------------------------------
  * We maintain ban_start as a pointer to the first element of the list
  * as a separate variable from the VTAILQ, to avoid depending on the
@@ -401,6 +810,9 @@ BAN_Insert(struct ban *b)
 	b->vsb = NULL;
 
 	Lck_Lock(&ban_mtx);
+	b->seq = ++ban_seq;
+	ban_compile(b);
+	ban_group_add(b, VTAILQ_FIRST(&ban_head));
 	VTAILQ_INSERT_HEAD(&ban_head, b, list);
 	ban_start = b;
 	VSC_C_main->bans++;
@@ -445,15 +857,20 @@ BAN_Insert(struct ban *b)
 void
 BAN_NewObjCore(struct objcore *oc)
 {
+	struct ban_shard *bs;
+	struct ban_oclist *bo;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	AZ(oc->ban);
 	AN(oc->objhead);
-	Lck_Lock(&ban_mtx);
+	bs = ban_shard(oc);
+	Lck_Lock(&bs->mtx);
 	oc->ban = ban_start;
-	ban_start->refcount++;
-	VTAILQ_INSERT_TAIL(&ban_start->objcore, oc, ban_list);
-	Lck_Unlock(&ban_mtx);
+	bo = &oc->ban->oclist[bs->n];
+	bo->refcount++;
+	VTAILQ_INSERT_TAIL(&bo->objcore, oc, ban_list);
+	bs->vsc->objcore++;
+	Lck_Unlock(&bs->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -463,17 +880,22 @@ BAN_NewObjCore(struct objcore *oc)
 void
 BAN_DestroyObj(struct objcore *oc)
 {
+	struct ban_shard *bs;
+	struct ban_oclist *bo;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	if (oc->ban == NULL)
 		return;
 	CHECK_OBJ_NOTNULL(oc->ban, BAN_MAGIC);
-	Lck_Lock(&ban_mtx);
-	assert(oc->ban->refcount > 0);
-	oc->ban->refcount--;
-	VTAILQ_REMOVE(&oc->ban->objcore, oc, ban_list);
+	bs = ban_shard(oc);
+	Lck_Lock(&bs->mtx);
+	bo = &oc->ban->oclist[bs->n];
+	assert(bo->refcount > 0);
+	bo->refcount--;
+	VTAILQ_REMOVE(&bo->objcore, oc, ban_list);
+	bs->vsc->objcore--;
 	oc->ban = NULL;
-	Lck_Unlock(&ban_mtx);
+	Lck_Unlock(&bs->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -485,6 +907,7 @@ struct ban *
 BAN_RefBan(struct objcore *oc, double t0, const struct ban *tail)
 {
 	struct ban *b;
+	struct ban_shard *bs;
 	double t1 = 0;
 
 	VTAILQ_FOREACH(b, &ban_head, list) {
@@ -496,10 +919,12 @@ BAN_RefBan(struct objcore *oc, double t0, const struct ban *tail)
 	}
 	AN(b);
 	assert(t1 == t0);
-	Lck_Lock(&ban_mtx);
-	b->refcount++;
-	VTAILQ_INSERT_TAIL(&b->objcore, oc, ban_list);
-	Lck_Unlock(&ban_mtx);
+	bs = ban_shard(oc);
+	Lck_Lock(&bs->mtx);
+	b->oclist[bs->n].refcount++;
+	VTAILQ_INSERT_TAIL(&b->oclist[bs->n].objcore, oc, ban_list);
+	bs->vsc->objcore++;
+	Lck_Unlock(&bs->mtx);
 	return (b);
 }
 
@@ -509,6 +934,9 @@ BAN_RefBan(struct objcore *oc, double t0, const struct ban *tail)
  *
  * If a newer ban has same condition, mark the new ban GONE.
  * mark any older bans, with the same condition, GONE as well.
+ *
+ * This only happens before BAN_Compile(), while the only other ban is
+ * ban_magic, so grouped bans still have sequence numbers in list order.
  */
 
 void
@@ -550,6 +978,8 @@ BAN_Reload(const uint8_t *ban, unsigned len)
 	b2->spec = malloc(len);
 	AN(b2->spec);
 	memcpy(b2->spec, ban, len);
+	b2->seq = ++ban_seq;
+	ban_compile(b2);
 	b2->flags |= gone;
 	if (ban[12])
 		b2->flags |= BAN_F_REQ;
@@ -593,6 +1023,7 @@ BAN_Time(const struct ban *b)
 void
 BAN_Compile(void)
 {
+	unsigned u;
 
 	ASSERT_CLI();
 
@@ -600,66 +1031,100 @@ BAN_Compile(void)
 	STV_BanInfo(BI_NEW, ban_magic->spec, ban_len(ban_magic->spec));
 
 	ban_start = VTAILQ_FIRST(&ban_head);
-	WRK_BgThread(&ban_thread, "ban-lurker", ban_lurker, NULL);
+	for (u = 0; u < ban_nshard; u++)
+		WRK_BgThread(&ban_shards[u].thread, ban_shards[u].name,
+		    ban_lurker, &ban_shards[u]);
 }
 
 /*--------------------------------------------------------------------
- * Evaluate ban-spec
+ * Evaluate a compiled ban
  */
 
+static char *
+ban_gethdr(struct ban_hcache *hc, const struct http *hp, const char *hdr)
+{
+	char *p;
+	unsigned u;
+
+	for (u = 0; u < hc->n; u++)
+		if (hc->e[u].hp == hp && hc->e[u].hdr == hdr)
+			return (hc->e[u].val);
+	(void)http_GetHdr(hp, hdr, &p);
+	if (hc->n < BAN_HCACHE) {
+		hc->e[hc->n].hp = hp;
+		hc->e[hc->n].hdr = hdr;
+		hc->e[hc->n].val = p;
+		hc->n++;
+	}
+	return (p);
+}
+
+static char *
+ban_getarg(struct ban_hcache *hc, uint8_t arg1, const char *arg1_spec,
+    const struct http *objhttp, const struct http *reqhttp)
+{
+
+	switch (arg1) {
+	case BAN_ARG_URL:
+		AN(reqhttp);
+		return (reqhttp->hd[HTTP_HDR_URL].b);
+	case BAN_ARG_REQHTTP:
+		AN(reqhttp);
+		return (ban_gethdr(hc, reqhttp, arg1_spec));
+	case BAN_ARG_OBJHTTP:
+		return (ban_gethdr(hc, objhttp, arg1_spec));
+	default:
+		INCOMPL();
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
 static int
-ban_evaluate(const uint8_t *bs, const struct http *objhttp,
-    const struct http *reqhttp, unsigned *tests)
+ban_evaluate(const struct ban *b, const struct http *objhttp,
+    const struct http *reqhttp, struct ban_hcache *hc, unsigned *tests)
 {
-	struct ban_test bt;
-	const uint8_t *be;
+	const struct ban_test *bt;
 	char *arg1;
 	char buf[10];
+	unsigned u;
 
-	be = bs + ban_len(bs);
-	bs += 13;
-	while (bs < be) {
+	for (u = 0; u < b->ntest; u++) {
 		(*tests)++;
-		ban_iter(&bs, &bt);
-		arg1 = NULL;
-		switch (bt.arg1) {
-		case BAN_ARG_URL:
-			AN(reqhttp);
-			arg1 = reqhttp->hd[HTTP_HDR_URL].b;
-			break;
-		case BAN_ARG_REQHTTP:
-			AN(reqhttp);
-			(void)http_GetHdr(reqhttp, bt.arg1_spec, &arg1);
-			break;
-		case BAN_ARG_OBJHTTP:
-			(void)http_GetHdr(objhttp, bt.arg1_spec, &arg1);
-			break;
-		case BAN_ARG_OBJSTATUS:
+		bt = &b->test[u];
+		if (bt->arg1 != BAN_ARG_OBJSTATUS)
+			arg1 = ban_getarg(hc, bt->arg1, bt->arg1_spec,
+			    objhttp, reqhttp);
+		else if (bt->oper == BAN_OPER_EQ) {
+			if (objhttp->status != bt->arg2_status)
+				return (0);
+			continue;
+		} else if (bt->oper == BAN_OPER_NEQ) {
+			if (objhttp->status == bt->arg2_status)
+				return (0);
+			continue;
+		} else {
 			arg1 = buf;
 			sprintf(buf, "%d", objhttp->status);
-			break;
-		default:
-			INCOMPL();
 		}
 
-		switch (bt.oper) {
+		switch (bt->oper) {
 		case BAN_OPER_EQ:
-			if (arg1 == NULL || strcmp(arg1, bt.arg2))
+			if (arg1 == NULL || strcmp(arg1, bt->arg2))
 				return (0);
 			break;
 		case BAN_OPER_NEQ:
-			if (arg1 != NULL && !strcmp(arg1, bt.arg2))
+			if (arg1 != NULL && !strcmp(arg1, bt->arg2))
 				return (0);
 			break;
 		case BAN_OPER_MATCH:
 			if (arg1 == NULL ||
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
+			    pcre_exec(bt->arg2_spec, NULL, arg1, strlen(arg1),
 			    0, 0, NULL, 0) < 0)
 				return (0);
 			break;
 		case BAN_OPER_NMATCH:
 			if (arg1 != NULL &&
-			    pcre_exec(bt.arg2_spec, NULL, arg1, strlen(arg1),
+			    pcre_exec(bt->arg2_spec, NULL, arg1, strlen(arg1),
 			    0, 0, NULL, 0) >= 0)
 				return (0);
 			break;
@@ -684,16 +1149,22 @@ static int
 ban_check_object(struct object *o, struct vsl_log *vsl,
     const struct http *req_http)
 {
-	struct ban *b;
+	struct ban *b, *bm;
 	struct objcore *oc;
 	struct ban * volatile b0;
+	struct ban_shard *bs;
+	struct ban_oclist *bo;
+	struct ban_group *g;
+	struct ban_hcache hc;
 	unsigned tests, skipped;
+	char *arg1;
 
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 	CHECK_OBJ_ORNULL(req_http, HTTP_MAGIC);
 	oc = o->objcore;
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->ban, BAN_MAGIC);
+	bs = ban_shard(oc);
 
 	b0 = ban_start;
 	CHECK_OBJ_NOTNULL(b0, BAN_MAGIC);
@@ -708,33 +1179,57 @@ ban_check_object(struct object *o, struct vsl_log *vsl,
 	 */
 	tests = 0;
 	skipped = 0;
+	hc.n = 0;
+	g = NULL;
 	for (b = b0; b != oc->ban; b = VTAILQ_NEXT(b, list)) {
 		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+		if (b->group != NULL) {
+			/* One lookup covers all the bans in the group */
+			if (b->group == g)
+				continue;
+			g = b->group;
+			CHECK_OBJ_NOTNULL(g, BAN_GROUP_MAGIC);
+			if (req_http == NULL && (b->flags & BAN_F_REQ)) {
+				skipped++;
+				continue;
+			}
+			tests++;
+			arg1 = ban_getarg(&hc, g->arg1, g->arg1_spec,
+			    o->http, req_http);
+			if (arg1 == NULL)
+				continue;
+			bm = ban_group_match(g, arg1, bs, oc);
+			if (bm != NULL) {
+				b = bm;
+				break;
+			}
+			continue;
+		}
 		if (b->flags & BAN_F_GONE)
 			continue;
-		if ((b->flags & BAN_F_LURK) &&
-		    (b->flags & BAN_F_LURK) == (oc->flags & OC_F_LURK)) {
-			AZ(b->flags & BAN_F_REQ);
+		if (ban_lurked(b, bs, oc))
 			/* Lurker already tested this */
 			continue;
-		}
 		if (req_http == NULL && (b->flags & BAN_F_REQ)) {
 			/*
 			 * We cannot test this one, but there might
 			 * be other bans that match, so we soldier on
 			 */
 			skipped++;
-		} else if (ban_evaluate(b->spec, o->http, req_http, &tests))
+		} else if (ban_evaluate(b, o->http, req_http, &hc, &tests))
 			break;
 	}
 
-	Lck_Lock(&ban_mtx);
-	VSC_C_main->bans_tested++;
-	VSC_C_main->bans_tests_tested += tests;
+	(void)VATOMIC_ADD(&VSC_C_main->bans_tested, 1);
+	(void)VATOMIC_ADD(&VSC_C_main->bans_tests_tested, tests);
+
+	Lck_Lock(&bs->mtx);
+	bs->vsc->tested++;
+	bs->vsc->tests_tested += tests;
 
 	if (b == oc->ban && skipped > 0) {
 		AZ(req_http);
-		Lck_Unlock(&ban_mtx);
+		Lck_Unlock(&bs->mtx);
 		/*
 		 * Not banned, but some tests were skipped, so we cannot know
 		 * for certain that it cannot be, so we just have to give up.
@@ -742,14 +1237,17 @@ ban_check_object(struct object *o, struct vsl_log *vsl,
 		return (-1);
 	}
 
-	oc->ban->refcount--;
-	VTAILQ_REMOVE(&oc->ban->objcore, oc, ban_list);
+	bo = &oc->ban->oclist[bs->n];
+	bo->refcount--;
+	VTAILQ_REMOVE(&bo->objcore, oc, ban_list);
 	if (b == oc->ban) {	/* not banned */
-		b->flags &= ~BAN_F_LURK;
-		VTAILQ_INSERT_TAIL(&b0->objcore, oc, ban_list);
-		b0->refcount++;
-	}
-	Lck_Unlock(&ban_mtx);
+		bo->flags &= ~BAN_F_LURK;
+		bo = &b0->oclist[bs->n];
+		VTAILQ_INSERT_TAIL(&bo->objcore, oc, ban_list);
+		bo->refcount++;
+	} else
+		bs->vsc->objcore--;
+	Lck_Unlock(&bs->mtx);
 
 	if (b == oc->ban) {	/* not banned */
 		oc->ban = b0;
@@ -774,14 +1272,40 @@ BAN_CheckObject(struct object *o, struct req *req)
 	return (ban_check_object(o, req->vsl, req->http) > 0);
 }
 
+/*--------------------------------------------------------------------
+ * Is the object known to be clean of bans, without locks ?
+ */
+
+int
+BAN_Fresh(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	return (oc->ban == ban_start);
+}
+
+/*--------------------------------------------------------------------
+ * Remove the last ban, if nobody references it.
+ *
+ * All the shard locks are held while we look, so that nobody can pick
+ * up ban_start in BAN_NewObjCore() while it is still the last ban.
+ */
+
 static struct ban *
 ban_CheckLast(void)
 {
 	struct ban *b;
+	unsigned u;
+	int r;
 
 	Lck_AssertHeld(&ban_mtx);
 	b = VTAILQ_LAST(&ban_head, banhead_s);
-	if (b != VTAILQ_FIRST(&ban_head) && b->refcount == 0) {
+	if (b == VTAILQ_FIRST(&ban_head) || b->refcount != 0)
+		return (NULL);
+	for (u = 0; u < ban_nshard; u++)
+		Lck_Lock(&ban_shards[u].mtx);
+	r = ban_refcount(b);
+	if (r == 0) {
 		if (b->flags & BAN_F_GONE)
 			VSC_C_main->bans_gone--;
 		if (b->flags & BAN_F_REQ)
@@ -789,20 +1313,47 @@ ban_CheckLast(void)
 		VSC_C_main->bans--;
 		VSC_C_main->bans_deleted++;
 		VTAILQ_REMOVE(&ban_head, b, list);
-	} else {
-		b = NULL;
+		ban_decompile(b);
 	}
-	return (b);
+	for (u = ban_nshard; u > 0; u--)
+		Lck_Unlock(&ban_shards[u - 1].mtx);
+	return (r == 0 ? b : NULL);
 }
 
 /*--------------------------------------------------------------------
- * Ban lurker thread
+ * Get rid of as many unreferenced bans at the end of the list as we can
+ */
+
+static void
+ban_cleantail(void)
+{
+	struct ban *b;
+
+	do {
+		Lck_Lock(&ban_mtx);
+		b = ban_CheckLast();
+		if (b != NULL)
+			/* Notify stevedores */
+			STV_BanInfo(BI_DROP, b->spec, ban_len(b->spec));
+		Lck_Unlock(&ban_mtx);
+		if (b != NULL)
+			BAN_Free(b);
+	} while (b != NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Ban lurker thread, one per shard
+ *
+ * Each lurker holds a reference on the last ban while it walks the
+ * list, so that the other lurkers cannot remove bans under it.
  */
 
 static int
-ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
+ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass,
+    struct ban_shard *bs)
 {
-	struct ban *b, *b0, *b2;
+	struct ban *b, *b0, *bt;
+	struct ban_oclist *bo;
 	struct objhead *oh;
 	struct objcore *oc, *oc2;
 	struct object *o;
@@ -812,16 +1363,9 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 	AZ(pass & ~BAN_F_LURK);
 
 	/* First route the last ban(s) */
-	do {
-		Lck_Lock(&ban_mtx);
-		b2 = ban_CheckLast();
-		if (b2 != NULL)
-			/* Notify stevedores */
-			STV_BanInfo(BI_DROP, b2->spec, ban_len(b2->spec));
-		Lck_Unlock(&ban_mtx);
-		if (b2 != NULL)
-			BAN_Free(b2);
-	} while (b2 != NULL);
+	ban_cleantail();
+
+	bt = ban_tailref();
 
 	/*
 	 * Find out if we have any bans we can do something about
@@ -829,31 +1373,37 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 	 */
 	i = 0;
 	b0 = NULL;
+	Lck_Lock(&bs->mtx);
 	VTAILQ_FOREACH(b, &ban_head, list) {
+		if (b == bt)
+			break;
 		if (b->flags & BAN_F_GONE)
 			continue;
 		if (b->flags & BAN_F_REQ)
 			continue;
-		if (b == VTAILQ_LAST(&ban_head, banhead_s))
-			continue;
 		if (b0 == NULL)
 			b0 = b;
 		i++;
-		b->flags &= ~BAN_F_LURK;
-		b->flags |= pass;
+		b->oclist[bs->n].flags &= ~BAN_F_LURK;
+		b->oclist[bs->n].flags |= pass;
 	}
+	Lck_Unlock(&bs->mtx);
 	if (DO_DEBUG(DBG_LURKER))
-		VSLb(vsl, SLT_Debug, "lurker: %d actionable bans", i);
-	if (i == 0)
+		VSLb(vsl, SLT_Debug, "lurker %u: %d actionable bans",
+		    bs->n, i);
+	if (i == 0) {
+		BAN_TailDeref(&bt);
 		return (0);
+	}
 
 	VTAILQ_FOREACH_REVERSE(b, &ban_head, banhead_s, list) {
+		bo = &b->oclist[bs->n];
 		if (DO_DEBUG(DBG_LURKER))
-			VSLb(vsl, SLT_Debug, "lurker doing %f %d",
-			    ban_time(b->spec), b->refcount);
+			VSLb(vsl, SLT_Debug, "lurker %u doing %f %d",
+			    bs->n, ban_time(b->spec), bo->refcount);
 		while (1) {
-			Lck_Lock(&ban_mtx);
-			oc = VTAILQ_FIRST(&b->objcore);
+			Lck_Lock(&bs->mtx);
+			oc = VTAILQ_FIRST(&bo->objcore);
 			if (oc == NULL)
 				break;
 			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -865,7 +1415,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 			oh = oc->objhead;
 			CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 			if (Lck_Trylock(&oh->mtx)) {
-				Lck_Unlock(&ban_mtx);
+				Lck_Unlock(&bs->mtx);
 				VSL_Flush(vsl, 0);
 				VTIM_sleep(cache_param->ban_lurker_sleep);
 				continue;
@@ -880,7 +1430,7 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 					break;
 			if (oc2 == NULL) {
 				Lck_Unlock(&oh->mtx);
-				Lck_Unlock(&ban_mtx);
+				Lck_Unlock(&bs->mtx);
 				VTIM_sleep(cache_param->ban_lurker_sleep);
 				continue;
 			}
@@ -890,20 +1440,21 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 			 */
 			if (oc->flags & OC_F_BUSY) {
 				oc->flags |= pass;
-				VTAILQ_REMOVE(&b->objcore, oc, ban_list);
-				VTAILQ_INSERT_TAIL(&b->objcore, oc, ban_list);
+				VTAILQ_REMOVE(&bo->objcore, oc, ban_list);
+				VTAILQ_INSERT_TAIL(&bo->objcore, oc, ban_list);
 				Lck_Unlock(&oh->mtx);
-				Lck_Unlock(&ban_mtx);
+				Lck_Unlock(&bs->mtx);
 				continue;
 			}
 			/*
 			 * Grab a reference to the OC and we can let go of
-			 * the BAN mutex
+			 * the shard mutex
 			 */
 			AN(oc->refcnt);
-			oc->refcnt++;
+			(void)VATOMIC_ADD(&oc->refcnt, 1);
 			oc->flags &= ~OC_F_LURK;
-			Lck_Unlock(&ban_mtx);
+			bs->vsc->lurker_tested++;
+			Lck_Unlock(&bs->mtx);
 			/*
 			 * Get the object and check it against all relevant bans
 			 */
@@ -912,13 +1463,17 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 			if (DO_DEBUG(DBG_LURKER))
 				VSLb(vsl, SLT_Debug, "lurker got: %p %d",
 				    oc, i);
-			if (i == -1) {
+			if (i == -1 || oc->ban == b) {
 				/* Not banned, not moved */
 				oc->flags |= pass;
-				Lck_Lock(&ban_mtx);
-				VTAILQ_REMOVE(&b->objcore, oc, ban_list);
-				VTAILQ_INSERT_TAIL(&b->objcore, oc, ban_list);
-				Lck_Unlock(&ban_mtx);
+				Lck_Lock(&bs->mtx);
+				VTAILQ_REMOVE(&bo->objcore, oc, ban_list);
+				VTAILQ_INSERT_TAIL(&bo->objcore, oc, ban_list);
+				Lck_Unlock(&bs->mtx);
+			} else if (i == 1) {
+				Lck_Lock(&bs->mtx);
+				bs->vsc->lurker_banned++;
+				Lck_Unlock(&bs->mtx);
 			}
 			Lck_Unlock(&oh->mtx);
 			if (DO_DEBUG(DBG_LURKER))
@@ -927,35 +1482,47 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl, unsigned pass)
 			(void)HSH_Deref(&wrk->stats, NULL, &o);
 			VTIM_sleep(cache_param->ban_lurker_sleep);
 		}
-		Lck_AssertHeld(&ban_mtx);
+		Lck_AssertHeld(&bs->mtx);
+		Lck_Unlock(&bs->mtx);
 		if (!(b->flags & BAN_F_REQ)) {
-			if (!(b->flags & BAN_F_GONE)) {
+			/* The ban is gone once all shards are done with it */
+			Lck_Lock(&ban_mtx);
+			if (!bo->lurked) {
+				bo->lurked = 1;
+				b->lurked++;
+			}
+			if (b->lurked == ban_nshard &&
+			    !(b->flags & BAN_F_GONE)) {
 				b->flags |= BAN_F_GONE;
 				VSC_C_main->bans_gone++;
 			}
+			Lck_Unlock(&ban_mtx);
 			if (DO_DEBUG(DBG_LURKER))
-				VSLb(vsl, SLT_Debug, "lurker BAN %f now gone",
-				    ban_time(b->spec));
+				VSLb(vsl, SLT_Debug,
+				    "lurker %u BAN %f done (%u/%u)",
+				    bs->n, ban_time(b->spec),
+				    b->lurked, ban_nshard);
 		}
-		Lck_Unlock(&ban_mtx);
 		VTIM_sleep(cache_param->ban_lurker_sleep);
 		if (b == b0)
 			break;
 	}
+	bs->vsc->lurker_passes++;
+	BAN_TailDeref(&bt);
 	return (1);
 }
 
 static void * __match_proto__(bgthread_t)
 ban_lurker(struct worker *wrk, void *priv)
 {
-	struct ban *bf;
+	struct ban_shard *bs;
 	unsigned pass = (1 << LURK_SHIFT);
 	struct vsl_log vsl;
-
 	int i = 0;
+
+	CAST_OBJ_NOTNULL(bs, priv, BAN_SHARD_MAGIC);
 	VSL_Setup(&vsl, NULL, 0);
 
-	(void)priv;
 	while (1) {
 
 		while (cache_param->ban_lurker_sleep == 0.0) {
@@ -963,20 +1530,11 @@ ban_lurker(struct worker *wrk, void *priv)
 			 * Ban-lurker is disabled:
 			 * Clean the last ban, if possible, and sleep
 			 */
-			Lck_Lock(&ban_mtx);
-			bf = ban_CheckLast();
-			if (bf != NULL)
-				/* Notify stevedores */
-				STV_BanInfo(BI_DROP, bf->spec,
-					    ban_len(bf->spec));
-			Lck_Unlock(&ban_mtx);
-			if (bf != NULL)
-				BAN_Free(bf);
-			else
-				VTIM_sleep(1.0);
+			ban_cleantail();
+			VTIM_sleep(1.0);
 		}
 
-		i = ban_lurker_work(wrk, &vsl, pass);
+		i = ban_lurker_work(wrk, &vsl, pass, bs);
 		VSL_Flush(&vsl, 0);
 		WRK_SumStat(wrk);
 		if (i) {
@@ -1092,6 +1650,8 @@ static void
 ccf_ban_list(struct cli *cli, const char * const *av, void *priv)
 {
 	struct ban *b, *bl;
+	struct objcore *oc;
+	unsigned u;
 
 	(void)av;
 	(void)priv;
@@ -1104,18 +1664,20 @@ ccf_ban_list(struct cli *cli, const char * const *av, void *priv)
 		if (b == bl && !DO_DEBUG(DBG_LURKER))
 			break;
 		VCLI_Out(cli, "%10.6f %5u%s\t", ban_time(b->spec),
-		    bl == b ? b->refcount - 1 : b->refcount,
+		    bl == b ? ban_refcount(b) - 1 : ban_refcount(b),
 		    b->flags & BAN_F_GONE ? "G" : " ");
 		ban_render(cli, b->spec);
 		VCLI_Out(cli, "\n");
 		if (VCLI_Overflow(cli))
 			break;
 		if (DO_DEBUG(DBG_LURKER)) {
-			Lck_Lock(&ban_mtx);
-			struct objcore *oc;
-			VTAILQ_FOREACH(oc, &b->objcore, ban_list)
-				VCLI_Out(cli, "     %p\n", oc);
-			Lck_Unlock(&ban_mtx);
+			for (u = 0; u < ban_nshard; u++) {
+				Lck_Lock(&ban_shards[u].mtx);
+				VTAILQ_FOREACH(oc, &b->oclist[u].objcore,
+				    ban_list)
+					VCLI_Out(cli, "     %p\n", oc);
+				Lck_Unlock(&ban_shards[u].mtx);
+			}
 		}
 	}
 
@@ -1132,9 +1694,32 @@ static struct cli_proto ban_cmds[] = {
 void
 BAN_Init(void)
 {
+	struct ban_shard *bs;
+	unsigned u;
+	char ident[8];
 
 	Lck_New(&ban_mtx, lck_ban);
 	CLI_AddFuncs(ban_cmds);
+
+	ban_nshard = cache_param->ban_shards;
+	assert(ban_nshard > 0);
+	ban_shards = calloc(ban_nshard, sizeof *ban_shards);
+	AN(ban_shards);
+	for (u = 0; u < ban_nshard; u++) {
+		bs = &ban_shards[u];
+		bs->magic = BAN_SHARD_MAGIC;
+		bs->n = u;
+		Lck_New(&bs->mtx, lck_banshard);
+		if (ban_nshard == 1)
+			bprintf(bs->name, "%s", "ban-lurker");
+		else
+			bprintf(bs->name, "ban-lurker-%u", u);
+		bprintf(ident, "%u", u);
+		bs->vsc = VSM_Alloc(sizeof *bs->vsc,
+		    VSC_CLASS, VSC_TYPE_BAN, ident);
+		AN(bs->vsc);
+	}
+
 	assert(BAN_F_LURK == OC_F_LURK);
 	AN((1 << LURK_SHIFT) & BAN_F_LURK);
 	AN((2 << LURK_SHIFT) & BAN_F_LURK);
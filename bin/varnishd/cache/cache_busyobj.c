@@ -69,6 +69,7 @@ vbo_New(void)
 	bo->magic = BUSYOBJ_MAGIC;
 	bo->end = (char *)bo + sz;
 	Lck_New(&bo->mtx, lck_busyobj);
+	AZ(pthread_cond_init(&bo->cond, NULL));
 	return (bo);
 }
 
@@ -82,6 +83,7 @@ VBO_Free(struct busyobj **bop)
 	*bop = NULL;
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	AZ(bo->refcount);
+	AZ(pthread_cond_destroy(&bo->cond));
 	Lck_Delete(&bo->mtx);
 	MPL_Free(vbopool, bo);
 }
@@ -114,14 +116,14 @@ VBO_GetBusyObj(struct worker *wrk)
 	assert(p < bo->end);
 
 	nhttp = (uint16_t)cache_param->http_max_hdr;
-	sz = HTTP_estimate(nhttp);
+	sz = HTTP_estimate(nhttp, 1);
 
-	bo->bereq = HTTP_create(p, nhttp);
+	bo->bereq = HTTP_create(p, nhttp, 1);
 	p += sz;
 	p = (void*)PRNDUP(p);
 	assert(p < bo->end);
 
-	bo->beresp = HTTP_create(p, nhttp);
+	bo->beresp = HTTP_create(p, nhttp, 1);
 	p += sz;
 	p = (void*)PRNDUP(p);
 	assert(p < bo->end);
@@ -166,6 +168,8 @@ VBO_DerefBusyObj(struct worker *wrk, struct busyobj **pbo)
 		Lck_Lock(&bo->mtx);
 		assert(bo->refcount > 0);
 		r = --bo->refcount;
+		if (r == 1)
+			AZ(pthread_cond_broadcast(&bo->cond));
 		Lck_Unlock(&bo->mtx);
 	}
 
@@ -179,6 +183,14 @@ VBO_DerefBusyObj(struct worker *wrk, struct busyobj **pbo)
 		(void)HSH_Deref(&wrk->stats, NULL, &bo->fetch_obj);
 	}
 
+	if (bo->ims_obj != NULL) {
+		AN(wrk);
+		(void)HSH_Deref(&wrk->stats, NULL, &bo->ims_obj);
+	}
+
+	if (bo->trim_st != NULL)
+		STV_free(bo->trim_st);
+
 	memset(&bo->refcount, 0,
 	    sizeof *bo - offsetof(struct busyobj, refcount));
 
@@ -187,3 +199,63 @@ VBO_DerefBusyObj(struct worker *wrk, struct busyobj **pbo)
 	else
 		VBO_Free(&bo);
 }
+
+/*--------------------------------------------------------------------
+ * Streaming delivery follows the fetch: the object length only grows
+ * under the busyobj lock, and every step is broadcast to the readers.
+ */
+
+void
+VBO_extend(struct busyobj *bo, ssize_t l)
+{
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->fetch_obj, OBJECT_MAGIC);
+	if (l == 0)
+		return;
+	assert(l > 0);
+	Lck_Lock(&bo->mtx);
+	bo->fetch_obj->len += l;
+	AZ(pthread_cond_broadcast(&bo->cond));
+	Lck_Unlock(&bo->mtx);
+}
+
+void
+VBO_setstate(struct busyobj *bo, enum busyobj_state_e next)
+{
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	Lck_Lock(&bo->mtx);
+	bo->state = next;
+	AZ(pthread_cond_broadcast(&bo->cond));
+	Lck_Unlock(&bo->mtx);
+}
+
+void
+VBO_waitstate(struct busyobj *bo, enum busyobj_state_e want)
+{
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	Lck_Lock(&bo->mtx);
+	while (bo->state < want)
+		(void)Lck_CondWait(&bo->cond, &bo->mtx, NULL);
+	Lck_Unlock(&bo->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * A pass object belongs to the request alone, it must not be freed
+ * until the fetch has let go of it.
+ */
+
+void
+VBO_waitlast(struct busyobj *bo)
+{
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->fetch_obj, OBJECT_MAGIC);
+	AZ(bo->fetch_obj->objcore->objhead);
+	Lck_Lock(&bo->mtx);
+	while (bo->refcount > 1)
+		(void)Lck_CondWait(&bo->cond, &bo->mtx, NULL);
+	Lck_Unlock(&bo->mtx);
+}
@@ -54,14 +54,17 @@ VDI_CloseFd(struct vbc **vbp)
 
 	bp = vc->backend;
 
-	VSLb(vc->vsl, SLT_BackendClose, "%s", bp->display_name);
-
-	/*
-	 * Checkpoint log to flush all info related to this connection
-	 * before the OS reuses the FD
-	 */
-	VSL_Flush(vc->vsl, 0);
-	vc->vsl = NULL;
+	/* Piped connections handed to the event loop have no log left */
+	if (vc->vsl != NULL) {
+		VSLb(vc->vsl, SLT_BackendClose, "%s", bp->display_name);
+
+		/*
+		 * Checkpoint log to flush all info related to this
+		 * connection before the OS reuses the FD
+		 */
+		VSL_Flush(vc->vsl, 0);
+		vc->vsl = NULL;
+	}
 
 	VTCP_close(&vc->fd);
 	VBE_DropRefConn(bp);
@@ -92,10 +95,9 @@ VDI_RecycleFd(struct vbc **vbp)
 	VSL_Flush(vc->vsl, 0);
 	vc->vsl = NULL;
 
-	Lck_Lock(&bp->mtx);
 	VSC_C_main->backend_recycle++;
-	VTAILQ_INSERT_HEAD(&bp->connlist, vc, list);
-	VBE_DropRefLocked(bp);
+	VBE_RecycleConn(vc);
+	VBE_DropRef(bp);
 }
 
 /* Get a connection --------------------------------------------------*/
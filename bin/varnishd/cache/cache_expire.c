@@ -47,11 +47,23 @@
  *                                 +---------------------------->+
  *                                     keep
  *
+ * With the expiry_wheel parameter, the binary heap is replaced with a
+ * number of hierarchical timer wheels, picked by hashing the objcore,
+ * each with its own lock.  Each wheel has four levels of 256 slots, at
+ * the bottom one slot per tick of EXP_WHEEL_TICK seconds, and each level
+ * up 256 times coarser.  When a level wraps, the next slot of the level
+ * above is cascaded down.  Slots which come due are moved to the due
+ * list, which the timer thread empties a batch at a time.
+ *
+ * oc->timer_idx is the slot number plus one in that case, so that
+ * BINHEAP_NOIDX still means "not on the timer".
+ *
  */
 
 #include "config.h"
 
 #include <math.h>
+#include <stdlib.h>
 
 #include "cache.h"
 
@@ -59,9 +71,28 @@
 #include "hash/hash_slinger.h"
 #include "vtim.h"
 
+#define EXP_WHEEL_TICK		0.1
+#define EXP_WHEEL_BITS		8
+#define EXP_WHEEL_SLOTS		(1U << EXP_WHEEL_BITS)
+#define EXP_WHEEL_LEVELS	4
+#define EXP_WHEEL_DUE		(EXP_WHEEL_LEVELS * EXP_WHEEL_SLOTS)
+#define EXP_WHEEL_SHARDS	16
+#define EXP_WHEEL_BATCH		64
+
+VTAILQ_HEAD(exp_slot, objcore);
+
+struct exp_wheel {
+	unsigned		magic;
+#define EXP_WHEEL_MAGIC		0x2c51f0e7
+	struct lock		mtx;
+	uint64_t		tick;		/* Last tick moved to due */
+	struct exp_slot		slot[EXP_WHEEL_DUE + 1];
+};
+
 static pthread_t exp_thread;
 static struct binheap *exp_heap;
 static struct lock exp_mtx;
+static struct exp_wheel *exp_wheels;
 
 /*--------------------------------------------------------------------
  * struct exp manipulations
@@ -108,7 +139,7 @@ EXP_ACCESS(keep, 0.,)
  * adjusted for defaults and by per-session limits.
  */
 
-static double
+double
 EXP_Keep(const struct req *req, const struct object *o)
 {
 	double r;
@@ -145,6 +176,149 @@ EXP_Ttl(const struct req *req, const struct object *o)
 	return (o->exp.entered + r);
 }
 
+/*--------------------------------------------------------------------
+ * Timer wheels
+ */
+
+static struct exp_wheel *
+exp_wheel(const struct objcore *oc)
+{
+	uintptr_t u;
+
+	AN(exp_wheels);
+	u = (uintptr_t)oc;
+	u ^= u >> 12;
+	return (&exp_wheels[(u >> 6) % EXP_WHEEL_SHARDS]);
+}
+
+static void
+exp_wheel_insert(struct exp_wheel *w, struct objcore *oc)
+{
+	uint64_t t, d;
+	double dt;
+	unsigned l, u;
+
+	Lck_AssertHeld(&w->mtx);
+	assert(oc->timer_idx == BINHEAP_NOIDX);
+	dt = ceil(oc->timer_when / EXP_WHEEL_TICK) - (double)w->tick;
+	if (dt <= 0.) {
+		u = EXP_WHEEL_DUE;
+	} else {
+		/* Clamp to the span of the wheel, we'll cascade again */
+		if (dt >= (double)(1ULL << (EXP_WHEEL_BITS * EXP_WHEEL_LEVELS)))
+			d = (1ULL << (EXP_WHEEL_BITS * EXP_WHEEL_LEVELS)) - 1;
+		else
+			d = (uint64_t)dt;
+		t = w->tick + d;
+		for (l = 0; d >= (1ULL << (EXP_WHEEL_BITS * (l + 1))); l++)
+			continue;
+		u = l * EXP_WHEEL_SLOTS +
+		    ((t >> (EXP_WHEEL_BITS * l)) & (EXP_WHEEL_SLOTS - 1));
+	}
+	VTAILQ_INSERT_TAIL(&w->slot[u], oc, timer_list);
+	oc->timer_idx = u + 1;
+}
+
+static void
+exp_wheel_delete(struct exp_wheel *w, struct objcore *oc)
+{
+
+	Lck_AssertHeld(&w->mtx);
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+	assert(oc->timer_idx <= EXP_WHEEL_DUE + 1);
+	VTAILQ_REMOVE(&w->slot[oc->timer_idx - 1], oc, timer_list);
+	oc->timer_idx = BINHEAP_NOIDX;
+}
+
+/* Move the content of a slot to where it belongs now */
+
+static void
+exp_wheel_cascade(struct exp_wheel *w, unsigned u)
+{
+	struct objcore *oc;
+
+	while (1) {
+		oc = VTAILQ_FIRST(&w->slot[u]);
+		if (oc == NULL)
+			break;
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		exp_wheel_delete(w, oc);
+		exp_wheel_insert(w, oc);
+	}
+}
+
+static void
+exp_wheel_advance(struct exp_wheel *w, double now)
+{
+	uint64_t t;
+	unsigned l;
+
+	Lck_AssertHeld(&w->mtx);
+	t = (uint64_t)floor(now / EXP_WHEEL_TICK);
+	while (w->tick < t) {
+		w->tick++;
+		for (l = 1; l < EXP_WHEEL_LEVELS; l++) {
+			if (w->tick & ((1ULL << (EXP_WHEEL_BITS * l)) - 1))
+				break;
+			exp_wheel_cascade(w, l * EXP_WHEEL_SLOTS +
+			    ((w->tick >> (EXP_WHEEL_BITS * l)) &
+			    (EXP_WHEEL_SLOTS - 1)));
+		}
+		exp_wheel_cascade(w, w->tick & (EXP_WHEEL_SLOTS - 1));
+	}
+}
+
+/*--------------------------------------------------------------------
+ * The lock which protects the timer position of this objcore, and the
+ * operations on it.  The caller also holds the lru->mtx.
+ */
+
+static struct lock *
+exp_lck(const struct objcore *oc)
+{
+
+	if (exp_wheels == NULL)
+		return (&exp_mtx);
+	return (&exp_wheel(oc)->mtx);
+}
+
+static void
+exp_timer_insert(struct objcore *oc)
+{
+
+	if (exp_wheels == NULL)
+		binheap_insert(exp_heap, oc);
+	else
+		exp_wheel_insert(exp_wheel(oc), oc);
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+}
+
+static void
+exp_timer_delete(struct objcore *oc)
+{
+
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+	if (exp_wheels == NULL)
+		binheap_delete(exp_heap, oc->timer_idx);
+	else
+		exp_wheel_delete(exp_wheel(oc), oc);
+	assert(oc->timer_idx == BINHEAP_NOIDX);
+}
+
+static void
+exp_timer_reorder(struct objcore *oc)
+{
+
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+	if (exp_wheels == NULL) {
+		binheap_reorder(exp_heap, oc->timer_idx);
+	} else {
+		exp_wheel_delete(exp_wheel(oc), oc);
+		exp_wheel_insert(exp_wheel(oc), oc);
+	}
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+}
+
 /*--------------------------------------------------------------------
  * When & why does the timer fire for this object ?
  */
@@ -158,7 +332,7 @@ update_object_when(const struct object *o)
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 	oc = o->objcore;
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-	Lck_AssertHeld(&exp_mtx);
+	Lck_AssertHeld(exp_lck(oc));
 
 	when = EXP_Keep(NULL, o);
 	w2 = EXP_Grace(NULL, o);
@@ -180,10 +354,9 @@ exp_insert(struct objcore *oc, struct lru *lru)
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
 
 	Lck_AssertHeld(&lru->mtx);
-	Lck_AssertHeld(&exp_mtx);
+	Lck_AssertHeld(exp_lck(oc));
 	assert(oc->timer_idx == BINHEAP_NOIDX);
-	binheap_insert(exp_heap, oc);
-	assert(oc->timer_idx != BINHEAP_NOIDX);
+	exp_timer_insert(oc);
 	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
 }
 
@@ -201,10 +374,10 @@ EXP_Inject(struct objcore *oc, struct lru *lru, double when)
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
 
 	Lck_Lock(&lru->mtx);
-	Lck_Lock(&exp_mtx);
+	Lck_Lock(exp_lck(oc));
 	oc->timer_when = when;
 	exp_insert(oc, lru);
-	Lck_Unlock(&exp_mtx);
+	Lck_Unlock(exp_lck(oc));
 	Lck_Unlock(&lru->mtx);
 }
 
@@ -232,10 +405,10 @@ EXP_Insert(struct object *o)
 	lru = oc_getlru(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
 	Lck_Lock(&lru->mtx);
-	Lck_Lock(&exp_mtx);
+	Lck_Lock(exp_lck(oc));
 	(void)update_object_when(o);
 	exp_insert(oc, lru);
-	Lck_Unlock(&exp_mtx);
+	Lck_Unlock(exp_lck(oc));
 	Lck_Unlock(&lru->mtx);
 	oc_updatemeta(oc);
 }
@@ -308,17 +481,14 @@ EXP_Rearm(const struct object *o)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	lru = oc_getlru(oc);
 	Lck_Lock(&lru->mtx);
-	Lck_Lock(&exp_mtx);
+	Lck_Lock(exp_lck(oc));
 	/*
 	 * The hang-man might have this object of the binheap while
 	 * tending to a timer.  If so, we do not muck with it here.
 	 */
-	if (oc->timer_idx != BINHEAP_NOIDX && update_object_when(o)) {
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_reorder(exp_heap, oc->timer_idx);
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-	}
-	Lck_Unlock(&exp_mtx);
+	if (oc->timer_idx != BINHEAP_NOIDX && update_object_when(o))
+		exp_timer_reorder(oc);
+	Lck_Unlock(exp_lck(oc));
 	Lck_Unlock(&lru->mtx);
 	oc_updatemeta(oc);
 }
@@ -415,6 +585,89 @@ exp_timer(struct worker *wrk, void *priv)
 	NEEDLESS_RETURN(NULL);
 }
 
+/*--------------------------------------------------------------------
+ * The timer thread for the wheels.  Expire up to a batch of objects
+ * from the due list of a wheel under one lock hold.
+ *
+ * Returns true if there may be more to do right away.
+ */
+
+static int
+exp_wheel_expire(struct worker *wrk, struct vsl_log *vsl, struct exp_wheel *w,
+    double t)
+{
+	struct objcore *oc, *oc_array[EXP_WHEEL_BATCH];
+	struct object *o;
+	struct lru *lru;
+	unsigned u;
+	int i, n;
+
+	CHECK_OBJ_NOTNULL(w, EXP_WHEEL_MAGIC);
+	n = 0;
+	Lck_Lock(&w->mtx);
+	exp_wheel_advance(w, t);
+	while (n < EXP_WHEEL_BATCH) {
+		oc = VTAILQ_FIRST(&w->slot[EXP_WHEEL_DUE]);
+		if (oc == NULL)
+			break;
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+		/* If the object is busy, try again next tick */
+		if (oc->flags & OC_F_BUSY) {
+			exp_wheel_delete(w, oc);
+			u = (w->tick + 1) & (EXP_WHEEL_SLOTS - 1);
+			VTAILQ_INSERT_TAIL(&w->slot[u], oc, timer_list);
+			oc->timer_idx = u + 1;
+			continue;
+		}
+
+		/* Wrong lock order, so punt if we cannot get it */
+		lru = oc_getlru(oc);
+		CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+		if (Lck_Trylock(&lru->mtx))
+			break;
+		exp_wheel_delete(w, oc);
+		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+		Lck_Unlock(&lru->mtx);
+		oc_array[n++] = oc;
+	}
+	Lck_Unlock(&w->mtx);
+
+	for (i = 0; i < n; i++) {
+		oc = oc_array[i];
+		VSC_C_main->n_expired++;
+		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+		o = oc_getobj(&wrk->stats, oc);
+		VSLb(vsl, SLT_ExpKill, "%u %.0f",
+		    oc_getxid(&wrk->stats, oc), EXP_Ttl(NULL, o) - t);
+		(void)HSH_Deref(&wrk->stats, oc, NULL);
+	}
+	return (n == EXP_WHEEL_BATCH);
+}
+
+static void * __match_proto__(bgthread_t)
+exp_wheel_timer(struct worker *wrk, void *priv)
+{
+	struct vsl_log vsl;
+	unsigned u;
+	int more;
+	double t;
+
+	(void)priv;
+	VSL_Setup(&vsl, NULL, 0);
+	while (1) {
+		t = VTIM_real();
+		more = 0;
+		for (u = 0; u < EXP_WHEEL_SHARDS; u++)
+			more |= exp_wheel_expire(wrk, &vsl, &exp_wheels[u], t);
+		VSL_Flush(&vsl, 0);
+		WRK_SumStat(wrk);
+		if (!more)
+			VTIM_sleep(cache_param->expiry_sleep);
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
 /*--------------------------------------------------------------------
  * Attempt to make space by nuking the oldest object on the LRU list
  * which isn't in use.
@@ -428,7 +681,6 @@ EXP_NukeOne(struct busyobj *bo, struct lru *lru)
 
 	/* Find the first currently unused object on the LRU.  */
 	Lck_Lock(&lru->mtx);
-	Lck_Lock(&exp_mtx);
 	VTAILQ_FOREACH(oc, &lru->lru_head, lru_list) {
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 		assert(oc->timer_idx != BINHEAP_NOIDX);
@@ -443,11 +695,11 @@ EXP_NukeOne(struct busyobj *bo, struct lru *lru)
 	}
 	if (oc != NULL) {
 		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		binheap_delete(exp_heap, oc->timer_idx);
-		assert(oc->timer_idx == BINHEAP_NOIDX);
+		Lck_Lock(exp_lck(oc));
+		exp_timer_delete(oc);
+		Lck_Unlock(exp_lck(oc));
 		VSC_C_main->n_lru_nuked++;
 	}
-	Lck_Unlock(&exp_mtx);
 	Lck_Unlock(&lru->mtx);
 
 	if (oc == NULL)
@@ -482,7 +734,6 @@ EXP_NukeLRU(struct worker *wrk, struct vsl_log *vsl, struct lru *lru)
 	t = VTIM_real();
 	Lck_Lock(&lru->mtx);
 	while (!VTAILQ_EMPTY(&lru->lru_head)) {
-		Lck_Lock(&exp_mtx);
 		n = 0;
 		while (n < NUKEBUF) {
 			oc = VTAILQ_FIRST(&lru->lru_head);
@@ -493,15 +744,14 @@ EXP_NukeLRU(struct worker *wrk, struct vsl_log *vsl, struct lru *lru)
 
 			/* Remove from the LRU and binheap */
 			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			assert(oc->timer_idx != BINHEAP_NOIDX);
-			binheap_delete(exp_heap, oc->timer_idx);
-			assert(oc->timer_idx == BINHEAP_NOIDX);
+			Lck_Lock(exp_lck(oc));
+			exp_timer_delete(oc);
+			Lck_Unlock(exp_lck(oc));
 
 			oc_array[n++] = oc;
 			VSC_C_main->n_lru_nuked++;
 		}
 		assert(n > 0);
-		Lck_Unlock(&exp_mtx);
 		Lck_Unlock(&lru->mtx);
 
 		for (i = 0; i < n; i++) {
@@ -550,9 +800,27 @@ object_update(void *priv, void *p, unsigned u)
 void
 EXP_Init(void)
 {
+	struct exp_wheel *w;
+	unsigned u, v;
+	uint64_t t;
 
 	Lck_New(&exp_mtx, lck_exp);
-	exp_heap = binheap_new(NULL, object_cmp, object_update);
-	XXXAN(exp_heap);
-	WRK_BgThread(&exp_thread, "cache-timeout", exp_timer, NULL);
+	if (!cache_param->expiry_wheel) {
+		exp_heap = binheap_new(NULL, object_cmp, object_update);
+		XXXAN(exp_heap);
+		WRK_BgThread(&exp_thread, "cache-timeout", exp_timer, NULL);
+		return;
+	}
+	exp_wheels = calloc(EXP_WHEEL_SHARDS, sizeof *exp_wheels);
+	XXXAN(exp_wheels);
+	t = (uint64_t)floor(VTIM_real() / EXP_WHEEL_TICK);
+	for (u = 0; u < EXP_WHEEL_SHARDS; u++) {
+		w = &exp_wheels[u];
+		w->magic = EXP_WHEEL_MAGIC;
+		Lck_New(&w->mtx, lck_expwheel);
+		w->tick = t;
+		for (v = 0; v <= EXP_WHEEL_DUE; v++)
+			VTAILQ_INIT(&w->slot[v]);
+	}
+	WRK_BgThread(&exp_thread, "cache-timeout", exp_wheel_timer, NULL);
 }
@@ -64,7 +64,7 @@ FetchError2(struct busyobj *bo, const char *error, const char *more)
 		else
 			VSLb(bo->vsl, SLT_FetchError, "%s: %s", error, more);
 	}
-	bo->state = BOS_FAILED;
+	VBO_setstate(bo, BOS_FAILED);
 	return (-1);
 }
 
@@ -114,15 +114,10 @@ VFP_End(struct busyobj *bo)
 }
 
 void
-VFP_update_length(const struct busyobj *bo, ssize_t l)
+VFP_update_length(struct busyobj *bo, ssize_t l)
 {
 
-	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
-	CHECK_OBJ_NOTNULL(bo->fetch_obj, OBJECT_MAGIC);
-	if (l == 0)
-		return;
-	assert(l > 0);
-	bo->fetch_obj->len += l;
+	VBO_extend(bo, l);
 }
 
 /*--------------------------------------------------------------------
@@ -194,19 +189,43 @@ vfp_nop_bytes(struct busyobj *bo, struct http_conn *htc, ssize_t bytes)
 static int __match_proto__(vfp_end_f)
 vfp_nop_end(struct busyobj *bo)
 {
-	struct storage *st;
+	struct storage *st, *st2;
 
 	st = VTAILQ_LAST(&bo->fetch_obj->store, storagehead);
 	if (st == NULL)
 		return (0);
 
 	if (st->len == 0) {
+		Lck_Lock(&bo->mtx);
 		VTAILQ_REMOVE(&bo->fetch_obj->store, st, list);
+		Lck_Unlock(&bo->mtx);
 		STV_free(st);
 		return (0);
 	}
-	if (st->len < st->space)
+	if (st->len == st->space)
+		return (0);
+	if (!bo->do_stream) {
 		STV_trim(st, st->len, 1);
+		return (0);
+	}
+
+	/*
+	 * Streaming readers may be using the segment, so it must not move.
+	 * Instead we put a trimmed copy in its place, for readers which get
+	 * there later, and the original goes with the busyobj, when the
+	 * last of the readers are done with it.
+	 */
+	st2 = STV_trimcopy(st);
+	if (st2 == NULL) {
+		STV_trim(st, st->len, 0);
+		return (0);
+	}
+	Lck_Lock(&bo->mtx);
+	VTAILQ_INSERT_AFTER(&bo->fetch_obj->store, st, st2, list);
+	VTAILQ_REMOVE(&bo->fetch_obj->store, st, list);
+	Lck_Unlock(&bo->mtx);
+	AZ(bo->trim_st);
+	bo->trim_st = st;
 	return (0);
 }
 
@@ -246,7 +265,9 @@ FetchStorage(struct busyobj *bo, ssize_t sz)
 		return (NULL);
 	}
 	AZ(st->len);
+	Lck_Lock(&bo->mtx);
 	VTAILQ_INSERT_TAIL(&obj->store, st, list);
+	Lck_Unlock(&bo->mtx);
 	return (st);
 }
 
@@ -428,6 +449,9 @@ FetchReqBody(struct req *req, int sendbody)
  *	-1 failure, not retryable
  *	 0 success
  *	 1 failure which can be retried.
+ *
+ * A recycled connection which fails before we get any of the response
+ * can be retried, on a new connection to the same backend.
  */
 
 int
@@ -457,7 +481,8 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 
 	hp = bo->bereq;
 
-	bo->vbc = VDI_GetFd(NULL, req);
+	bo->vbc = VDI_GetFd(bo->retry_dir, req);
+	bo->retry_dir = NULL;
 	if (bo->vbc == NULL) {
 		VSLb(req->vsl, SLT_FetchError, "no backend connection");
 		return (-1);
@@ -486,6 +511,8 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 		VSLb(req->vsl, SLT_FetchError,
 		    "backend write error: %d (%s)",
 		    errno, strerror(errno));
+		if (retry > 0)
+			bo->retry_dir = VBE_Director(vc);
 		VDI_CloseFd(&bo->vbc);
 		/* XXX: other cleanup ? */
 		return (retry);
@@ -517,6 +544,8 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 			VSLb(req->vsl, SLT_FetchError,
 			    "http %sread error: EOF",
 			    first ? "first " : "");
+			if (retry > 0)
+				bo->retry_dir = VBE_Director(vc);
 			VDI_CloseFd(&bo->vbc);
 			/* XXX: other cleanup ? */
 			return (retry);
@@ -540,6 +569,53 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * The backend said 304 to our conditional fetch, copy the body of the
+ * stale object we asked about into the new one.
+ *
+ * XXX: Sharing the storage would be cheaper, but the stevedores have
+ * XXX: no notion of refcounted segments.
+ */
+
+static void
+fetch_ims(struct busyobj *bo)
+{
+	struct object *ims;
+	struct storage *st, *st2;
+	ssize_t l, w, done = 0;
+
+	ims = bo->ims_obj;
+	CHECK_OBJ_NOTNULL(ims, OBJECT_MAGIC);
+
+	VTAILQ_FOREACH(st2, &ims->store, list) {
+		l = 0;
+		while (l < st2->len) {
+			st = FetchStorage(bo, ims->len - done);
+			if (st == NULL)
+				return;
+			w = st->space - st->len;
+			if (w > st2->len - l)
+				w = st2->len - l;
+			memcpy(st->ptr + st->len, st2->ptr + l, w);
+			st->len += w;
+			VFP_update_length(bo, w);
+			l += w;
+			done += w;
+		}
+	}
+	if (ims->esidata != NULL) {
+		bo->fetch_obj->esidata = STV_alloc(bo, ims->esidata->len);
+		if (bo->fetch_obj->esidata == NULL) {
+			(void)FetchError(bo,
+			    "Could not allocate storage for esidata");
+			return;
+		}
+		memcpy(bo->fetch_obj->esidata->ptr, ims->esidata->ptr,
+		    ims->esidata->len);
+		bo->fetch_obj->esidata->len = ims->esidata->len;
+	}
+}
+
 /*--------------------------------------------------------------------
  * This function is either called by the requesting thread OR by a
  * dedicated body-fetch work-thread.
@@ -583,7 +659,7 @@ FetchBody(struct worker *wrk, void *priv)
 	AZ(bo->vgz_rx);
 	AZ(VTAILQ_FIRST(&obj->store));
 
-	bo->state = BOS_FETCHING;
+	VBO_setstate(bo, BOS_FETCHING);
 
 	/* XXX: pick up estimate from objdr ? */
 	cl = 0;
@@ -591,6 +667,11 @@ FetchBody(struct worker *wrk, void *priv)
 	switch (bo->body_status) {
 	case BS_NONE:
 		mklen = 0;
+		if (bo->ims_obj != NULL) {
+			fetch_ims(bo);
+			(void)HSH_Deref(&wrk->stats, NULL, &bo->ims_obj);
+			mklen = 1;
+		}
 		break;
 	case BS_ZERO:
 		mklen = 1;
@@ -685,8 +766,7 @@ FetchBody(struct worker *wrk, void *priv)
 			VDI_RecycleFd(&bo->vbc);
 
 
-		/* XXX: Atomic assignment, needs volatile/membar ? */
-		bo->state = BOS_FINISHED;
+		VBO_setstate(bo, BOS_FINISHED);
 	}
 	if (obj->objcore->objhead != NULL)
 		HSH_Complete(obj->objcore);
@@ -48,6 +48,16 @@
  *
  * New objects are always marked busy, and they can go from busy to
  * not busy only once.
+ *
+ * If the hash implementation can do lockless lookups (hash->peek) and
+ * critbit_snapshot is enabled, the newest object on the objhead is also
+ * published in oh->snap_oc when it is unbusied, provided it has no Vary.
+ * A lookup which finds it fresh, non-busy and clean of bans, can use it
+ * without ever taking the oh->mtx.  The reference is taken by atomically
+ * incrementing oc->refcnt only if it is not already zero, so all changes
+ * to oc->refcnt are atomic, and objcores which have been published are
+ * put on a cooloff list for critbit_cooloff seconds, rather than freed
+ * right away.  The object itself is freed right away as usual.
  */
 
 #include "config.h"
@@ -60,10 +70,17 @@
 
 
 #include "hash/hash_slinger.h"
+#include "vatomic.h"
+#include "vmb.h"
 #include "vsha256.h"
+#include "vtim.h"
 
 static const struct hash_slinger *hash;
 
+static struct lock hsh_cool_mtx;
+static VTAILQ_HEAD(,objcore) hsh_cool = VTAILQ_HEAD_INITIALIZER(hsh_cool);
+static pthread_t hsh_cool_thread;
+
 /*---------------------------------------------------------------------*/
 
 struct objcore *
@@ -275,6 +292,7 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc)
 	AZ(oc->flags & OC_F_BUSY);
 
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, list);
+	oh->snap_oc = NULL;
 	/* NB: do not deref objhead the new object inherits our reference */
 	oc->objhead = oh;
 	Lck_Unlock(&oh->mtx);
@@ -282,6 +300,53 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc)
 	wrk->stats.n_vampireobject++;
 }
 
+/*---------------------------------------------------------------------
+ * Try the snapshot, without taking the oh->mtx.
+ */
+
+static struct objcore *
+hsh_snaplookup(struct req *req)
+{
+	struct worker *wrk;
+	struct objhead *oh;
+	struct objcore *oc;
+	struct object *o;
+	int r;
+
+	wrk = req->wrk;
+	oh = hash->peek(wrk, req->digest);
+	if (oh == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	oc = oh->snap_oc;
+	if (oc == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	/* Only if somebody else still holds a reference */
+	do {
+		r = oc->refcnt;
+		if (r <= 0)
+			return (NULL);
+	} while (!VATOMIC_CAS(&oc->refcnt, r, r + 1));
+
+	AN(oc->flags & OC_F_SNAP);
+	AZ(oc->flags & OC_F_BUSY);
+	if (oc->busyobj == NULL && BAN_Fresh(oc)) {
+		o = oc_getobj(&wrk->stats, oc);
+		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+		if (o->vary == NULL && o->exp.ttl > 0. &&
+		    EXP_Ttl(req, o) >= req->t_req) {
+			if (!cache_param->obj_readonly && o->hits < INT_MAX)
+				(void)VATOMIC_ADD(&o->hits, 1);
+			wrk->stats.hcb_snaphit++;
+			return (oc);
+		}
+	}
+	(void)HSH_Deref(&wrk->stats, oc, NULL);
+	return (NULL);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -292,6 +357,7 @@ HSH_Lookup(struct req *req)
 	struct objhead *oh;
 	struct objcore *oc;
 	struct objcore *grace_oc;
+	struct objcore *ims_oc;
 	struct object *o;
 	double grace_ttl;
 	int busy_found;
@@ -307,6 +373,13 @@ HSH_Lookup(struct req *req)
 	if (DO_DEBUG(DBG_HASHEDGE))
 		hsh_testmagic(req->digest);
 
+	if (req->hash_objhead == NULL && !req->hash_always_miss &&
+	    hash->peek != NULL && cache_param->critbit_snapshot) {
+		oc = hsh_snaplookup(req);
+		if (oc != NULL)
+			return (oc);
+	}
+
 	if (req->hash_objhead != NULL) {
 		/*
 		 * This sess came off the waiting list, and brings a
@@ -328,6 +401,7 @@ HSH_Lookup(struct req *req)
 	busy_found = 0;
 	grace_oc = NULL;
 	grace_ttl = NAN;
+	ims_oc = NULL;
 	VTAILQ_FOREACH(oc, &oh->objcs, list) {
 		/* Must be at least our own ref + the objcore we examine */
 		assert(oh->refcnt > 1);
@@ -344,8 +418,16 @@ HSH_Lookup(struct req *req)
 			    !VRY_Match(req, oc->busyobj->vary))
 				continue;
 
-			busy_found = 1;
-			continue;
+			/*
+			 * An unbusied object whose body is still being
+			 * streamed can be delivered alongside the fetch.
+			 * ESI includes still wait for the complete object.
+			 */
+			if (oc->flags & (OC_F_BUSY|OC_F_PASS) ||
+			    !oc->busyobj->do_stream || req->esi_level > 0) {
+				busy_found = 1;
+				continue;
+			}
 		}
 
 		o = oc_getobj(&wrk->stats, oc);
@@ -355,7 +437,7 @@ HSH_Lookup(struct req *req)
 			continue;
 		if (BAN_CheckObject(o, req))
 			continue;
-		if (o->vary != NULL && !VRY_Match(req, o->vary))
+		if (o->vary != NULL && !VRY_MatchObj(req, oc, o->vary))
 			continue;
 
 		/* If still valid, use it */
@@ -373,6 +455,18 @@ HSH_Lookup(struct req *req)
 				grace_ttl = o->exp.entered + o->exp.ttl;
 			}
 		}
+
+		/*
+		 * Remember the newest stale object with validators, a
+		 * fetch can ask the backend if it is still good.
+		 */
+		if (ims_oc == NULL && oc->busyobj == NULL &&
+		    !(oc->flags & OC_F_PASS) &&
+		    (EXP_Keep(req, o) >= req->t_req ||
+		    EXP_Grace(req, o) >= req->t_req) &&
+		    (http_GetHdr(o->http, H_Last_Modified, NULL) ||
+		    http_GetHdr(o->http, H_ETag, NULL)))
+			ims_oc = oc;
 	}
 
 	/*
@@ -391,19 +485,51 @@ HSH_Lookup(struct req *req)
 		o = oc_getobj(&wrk->stats, grace_oc);
 		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 		oc = grace_oc;
+	} else if (oc == NULL && grace_oc != NULL &&
+	    cache_param->grace_bgfetch && req->esi_level == 0 &&
+	    !req->hash_always_miss && grace_oc->busyobj == NULL &&
+	    !(grace_oc->flags & OC_F_PASS)) {
+		/*
+		 * Nobody is fetching a new copy yet.  Deliver the graced
+		 * object, and leave a busy objcore for the request to
+		 * fetch into once the client has its response.
+		 */
+		oc = grace_oc;
+		AZ(req->bg_objcore);
+		req->bg_objcore = wrk->nobjcore;
+		wrk->nobjcore = NULL;
+		AN(req->bg_objcore->flags & OC_F_BUSY);
+		req->bg_objcore->refcnt = 1;	/* Owned by busyobj */
+		req->bg_objcore->objhead = oh;
+		VTAILQ_INSERT_TAIL(&oh->objcs, req->bg_objcore, list);
+		/* The busy objcore needs an objhead ref of its own */
+		oh->refcnt++;
+		if (ims_oc != NULL) {
+			AZ(req->ims_oc);
+			(void)VATOMIC_ADD(&ims_oc->refcnt, 1);
+			req->ims_oc = ims_oc;
+		}
 	}
 
 	if (oc != NULL && !req->hash_always_miss) {
 		/* We found an object we like */
 		assert(oh->refcnt > 1);
 		assert(oc->objhead == oh);
-		oc->refcnt++;
+		(void)VATOMIC_ADD(&oc->refcnt, 1);
+		if (oc->busyobj != NULL) {
+			/* Follow the fetch, see cnt_deliver() */
+			CHECK_OBJ_NOTNULL(oc->busyobj, BUSYOBJ_MAGIC);
+			AZ(req->busyobj);
+			oc->busyobj->refcount++;
+			req->busyobj = oc->busyobj;
+			wrk->stats.busy_stream++;
+		}
 		Lck_Unlock(&oh->mtx);
 		assert(hash->deref(oh));
 		o = oc_getobj(&wrk->stats, oc);
 		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 		if (!cache_param->obj_readonly && o->hits < INT_MAX)
-			o->hits++;
+			(void)VATOMIC_ADD(&o->hits, 1);
 		return (oc);
 	}
 
@@ -442,6 +568,11 @@ HSH_Lookup(struct req *req)
 	oc->refcnt = 1;		/* Owned by busyobj */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, list);
+	if (ims_oc != NULL) {
+		AZ(req->ims_oc);
+		(void)VATOMIC_ADD(&ims_oc->refcnt, 1);
+		req->ims_oc = ims_oc;
+	}
 	/* NB: do not deref objhead the new object inherits our reference */
 	Lck_Unlock(&oh->mtx);
 	return (oc);
@@ -451,7 +582,7 @@ HSH_Lookup(struct req *req)
  */
 
 static void
-hsh_rush(struct dstat *ds, struct objhead *oh)
+hsh_rush(struct dstat *ds, struct objhead *oh, unsigned max)
 {
 	unsigned u;
 	struct req *req;
@@ -461,7 +592,7 @@ hsh_rush(struct dstat *ds, struct objhead *oh)
 	Lck_AssertHeld(&oh->mtx);
 	wl = oh->waitinglist;
 	CHECK_OBJ_NOTNULL(wl, WAITINGLIST_MAGIC);
-	for (u = 0; u < cache_param->rush_exponent; u++) {
+	for (u = 0; u < max; u++) {
 		req = VTAILQ_FIRST(&wl->list);
 		if (req == NULL)
 			break;
@@ -520,7 +651,7 @@ HSH_Purge(struct req *req, struct objhead *oh, double ttl, double grace)
 		    /* XXX: still needed ? */
 
 		xxxassert(spc >= sizeof *ocp);
-		oc->refcnt++;
+		(void)VATOMIC_ADD(&oc->refcnt, 1);
 		spc -= sizeof *ocp;
 		ocp[nobj++] = oc;
 	}
@@ -580,6 +711,32 @@ HSH_Complete(struct objcore *oc)
 	Lck_Unlock(&oh->mtx);
 }
 
+/*---------------------------------------------------------------------
+ * Publish the new head of the objhead for lockless lookups, if it has
+ * no Vary, otherwise we must look at the variants under the lock.
+ */
+
+static void
+hsh_publish(struct dstat *ds, struct objhead *oh, struct objcore *oc)
+{
+	struct object *o;
+
+	Lck_AssertHeld(&oh->mtx);
+	if (!cache_param->critbit_snapshot) {
+		oh->snap_oc = NULL;
+		return;
+	}
+	o = oc_getobj(ds, oc);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	if (o->vary != NULL) {
+		oh->snap_oc = NULL;
+		return;
+	}
+	oc->flags |= OC_F_SNAP;
+	VWMB();
+	oh->snap_oc = oc;
+}
+
 /*---------------------------------------------------------------------
  * Unbusy an objcore when the object is completely fetched.
  */
@@ -604,8 +761,19 @@ HSH_Unbusy(struct dstat *ds, struct objcore *oc)
 	VTAILQ_REMOVE(&oh->objcs, oc, list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, list);
 	oc->flags &= ~OC_F_BUSY;
-	if (oh->waitinglist != NULL)
-		hsh_rush(ds, oh);
+	if (hash->peek != NULL)
+		hsh_publish(ds, oh, oc);
+	/*
+	 * Without Vary every waiter can use this object, so there is no
+	 * point in letting them trickle in.
+	 */
+	if (oh->waitinglist != NULL) {
+		if (oc->busyobj != NULL && oc->busyobj->vary == NULL &&
+		    !(oc->flags & OC_F_PASS))
+			hsh_rush(ds, oh, UINT_MAX);
+		else
+			hsh_rush(ds, oh, cache_param->rush_exponent);
+	}
 	Lck_Unlock(&oh->mtx);
 }
 
@@ -623,7 +791,7 @@ HSH_Ref(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_Lock(&oh->mtx);
 	assert(oc->refcnt > 0);
-	oc->refcnt++;
+	(void)VATOMIC_ADD(&oc->refcnt, 1);
 	Lck_Unlock(&oh->mtx);
 }
 
@@ -667,15 +835,17 @@ HSH_Deref(struct dstat *ds, struct objcore *oc, struct object **oo)
 		Lck_Lock(&oh->mtx);
 		assert(oh->refcnt > 0);
 		assert(oc->refcnt > 0);
-		r = --oc->refcnt;
-		if (!r)
+		r = VATOMIC_SUB(&oc->refcnt, 1);
+		if (!r) {
 			VTAILQ_REMOVE(&oh->objcs, oc, list);
-		else {
+			if (oh->snap_oc == oc)
+				oh->snap_oc = NULL;
+		} else {
 			/* Must have an object */
 			AN(oc->methods);
 		}
 		if (oh->waitinglist != NULL)
-			hsh_rush(ds, oh);
+			hsh_rush(ds, oh, cache_param->rush_exponent);
 		Lck_Unlock(&oh->mtx);
 		if (r != 0)
 			return (r);
@@ -688,7 +858,14 @@ HSH_Deref(struct dstat *ds, struct objcore *oc, struct object **oo)
 		oc_freeobj(oc);
 		ds->n_object--;
 	}
-	FREE_OBJ(oc);
+	if (oc->flags & OC_F_SNAP) {
+		/* A lockless lookup may still be looking at it */
+		oc->cool_when = VTIM_real();
+		Lck_Lock(&hsh_cool_mtx);
+		VTAILQ_INSERT_TAIL(&hsh_cool, oc, list);
+		Lck_Unlock(&hsh_cool_mtx);
+	} else
+		FREE_OBJ(oc);
 
 	ds->n_objectcore--;
 	if (oh != NULL) {
@@ -701,6 +878,37 @@ HSH_Deref(struct dstat *ds, struct objcore *oc, struct object **oo)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Free published objcores once lockless lookups are done with them.
+ * oc->cool_when is when they were put on the list.
+ */
+
+static void * __match_proto__(bgthread_t)
+hsh_cooler(struct worker *wrk, void *priv)
+{
+	struct objcore *oc;
+	double t;
+
+	(void)wrk;
+	(void)priv;
+	while (1) {
+		t = VTIM_real() - cache_param->critbit_cooloff;
+		Lck_Lock(&hsh_cool_mtx);
+		while (1) {
+			oc = VTAILQ_FIRST(&hsh_cool);
+			if (oc == NULL || oc->cool_when > t)
+				break;
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			AZ(oc->refcnt);
+			VTAILQ_REMOVE(&hsh_cool, oc, list);
+			FREE_OBJ(oc);
+		}
+		Lck_Unlock(&hsh_cool_mtx);
+		VTIM_sleep(1.0);
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
 void
 HSH_Init(const struct hash_slinger *slinger)
 {
@@ -709,4 +917,8 @@ HSH_Init(const struct hash_slinger *slinger)
 	hash = slinger;
 	if (hash->start != NULL)
 		hash->start();
+	if (hash->peek != NULL) {
+		Lck_New(&hsh_cool_mtx, lck_hshcool);
+		WRK_BgThread(&hsh_cool_thread, "hsh-cooler", hsh_cooler, NULL);
+	}
 }
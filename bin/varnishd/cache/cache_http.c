@@ -94,18 +94,101 @@ http_StatusMessage(unsigned status)
 	return ("Unknown Error");
 }
 
+/*--------------------------------------------------------------------
+ * Index of the well-known headers in tbl/http_headers.h
+ *
+ * hp->hdx[] holds the first slot of each well-known header, or zero
+ * if it is not present, so http_GetHdr() need not walk the headers.
+ * Objects are never dissected and rarely searched, so they do not
+ * carry an index.
+ * The index is maintained when headers are appended, and rebuilt
+ * when they are removed or moved.  Slots which do not fit in the
+ * index, or any other doubt, clear hp->hdx[HDX_OK] and we walk.
+ *
+ * The header names are mapped to the index with a perfect hash over
+ * the length and the first and last characters.  HTTP_Init() asserts
+ * that it is perfect, if you add a header to the table and it trips,
+ * find new constants for HDX_HASH.
+ */
+
+#define HDX_NHASH	128
+#define HDX_HASH(l, f, e) \
+	(((l) * 15U + ((f) | 0x20U) * 24U + ((e) | 0x20U) * 8U) & \
+	(HDX_NHASH - 1))
+
+#define HDX_OK		HDX__MAX
+#define HDX_LEN		(HDX__MAX + 1)
+#define HDX_VALID(hp)	((hp)->hdx != NULL && (hp)->hdx[HDX_OK])
+
+static const char * const hdx_name[HDX__MAX] = {
+#define HTTPH(a, b, c) [HDX_##b] = a,
+#include "tbl/http_headers.h"
+#undef HTTPH
+};
+
+static int8_t hdx_tbl[HDX_NHASH];
+
+static int
+http_hdx_find(const char *name, unsigned l)
+{
+	int k;
+
+	if (l == 0)
+		return (-1);
+	k = hdx_tbl[HDX_HASH(l, (unsigned char)name[0],
+	    (unsigned char)name[l - 1])];
+	if (k < 0 || hdx_name[k][l] != '\0' ||
+	    strncasecmp(name, hdx_name[k], l))
+		return (-1);
+	return (k);
+}
+
+static void
+http_hdx_add(struct http *hp, unsigned u)
+{
+	const char *c;
+	int k;
+
+	if (!HDX_VALID(hp) || hp->hd[u].b == NULL)
+		return;
+	if (u > UINT8_MAX) {
+		hp->hdx[HDX_OK] = 0;
+		return;
+	}
+	c = memchr(hp->hd[u].b, ':', Tlen(hp->hd[u]));
+	if (c == NULL)
+		return;
+	k = http_hdx_find(hp->hd[u].b, c - hp->hd[u].b);
+	if (k >= 0 && hp->hdx[k] == 0)
+		hp->hdx[k] = (uint8_t)u;
+}
+
+static void
+http_hdx_build(struct http *hp)
+{
+	unsigned u;
+
+	if (hp->hdx == NULL)
+		return;
+	memset(hp->hdx, 0, HDX_LEN);
+	hp->hdx[HDX_OK] = 1;
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++)
+		http_hdx_add(hp, u);
+}
+
 /*--------------------------------------------------------------------*/
 
 unsigned
-HTTP_estimate(unsigned nhttp)
+HTTP_estimate(unsigned nhttp, int hdx)
 {
 
 	/* XXX: We trust the structs to size-aligned as necessary */
-	return (sizeof (struct http) + (sizeof (txt) + 1) * nhttp);
+	return (sizeof (struct http) + (sizeof (txt) + 1) * nhttp +
+	    (hdx ? HDX_LEN : 0));
 }
 
 struct http *
-HTTP_create(void *p, uint16_t nhttp)
+HTTP_create(void *p, uint16_t nhttp, int hdx)
 {
 	struct http *hp;
 
@@ -114,6 +197,11 @@ HTTP_create(void *p, uint16_t nhttp)
 	hp->hd = (void*)(hp + 1);
 	hp->shd = nhttp;
 	hp->hdf = (void*)(hp->hd + nhttp);
+	hp->hdx = NULL;
+	if (hdx) {
+		hp->hdx = hp->hdf + nhttp;
+		memset(hp->hdx, 0, HDX_LEN);
+	}
 	return (hp);
 }
 
@@ -137,11 +225,13 @@ http_Teardown(struct http *hp)
 	uint16_t shd;
 	txt *hd;
 	unsigned char *hdf;
+	uint8_t *hdx;
 
 	/* XXX: This is not elegant, is it efficient ? */
 	shd = hp->shd;
 	hd = hp->hd;
 	hdf = hp->hdf;
+	hdx = hp->hdx;
 	memset(hp, 0, sizeof *hp);
 	memset(hd, 0, sizeof *hd * shd);
 	memset(hdf, 0, sizeof *hdf * shd);
@@ -150,6 +240,11 @@ http_Teardown(struct http *hp)
 	hp->shd = shd;
 	hp->hd = hd;
 	hp->hdf = hdf;
+	hp->hdx = hdx;
+	if (hdx != NULL) {
+		memset(hdx, 0, HDX_LEN);
+		hdx[HDX_OK] = 1;
+	}
 }
 
 /*--------------------------------------------------------------------*/
@@ -222,6 +317,7 @@ http_CollectHdr(struct http *hp, const char *hdr)
 	}
 	if (b == NULL)
 		return;
+	http_hdx_build(hp);
 	AN(e);
 	if (b >= e) {
 		WS_Release(hp->ws, 0);
@@ -259,12 +355,19 @@ http_GetHdr(const struct http *hp, const char *hdr, char **ptr)
 {
 	unsigned u, l;
 	char *p;
+	int k;
 
 	l = hdr[0];
 	diagnostic(l == strlen(hdr + 1));
 	assert(hdr[l] == ':');
 	hdr++;
-	u = http_findhdr(hp, l - 1, hdr);
+	k = -1;
+	if (HDX_VALID(hp))
+		k = http_hdx_find(hdr, l - 1);
+	if (k >= 0)
+		u = hp->hdx[k];
+	else
+		u = http_findhdr(hp, l - 1, hdr);
 	if (u == 0) {
 		if (ptr != NULL)
 			*ptr = NULL;
@@ -493,16 +596,16 @@ http_dissect_hdrs(struct http *hp, char *p, const struct http_conn *htc)
 
 	hp->nhd = HTTP_HDR_FIRST;
 	hp->conds = 0;
+	http_hdx_build(hp);
 	r = NULL;		/* For FlexeLint */
 	for (; p < t.e; p = r) {
 
 		/* Find end of next header */
 		q = r = p;
 		while (r < t.e) {
-			if (!vct_iscrlf(*r)) {
-				r++;
-				continue;
-			}
+			r += VCT_NotCRLF(r, t.e);
+			if (r >= t.e)
+				break;
 			q = r;
 			assert(r < t.e);
 			r += vct_skipcrlf(r);
@@ -542,6 +645,7 @@ http_dissect_hdrs(struct http *hp, char *p, const struct http_conn *htc)
 			hp->hd[hp->nhd].b = p;
 			hp->hd[hp->nhd].e = q;
 			http_VSLH(hp, hp->nhd);
+			http_hdx_add(hp, hp->nhd);
 			hp->nhd++;
 		} else {
 			VSC_C_main->losthdr++;
@@ -813,6 +917,7 @@ http_filterfields(struct http *to, const struct http *fm, unsigned how)
 	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
 	to->nhd = HTTP_HDR_FIRST;
 	to->status = fm->status;
+	http_hdx_build(to);
 	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
 		if (fm->hd[u].b == NULL)
 			continue;
@@ -827,6 +932,7 @@ http_filterfields(struct http *to, const struct http *fm, unsigned how)
 		if (to->nhd < to->shd) {
 			to->hd[to->nhd] = fm->hd[u];
 			to->hdf[to->nhd] = 0;
+			http_hdx_add(to, to->nhd);
 			to->nhd++;
 		} else  {
 			VSC_C_main->losthdr++;
@@ -875,7 +981,7 @@ http_FilterResp(const struct http *fm, struct http *to, unsigned how)
  */
 
 void
-http_CopyHome(const struct http *hp)
+http_CopyHome(struct http *hp)
 {
 	unsigned u, l;
 	char *p;
@@ -899,10 +1005,45 @@ http_CopyHome(const struct http *hp)
 			VSLbt(hp->vsl, SLT_LostHeader, hp->hd[u]);
 			hp->hd[u].b = NULL;
 			hp->hd[u].e = NULL;
+			if (u >= HTTP_HDR_FIRST)
+				http_hdx_build(hp);
 		}
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Turn a 304 response into the full response it revalidated: the
+ * status line and any headers the 304 does not replace come from the
+ * stored object.  The 304 says nothing about the body we keep.
+ */
+
+void
+http_Merge(const struct http *fm, struct http *to)
+{
+	unsigned u;
+	const char *p;
+
+	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
+	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
+
+	http_Unset(to, H_Content_Length);
+	http_Unset(to, H_Content_Encoding);
+	http_Unset(to, H_Transfer_Encoding);
+
+	to->status = fm->status;
+	http_linkh(to, fm, HTTP_HDR_PROTO);
+	http_linkh(to, fm, HTTP_HDR_RESPONSE);
+
+	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
+		if (fm->hd[u].b == NULL)
+			continue;
+		p = strchr(fm->hd[u].b, ':');
+		if (p == NULL || http_findhdr(to, p - fm->hd[u].b, fm->hd[u].b))
+			continue;
+		http_SetHeader(to, fm->hd[u].b);
+	}
+}
+
 /*--------------------------------------------------------------------*/
 
 void
@@ -915,6 +1056,7 @@ http_ClrHeader(struct http *to)
 	to->protover = 0;
 	to->conds = 0;
 	memset(to->hd, 0, sizeof *to->hd * to->shd);
+	http_hdx_build(to);
 }
 
 /*--------------------------------------------------------------------*/
@@ -929,7 +1071,9 @@ http_SetHeader(struct http *to, const char *hdr)
 		VSLb(to->vsl, SLT_LostHeader, "%s", hdr);
 		return;
 	}
-	http_SetH(to, to->nhd++, hdr);
+	http_SetH(to, to->nhd, hdr);
+	http_hdx_add(to, to->nhd);
+	to->nhd++;
 }
 
 /*--------------------------------------------------------------------*/
@@ -1004,6 +1148,7 @@ http_PrintfHeader(struct http *to, const char *fmt, ...)
 		to->hd[to->nhd].e = to->ws->f + n;
 		to->hdf[to->nhd] = 0;
 		WS_Release(to->ws, n + 1);
+		http_hdx_add(to, to->nhd);
 		to->nhd++;
 	}
 }
@@ -1025,7 +1170,10 @@ http_Unset(struct http *hp, const char *hdr)
 		}
 		v++;
 	}
-	hp->nhd = v;
+	if (hp->nhd != v) {
+		hp->nhd = v;
+		http_hdx_build(hp);
+	}
 }
 
 /*--------------------------------------------------------------------*/
@@ -1042,6 +1190,10 @@ HTTP_Copy(struct http *to, const struct http * const fm)
 	assert(fm->nhd <= to->shd);
 	memcpy(to->hd, fm->hd, fm->nhd * sizeof *to->hd);
 	memcpy(to->hdf, fm->hdf, fm->nhd * sizeof *to->hdf);
+	if (to->hdx != NULL && HDX_VALID(fm))
+		memcpy(to->hdx, fm->hdx, HDX_LEN);
+	else
+		http_hdx_build(to);
 }
 
 /*--------------------------------------------------------------------*/
@@ -1093,7 +1245,18 @@ void
 HTTP_Init(void)
 {
 
+	unsigned u, h;
+
 #define HTTPH(a, b, c) b[0] = (char)strlen(b + 1);
 #include "tbl/http_headers.h"
 #undef HTTPH
+
+	memset(hdx_tbl, -1, sizeof hdx_tbl);
+	for (u = 0; u < HDX__MAX; u++) {
+		h = HDX_HASH(strlen(hdx_name[u]),
+		    (unsigned char)hdx_name[u][0],
+		    (unsigned char)hdx_name[u][strlen(hdx_name[u]) - 1]);
+		assert(hdx_tbl[h] == -1);	/* See HDX_HASH */
+		hdx_tbl[h] = (int8_t)u;
+	}
 }
@@ -139,7 +139,7 @@ http1_wait(struct sess *sp, struct worker *wrk, struct req *req)
 				req->t_req = NAN;
 				wrk->stats.sess_herd++;
 				SES_ReleaseReq(req);
-				WAIT_Enter(sp);
+				SES_Wait(sp);
 				return (1);
 			}
 		} else {
@@ -182,6 +182,8 @@ http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 
 	AZ(req->obj);
 	AZ(req->busyobj);
+	AZ(req->bg_objcore);
+	AZ(req->bgfetch);
 	req->director = NULL;
 	req->restarts = 0;
 
@@ -219,6 +221,7 @@ http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 	if (wrk->stats.client_req >= cache_param->wthread_stats_rate)
 		WRK_SumStat(wrk);
 
+	req->re_memo = NULL;
 	WS_Reset(req->ws, NULL);
 	WS_Reset(wrk->aws, NULL);
 
@@ -201,6 +201,7 @@ child_main(void)
 
 	VDI_Init();
 	VBO_Init();
+	Pipe_Init();
 	VBE_InitCfg();
 	VBP_Init();
 	WRK_Init();
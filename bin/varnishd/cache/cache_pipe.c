@@ -31,8 +31,10 @@
 
 #include "config.h"
 
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cache.h"
 
@@ -40,31 +42,318 @@
 #include "vtcp.h"
 #include "vtim.h"
 
+/*--------------------------------------------------------------------
+ * One direction of a pipe.
+ *
+ * Data is staged between reading from src and writing to dst, either
+ * in a kernel pipe with splice(2), so it never crosses into userland,
+ * or in a plain buffer.
+ */
+
+#define PIPE_SPLICE_MAX		65536	/* Default kernel pipe capacity */
+
+struct pipe_dir {
+	int			src;
+	int			dst;
+	int			p[2];
+	char			*buf;
+	ssize_t			off;
+	ssize_t			len;
+	unsigned		done;
+};
+
+static void
+pipe_dir_init(struct pipe_dir *pd, int src, int dst)
+{
+
+	memset(pd, 0, sizeof *pd);
+	pd->src = src;
+	pd->dst = dst;
+	pd->p[0] = pd->p[1] = -1;
+#ifdef HAVE_SPLICE
+	if (cache_param->pipe_splice && !pipe(pd->p))
+		return;
+	pd->p[0] = pd->p[1] = -1;
+#endif
+	pd->buf = malloc(BUFSIZ);
+	XXXAN(pd->buf);
+}
+
+static void
+pipe_dir_fini(struct pipe_dir *pd)
+{
+
+	if (pd->p[0] >= 0) {
+		AZ(close(pd->p[0]));
+		AZ(close(pd->p[1]));
+	}
+	free(pd->buf);
+	pd->buf = NULL;
+}
+
+/* Read from src into an empty stage */
+static ssize_t
+pipe_fill(struct pipe_dir *pd)
+{
+	ssize_t i;
+
+	assert(pd->len == 0);
+#ifdef HAVE_SPLICE
+	if (pd->p[0] >= 0)
+		i = splice(pd->src, NULL, pd->p[1], NULL, PIPE_SPLICE_MAX,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	else
+#endif
+		i = read(pd->src, pd->buf, BUFSIZ);
+	if (i > 0) {
+		pd->off = 0;
+		pd->len = i;
+	}
+	return (i);
+}
+
+/* Write as much of the stage to dst as it will take */
+static ssize_t
+pipe_drain(struct pipe_dir *pd)
+{
+	ssize_t i;
+
+	assert(pd->len > 0);
+#ifdef HAVE_SPLICE
+	if (pd->p[0] >= 0)
+		i = splice(pd->p[0], NULL, pd->dst, NULL, pd->len,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	else
+#endif
+		i = write(pd->dst, pd->buf + pd->off, pd->len);
+	if (i > 0) {
+		pd->off += i;
+		pd->len -= i;
+	}
+	return (i);
+}
+
+/* Relay one read worth of data on blocking sockets */
 static int
-rdf(int fd0, int fd1)
+rdf(struct pipe_dir *pd)
 {
-	int i, j;
-	char buf[BUFSIZ], *p;
 
-	i = read(fd0, buf, sizeof buf);
-	if (i <= 0)
+	if (pipe_fill(pd) <= 0)
 		return (1);
-	for (p = buf; i > 0; i -= j, p += j) {
-		j = write(fd1, p, i);
-		if (j <= 0)
+	while (pd->len > 0)
+		if (pipe_drain(pd) <= 0)
 			return (1);
-		if (i != j)
-			(void)usleep(100000);		/* XXX hack */
+	return (0);
+}
+
+/* Half-close a direction, return true if the other one is done too */
+static int
+pipe_shut(struct pipe_dir *pd, const struct pipe_dir *other)
+{
+
+	pd->done = 1;
+	if (other->done)
+		return (1);
+	(void)shutdown(pd->src, SHUT_RD);
+	(void)shutdown(pd->dst, SHUT_WR);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * The shared pipe event loop.
+ *
+ * With pipe_eventloop, a piped connection is handed to a single thread
+ * once the request has been sent, so it does not occupy a worker thread
+ * for its lifetime.  The sockets are made non-blocking and a direction
+ * stops reading until its staged data has been written out.
+ */
+
+struct pipe_conn {
+	unsigned		magic;
+#define PIPE_CONN_MAGIC		0x2b5a0f5e
+	VTAILQ_ENTRY(pipe_conn)	list;
+	struct vbc		*vc;
+	int			fd;
+	double			t_last;
+	struct pipe_dir		dir[2];		/* from backend, to backend */
+};
+
+static VTAILQ_HEAD(, pipe_conn)	pipe_new = VTAILQ_HEAD_INITIALIZER(pipe_new);
+static struct lock		pipe_mtx;
+static int			pipe_wake[2];
+static pthread_t		pipe_thread;
+
+static void
+pipe_conn_close(struct pipe_conn *pc)
+{
+
+	CHECK_OBJ_NOTNULL(pc, PIPE_CONN_MAGIC);
+	pipe_dir_fini(&pc->dir[0]);
+	pipe_dir_fini(&pc->dir[1]);
+	(void)close(pc->fd);
+	VDI_CloseFd(&pc->vc);
+	FREE_OBJ(pc);
+}
+
+/* Move data along, return true when the connection is finished */
+static int
+pipe_conn_run(struct pipe_conn *pc, const short *rev, double now)
+{
+	struct pipe_dir *pd, *other;
+	ssize_t i;
+	int d;
+
+	for (d = 0; d < 2; d++) {
+		pd = &pc->dir[d];
+		other = &pc->dir[1 - d];
+		if (pd->done)
+			continue;
+		if (pd->len == 0 && rev[pd->src == pc->fd ? 0 : 1]) {
+			i = pipe_fill(pd);
+			if (i == 0 || (i < 0 && errno != EAGAIN)) {
+				if (pipe_shut(pd, other))
+					return (1);
+				continue;
+			}
+			if (i > 0)
+				pc->t_last = now;
+		}
+		if (pd->len > 0) {
+			i = pipe_drain(pd);
+			if (i < 0 && errno != EAGAIN) {
+				if (pipe_shut(pd, other))
+					return (1);
+				continue;
+			}
+			if (i > 0)
+				pc->t_last = now;
+		}
 	}
+	return (now - pc->t_last > cache_param->pipe_timeout);
+}
+
+static void *
+pipe_loop(struct worker *wrk, void *priv)
+{
+	VTAILQ_HEAD(, pipe_conn) conns = VTAILQ_HEAD_INITIALIZER(conns);
+	struct pipe_conn *pc, *pc2;
+	struct pollfd *fds = NULL;
+	struct pipe_dir *pd;
+	short rev[2];
+	unsigned n, nfds = 0, u;
+	char buf[64];
+	double now;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	while (1) {
+		Lck_Lock(&pipe_mtx);
+		VTAILQ_CONCAT(&conns, &pipe_new, list);
+		Lck_Unlock(&pipe_mtx);
+
+		n = 1;
+		VTAILQ_FOREACH(pc, &conns, list)
+			n += 2;
+		VSC_C_main->n_pipe_loop = (n - 1) / 2;
+		if (n > nfds) {
+			nfds = n * 2;
+			fds = realloc(fds, nfds * sizeof *fds);
+			XXXAN(fds);
+		}
+		memset(fds, 0, n * sizeof *fds);
+		fds[0].fd = pipe_wake[0];
+		fds[0].events = POLLIN;
+		n = 1;
+		VTAILQ_FOREACH(pc, &conns, list) {
+			fds[n].fd = pc->fd;
+			fds[n + 1].fd = pc->vc->fd;
+			for (u = 0; u < 2; u++) {
+				pd = &pc->dir[u];
+				if (pd->done)
+					continue;
+				if (pd->len > 0)
+					fds[pd->dst == pc->fd ? n : n + 1].events
+					    |= POLLOUT;
+				else
+					fds[pd->src == pc->fd ? n : n + 1].events
+					    |= POLLIN;
+			}
+			/* Don't let errors on finished directions wake us */
+			for (u = n; u < n + 2; u++)
+				if (fds[u].events == 0)
+					fds[u].fd = -1;
+			n += 2;
+		}
+
+		i = poll(fds, n, 1000);
+		assert(i >= 0 || errno == EINTR);
+		if (fds[0].revents)
+			while (read(pipe_wake[0], buf, sizeof buf) > 0)
+				continue;
+
+		now = VTIM_real();
+		n = 1;
+		VTAILQ_FOREACH_SAFE(pc, &conns, list, pc2) {
+			rev[0] = fds[n].revents;
+			rev[1] = fds[n + 1].revents;
+			n += 2;
+			if (pipe_conn_run(pc, rev, now)) {
+				VTAILQ_REMOVE(&conns, pc, list);
+				pipe_conn_close(pc);
+			}
+		}
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Hand the connection to the event loop.  The session gets closed by
+ * our caller, so we keep a dup of its socket.
+ */
+
+static int
+pipe_handoff(struct req *req, struct vbc *vc)
+{
+	struct pipe_conn *pc;
+	int fd;
+
+	fd = dup(req->sp->fd);
+	if (fd < 0)
+		return (-1);
+	ALLOC_OBJ(pc, PIPE_CONN_MAGIC);
+	if (pc == NULL) {
+		AZ(close(fd));
+		return (-1);
+	}
+	(void)VTCP_nonblocking(fd);
+	(void)VTCP_nonblocking(vc->fd);
+	pc->fd = fd;
+	pc->vc = vc;
+	pc->t_last = VTIM_real();
+	pipe_dir_init(&pc->dir[0], vc->fd, fd);
+	pipe_dir_init(&pc->dir[1], fd, vc->fd);
+
+	/* The busyobj and its log are going away, close quietly */
+	VSL_Flush(vc->vsl, 0);
+	vc->vsl = NULL;
+
+	Lck_Lock(&pipe_mtx);
+	VTAILQ_INSERT_TAIL(&pipe_new, pc, list);
+	Lck_Unlock(&pipe_mtx);
+	(void)write(pipe_wake[1], "", 1);
 	return (0);
 }
 
+/*--------------------------------------------------------------------*/
+
 void
 PipeRequest(struct req *req)
 {
 	struct vbc *vc;
 	struct worker *wrk;
 	struct pollfd fds[2];
+	struct pipe_dir pd[2];
 	struct busyobj *bo;
 	int i;
 
@@ -99,15 +388,23 @@ PipeRequest(struct req *req)
 
 	req->t_resp = VTIM_real();
 
+	if (cache_param->pipe_eventloop && !pipe_handoff(req, vc)) {
+		SES_Close(req->sp, SC_TX_PIPE);
+		bo->vbc = NULL;
+		return;
+	}
+
 	memset(fds, 0, sizeof fds);
 
 	// XXX: not yet (void)VTCP_linger(vc->fd, 0);
 	fds[0].fd = vc->fd;
 	fds[0].events = POLLIN | POLLERR;
+	pipe_dir_init(&pd[0], vc->fd, req->sp->fd);
 
 	// XXX: not yet (void)VTCP_linger(req->sp->fd, 0);
 	fds[1].fd = req->sp->fd;
 	fds[1].events = POLLIN | POLLERR;
+	pipe_dir_init(&pd[1], req->sp->fd, vc->fd);
 
 	while (fds[0].fd > -1 || fds[1].fd > -1) {
 		fds[0].revents = 0;
@@ -115,24 +412,35 @@ PipeRequest(struct req *req)
 		i = poll(fds, 2, cache_param->pipe_timeout * 1000);
 		if (i < 1)
 			break;
-		if (fds[0].revents && rdf(vc->fd, req->sp->fd)) {
-			if (fds[1].fd == -1)
+		if (fds[0].revents && rdf(&pd[0])) {
+			if (pipe_shut(&pd[0], &pd[1]))
 				break;
-			(void)shutdown(vc->fd, SHUT_RD);
-			(void)shutdown(req->sp->fd, SHUT_WR);
 			fds[0].events = 0;
 			fds[0].fd = -1;
 		}
-		if (fds[1].revents && rdf(req->sp->fd, vc->fd)) {
-			if (fds[0].fd == -1)
+		if (fds[1].revents && rdf(&pd[1])) {
+			if (pipe_shut(&pd[1], &pd[0]))
 				break;
-			(void)shutdown(req->sp->fd, SHUT_RD);
-			(void)shutdown(vc->fd, SHUT_WR);
 			fds[1].events = 0;
 			fds[1].fd = -1;
 		}
 	}
+	pipe_dir_fini(&pd[0]);
+	pipe_dir_fini(&pd[1]);
 	SES_Close(req->sp, SC_TX_PIPE);
 	VDI_CloseFd(&vc);
 	bo->vbc = NULL;
 }
+
+/*--------------------------------------------------------------------*/
+
+void
+Pipe_Init(void)
+{
+
+	Lck_New(&pipe_mtx, lck_pipe);
+	AZ(pipe(pipe_wake));
+	AZ(fcntl(pipe_wake[0], F_SETFL, O_NONBLOCK));
+	AZ(fcntl(pipe_wake[1], F_SETFL, O_NONBLOCK));
+	WRK_BgThread(&pipe_thread, "pipe-loop", pipe_loop, NULL);
+}
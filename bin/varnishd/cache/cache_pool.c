@@ -36,11 +36,14 @@
 #include "config.h"
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache.h"
 #include "common/heritage.h"
 
+#include "vatomic.h"
+#include "vmb.h"
 #include "vtim.h"
 
 VTAILQ_HEAD(taskhead, pool_task);
@@ -58,6 +61,7 @@ struct pool {
 	unsigned			magic;
 #define POOL_MAGIC			0x606658fa
 	VTAILQ_ENTRY(pool)		list;
+	unsigned			pool_no;
 
 	pthread_cond_t			herder_cond;
 	pthread_t			herder_thr;
@@ -69,14 +73,33 @@ struct pool {
 	unsigned			nthr;
 	unsigned			dry;
 	unsigned			lqueue;
-	uintmax_t			ndropped;
-	uintmax_t			nqueued;
 	struct sesspool			*sesspool;
+	struct VSC_C_wrk		*vsc;		/* See Pool_SumStat() */
+
+	/* Queue delay controller, see pool_herd_delay() */
+#define POOL_NHIST			24
+	unsigned			qhist[POOL_NHIST];
+	double				t_window;
+	unsigned			lat_add;
+	unsigned			lat_shrink;
 };
 
 static struct lock		pool_mtx;
 static pthread_t		thr_pool_herder;
 
+/*
+ * Pools are only ever added, fully built, to the tail, so this list
+ * can be walked without locks.
+ */
+static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
+
+/*--------------------------------------------------------------------
+ * The counters of a pool are updated by its workers without locks, and
+ * by other pools when they steal from it, so all updates are atomic.
+ */
+
+#define POOL_STAT(pp, n, v)	(void)VATOMIC_ADD(&(pp)->vsc->n, (v))
+
 /*--------------------------------------------------------------------
  */
 
@@ -101,6 +124,104 @@ pool_getidleworker(struct pool *pp)
 	return (wrk);
 }
 
+/*--------------------------------------------------------------------
+ * Account for the time a task waited before a thread started on it.
+ *
+ * qhist[] has log2 microsecond buckets for the herder, the VSC
+ * histogram has decades.
+ */
+
+static void
+pool_delay(struct pool *pp, const struct pool_task *tp)
+{
+	double d;
+	uint64_t u;
+	unsigned b;
+
+	Lck_AssertHeld(&pp->mtx);
+	if (tp == NULL) {
+		/* Started right away */
+		pp->qhist[0]++;
+		POOL_STAT(pp, pool_delay_100us, 1);
+		return;
+	}
+	d = VTIM_mono() - tp->t_queued;
+	if (d < 0.)
+		d = 0.;
+	u = (uint64_t)(1e6 * d);
+	POOL_STAT(pp, sess_queue_wait, u);
+	for (b = 0; u > 1 && b < POOL_NHIST - 1; b++)
+		u >>= 1;
+	pp->qhist[b]++;
+	if (d < 100e-6)
+		POOL_STAT(pp, pool_delay_100us, 1);
+	else if (d < 1e-3)
+		POOL_STAT(pp, pool_delay_1ms, 1);
+	else if (d < 10e-3)
+		POOL_STAT(pp, pool_delay_10ms, 1);
+	else if (d < 100e-3)
+		POOL_STAT(pp, pool_delay_100ms, 1);
+	else if (d < 1.)
+		POOL_STAT(pp, pool_delay_1s, 1);
+	else
+		POOL_STAT(pp, pool_delay_slow, 1);
+}
+
+/*--------------------------------------------------------------------
+ * Work stealing
+ *
+ * Other pools are only try-locked, so we never wait for them, and
+ * can do this while holding our own pool lock.  Steals are counted
+ * in the victims stats.
+ */
+
+static struct worker *
+pool_steal_worker(const struct pool *pp)
+{
+	struct pool *pp2;
+	struct pool_task *pt;
+	struct worker *wrk = NULL;
+
+	VTAILQ_FOREACH(pp2, &pools, list) {
+		if (pp2 == pp || Lck_Trylock(&pp2->mtx))
+			continue;
+		pt = VTAILQ_FIRST(&pp2->idle_queue);
+		if (pt != NULL) {
+			AZ(pt->func);
+			CAST_OBJ_NOTNULL(wrk, pt->priv, WORKER_MAGIC);
+			VTAILQ_REMOVE(&pp2->idle_queue, pt, list);
+			POOL_STAT(pp2, pool_steal, 1);
+		}
+		Lck_Unlock(&pp2->mtx);
+		if (wrk != NULL)
+			break;
+	}
+	return (wrk);
+}
+
+static struct pool_task *
+pool_steal_task(const struct pool *pp)
+{
+	struct pool *pp2;
+	struct pool_task *tp = NULL;
+
+	VTAILQ_FOREACH(pp2, &pools, list) {
+		if (pp2 == pp || Lck_Trylock(&pp2->mtx))
+			continue;
+		tp = VTAILQ_FIRST(&pp2->front_queue);
+		if (tp != NULL) {
+			VTAILQ_REMOVE(&pp2->front_queue, tp, list);
+			pp2->lqueue--;
+			POOL_STAT(pp2, pool_steal, 1);
+			pool_delay(pp2, tp);
+		}
+		Lck_Unlock(&pp2->mtx);
+		if (tp != NULL)
+			break;
+	}
+	return (tp);
+}
+
 /*--------------------------------------------------------------------
  * Nobody is accepting on this socket, so we do.
  *
@@ -125,6 +246,9 @@ pool_accept(struct worker *wrk, void *arg)
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 	CAST_OBJ_NOTNULL(ps, arg, POOLSOCK_MAGIC);
 
+	/* We may sit in accept(2) for a long time, don't sit on our stats */
+	Pool_SumStat(wrk);
+
 	CHECK_OBJ_NOTNULL(ps->lsock, LISTEN_SOCK_MAGIC);
 	assert(sizeof *wa == WS_Reserve(wrk->aws, sizeof *wa));
 	wa = (void*)wrk->aws->f;
@@ -141,7 +265,7 @@ pool_accept(struct worker *wrk, void *arg)
 		if (VCA_Accept(ps->lsock, wa) < 0) {
 			wrk->stats.sess_fail++;
 			/* We're going to pace in vca anyway... */
-			(void)WRK_TrySumStat(wrk);
+			Pool_SumStat(wrk);
 			continue;
 		}
 
@@ -197,6 +321,7 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum pool_how how)
 	if (wrk != NULL) {
 		VTAILQ_REMOVE(&pp->idle_queue, &wrk->task, list);
 		AZ(wrk->task.func);
+		pool_delay(pp, NULL);
 		Lck_Unlock(&pp->mtx);
 		wrk->task.func = task->func;
 		wrk->task.priv = task->priv;
@@ -204,6 +329,20 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum pool_how how)
 		return (0);
 	}
 
+	/* Accept tasks belong to their pool, don't let them wander */
+	if (how != POOL_QUEUE_BACK && cache_param->wthread_steal) {
+		wrk = pool_steal_worker(pp);
+		if (wrk != NULL) {
+			pool_delay(pp, NULL);
+			Lck_Unlock(&pp->mtx);
+			AZ(wrk->task.func);
+			wrk->task.func = task->func;
+			wrk->task.priv = task->priv;
+			AZ(pthread_cond_signal(&wrk->cond));
+			return (0);
+		}
+	}
+
 	switch (how) {
 	case POOL_NO_QUEUE:
 		retval = -1;
@@ -211,11 +350,12 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum pool_how how)
 	case POOL_QUEUE_FRONT:
 		/* If we have too much in the queue already, refuse. */
 		if (pp->lqueue > cache_param->wthread_queue_limit) {
-			pp->ndropped++;
+			POOL_STAT(pp, sess_dropped, 1);
 			retval = -1;
 		} else {
+			task->t_queued = VTIM_mono();
 			VTAILQ_INSERT_TAIL(&pp->front_queue, task, list);
-			pp->nqueued++;
+			POOL_STAT(pp, sess_queued, 1);
 			pp->lqueue++;
 		}
 		break;
@@ -229,6 +369,51 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum pool_how how)
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * Which pool is this, for things which want to shard by pool
+ */
+
+unsigned
+Pool_No(const struct pool *pp)
+{
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	return (pp->pool_no);
+}
+
+/*--------------------------------------------------------------------
+ * Fold a workers stats into the VSM counter block of its pool.
+ *
+ * This takes no locks, the counters are added atomically, and only
+ * those which moved.  The pool blocks are summed with VSC_C_main by
+ * VSC_Main() and VSC_Iter(), so the totals are exact once a worker
+ * has folded.  A busy worker does so at most every POOL_STAT_DELAY.
+ */
+
+#define POOL_STAT_DELAY		0.1
+
+void
+Pool_SumStat(struct worker *wrk)
+{
+	struct pool *pp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	pp = wrk->pool;
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+#define L0(n)
+#define L1(n)							\
+	do {							\
+		if (wrk->stats.n != 0)				\
+			POOL_STAT(pp, n, wrk->stats.n);		\
+	} while (0)
+#define VSC_F(n, t, l, f, d, e) L##l(n);
+#include "tbl/vsc_f_main.h"
+#undef VSC_F
+#undef L0
+#undef L1
+	memset(&wrk->stats, 0, sizeof wrk->stats);
+}
+
 /*--------------------------------------------------------------------
  * This is the work function for worker threads in the pool.
  */
@@ -237,13 +422,22 @@ void
 Pool_Work_Thread(void *priv, struct worker *wrk)
 {
 	struct pool *pp;
-	int stats_clean;
 	struct pool_task *tp;
+	double now;
 
 	CAST_OBJ_NOTNULL(pp, priv, POOL_MAGIC);
 	wrk->pool = pp;
-	stats_clean = 1;
 	while (1) {
+		/*
+		 * A busy worker only folds its stats every POOL_STAT_DELAY,
+		 * and an idle one before it goes to sleep.
+		 */
+		now = VTIM_real();
+		if (now - wrk->t_stats > POOL_STAT_DELAY) {
+			Pool_SumStat(wrk);
+			wrk->t_stats = now;
+		}
+
 		Lck_Lock(&pp->mtx);
 
 		CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -254,22 +448,25 @@ Pool_Work_Thread(void *priv, struct worker *wrk)
 		if (tp != NULL) {
 			pp->lqueue--;
 			VTAILQ_REMOVE(&pp->front_queue, tp, list);
+			pool_delay(pp, tp);
 		} else {
 			tp = VTAILQ_FIRST(&pp->back_queue);
 			if (tp != NULL)
 				VTAILQ_REMOVE(&pp->back_queue, tp, list);
 		}
 
+		if (tp == NULL && cache_param->wthread_steal)
+			tp = pool_steal_task(pp);
+
 		if (tp == NULL) {
 			/* Nothing to do: To sleep, perchance to dream ... */
+			Pool_SumStat(wrk);
 			if (isnan(wrk->lastused))
 				wrk->lastused = VTIM_real();
 			wrk->task.func = NULL;
 			wrk->task.priv = wrk;
 			AZ(wrk->task.func);
 			VTAILQ_INSERT_HEAD(&pp->idle_queue, &wrk->task, list);
-			if (!stats_clean)
-				WRK_SumStat(wrk);
 			(void)Lck_CondWait(&wrk->cond, &pp->mtx, NULL);
 			tp = &wrk->task;
 		}
@@ -280,7 +477,11 @@ Pool_Work_Thread(void *priv, struct worker *wrk)
 
 		assert(wrk->pool == pp);
 		tp->func(wrk, tp->priv);
-		stats_clean = WRK_TrySumStat(wrk);
+
+		/* Unlocked peek, it is only a hint */
+		if (VTAILQ_EMPTY(&pp->front_queue) &&
+		    VTAILQ_EMPTY(&pp->back_queue))
+			STV_Idle();
 	}
 	wrk->pool = NULL;
 }
@@ -313,6 +514,61 @@ pool_breed(struct pool *qp, const pthread_attr_t *tp_attr)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Steer the thread count by queue delay
+ *
+ * Once per window we find the 99th percentile of the time tasks
+ * waited for a thread.  Above thread_pool_delay_target we grow the
+ * pool by an eighth, below half of it we let the herder retire one
+ * thread which sat idle for the entire window, even if it has not
+ * reached thread_pool_timeout.
+ */
+
+#define POOL_DELAY_WINDOW	1.0
+
+static void
+pool_herd_delay(struct pool *pp)
+{
+	unsigned hist[POOL_NHIST];
+	unsigned b, n, lim;
+	double now, p99;
+
+	now = VTIM_mono();
+	if (now - pp->t_window < POOL_DELAY_WINDOW)
+		return;
+	pp->t_window = now;
+
+	Lck_Lock(&pp->mtx);
+	memcpy(hist, pp->qhist, sizeof hist);
+	memset(pp->qhist, 0, sizeof pp->qhist);
+	Lck_Unlock(&pp->mtx);
+
+	n = 0;
+	for (b = 0; b < POOL_NHIST; b++)
+		n += hist[b];
+	pp->lat_add = 0;
+	pp->lat_shrink = 0;
+	if (n == 0) {
+		pp->lat_shrink = 1;
+		return;
+	}
+
+	/* Upper edge of the bucket holding the 99th percentile */
+	lim = n / 100;
+	for (b = POOL_NHIST - 1; b > 0; b--) {
+		if (hist[b] > lim)
+			break;
+		lim -= hist[b];
+	}
+	p99 = (1U << (b + 1)) * 1e-6;
+
+	if (p99 > cache_param->wthread_delay_target) {
+		if (pp->nthr < cache_param->wthread_max)
+			pp->lat_add = 1 + pp->nthr / 8;
+	} else if (p99 < .5 * cache_param->wthread_delay_target)
+		pp->lat_shrink = 1;
+}
+
 /*--------------------------------------------------------------------
  * Herd a single pool
  *
@@ -324,10 +580,14 @@ pool_breed(struct pool *qp, const pthread_attr_t *tp_attr)
  * whenever we fail to, hopefully missing a lot of cond_signals in
  * the meantime.
  *
+ * It also wakes up every POOL_HERD_DELAY, to retire idle threads.
+ *
  * XXX: probably need a lot more work.
  *
  */
 
+#define POOL_HERD_DELAY		0.1
+
 static void*
 pool_herder(void *priv)
 {
@@ -336,11 +596,17 @@ pool_herder(void *priv)
 	pthread_attr_t tp_attr;
 	double t_idle;
 	struct worker *wrk;
+	struct timespec ts;
 
 	CAST_OBJ_NOTNULL(pp, priv, POOL_MAGIC);
 	AZ(pthread_attr_init(&tp_attr));
 
 	while (1) {
+		if (cache_param->wthread_delay_target > 0.)
+			pool_herd_delay(pp);
+		else
+			pp->lat_add = pp->lat_shrink = 0;
+
 		/* Set the stacksize for worker threads we create */
 		if (cache_param->wthread_stacksize != UINT_MAX)
 			AZ(pthread_attr_setstacksize(&tp_attr,
@@ -352,21 +618,23 @@ pool_herder(void *priv)
 
 		/* Make more threads if needed and allowed */
 		if (pp->nthr < cache_param->wthread_min ||
-		    (pp->dry && pp->nthr < cache_param->wthread_max)) {
+		    ((pp->dry || pp->lat_add) &&
+		    pp->nthr < cache_param->wthread_max)) {
+			if (pp->lat_add > 0)
+				pp->lat_add--;
 			pool_breed(pp, &tp_attr);
 			continue;
 		}
 
 		if (pp->nthr > cache_param->wthread_min) {
 
-			t_idle = VTIM_real() - cache_param->wthread_timeout;
+			if (pp->lat_shrink)
+				t_idle = VTIM_real() - POOL_DELAY_WINDOW;
+			else
+				t_idle = VTIM_real() -
+				    cache_param->wthread_timeout;
 
 			Lck_Lock(&pp->mtx);
-			/* XXX: unsafe counters */
-			VSC_C_main->sess_queued += pp->nqueued;
-			VSC_C_main->sess_dropped += pp->ndropped;
-			pp->nqueued = pp->ndropped = 0;
-
 			wrk = NULL;
 			pt = VTAILQ_LAST(&pp->idle_queue, taskhead);
 			if (pt != NULL) {
@@ -384,6 +652,7 @@ pool_herder(void *priv)
 
 			/* And give it a kiss on the cheek... */
 			if (wrk != NULL) {
+				pp->lat_shrink = 0;
 				pp->nthr--;
 				Lck_Lock(&pool_mtx);
 				VSC_C_main->threads--;
@@ -397,8 +666,10 @@ pool_herder(void *priv)
 		}
 
 		Lck_Lock(&pp->mtx);
-		if (!pp->dry)
-			(void)Lck_CondWait(&pp->herder_cond, &pp->mtx, NULL);
+		if (!pp->dry) {
+			ts = VTIM_timespec(VTIM_real() + POOL_HERD_DELAY);
+			(void)Lck_CondWait(&pp->herder_cond, &pp->mtx, &ts);
+		}
 		Lck_Unlock(&pp->mtx);
 	}
 	NEEDLESS_RETURN(NULL);
@@ -414,11 +685,16 @@ pool_mkpool(unsigned pool_no)
 	struct pool *pp;
 	struct listen_sock *ls;
 	struct poolsock *ps;
+	char buf[16];
 
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
 	Lck_New(&pp->mtx, lck_wq);
+	pp->pool_no = pool_no;
+	bprintf(buf, "%u", pool_no);
+	pp->vsc = VSM_Alloc(sizeof *pp->vsc, VSC_CLASS, VSC_TYPE_WRK, buf);
+	AN(pp->vsc);
 
 	VTAILQ_INIT(&pp->idle_queue);
 	VTAILQ_INIT(&pp->front_queue);
@@ -451,7 +727,6 @@ static void *
 pool_poolherder(void *priv)
 {
 	unsigned nwq;
-	VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
 	struct pool *pp;
 	uint64_t u;
 
@@ -463,6 +738,7 @@ pool_poolherder(void *priv)
 		if (nwq < cache_param->wthread_pools) {
 			pp = pool_mkpool(nwq);
 			if (pp != NULL) {
+				VWMB();
 				VTAILQ_INSERT_TAIL(&pools, pp, list);
 				VSC_C_main->pools++;
 				nwq++;
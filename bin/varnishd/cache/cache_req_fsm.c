@@ -75,6 +75,147 @@ DOT acceptor -> recv [style=bold,color=green]
 #include "compat/srandomdev.h"
 #endif
 
+/*--------------------------------------------------------------------
+ * Let go of the busyobj we are delivering from.
+ *
+ * A pass object is ours alone, so the fetch must be done with it before
+ * we can think about freeing it.
+ */
+
+static void
+cnt_releasebo(struct worker *wrk, struct req *req)
+{
+
+	CHECK_OBJ_NOTNULL(req->obj, OBJECT_MAGIC);
+	CHECK_OBJ_NOTNULL(req->busyobj, BUSYOBJ_MAGIC);
+	if (req->obj->objcore->objhead == NULL)
+		VBO_waitlast(req->busyobj);
+	VBO_DerefBusyObj(wrk, &req->busyobj);
+}
+
+/*--------------------------------------------------------------------
+ * Background fetch of a graced object.
+ *
+ * HSH_Lookup() left a busy objcore for us, which we fetch into as an
+ * ordinary miss once the graced object has been delivered.  The fetch
+ * runs on a request of its own, from a pool task, so that the client
+ * can get on with its next request.  Whichever way that fetch ends,
+ * nothing is sent to anybody.
+ */
+
+static void
+cnt_bgdrop(struct worker *wrk, struct req *req)
+{
+	struct objcore *oc;
+	struct busyobj *bo;
+
+	oc = req->bg_objcore;
+	req->bg_objcore = NULL;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	bo = oc->busyobj;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	AZ(HSH_Deref(&wrk->stats, oc, NULL));
+	VBO_DerefBusyObj(wrk, &bo);
+}
+
+static void
+cnt_bgtask(struct worker *wrk, void *priv)
+{
+	struct req *req;
+	struct sess *sp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(req, priv, REQ_MAGIC);
+	sp = req->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	THR_SetRequest(req);
+	AZ(wrk->aws->r);
+	wrk->lastused = NAN;
+	assert(CNT_Request(wrk, req) == 1);
+	AZ(req->bgfetch);
+	AZ(req->busyobj);
+	AZ(req->obj);
+
+	/* Hand the VCL reference to the worker, like http1_cleanup() */
+	if (wrk->vcl != NULL)
+		VCL_Rel(&wrk->vcl);
+	wrk->vcl = req->vcl;
+	req->vcl = NULL;
+
+	SES_ReleaseReq(req);
+	SES_Free(sp);
+	THR_SetRequest(NULL);
+}
+
+static void
+cnt_bgstart(struct worker *wrk, struct req *req)
+{
+	struct objcore *oc;
+	struct sess *sp;
+	struct req *req2;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	oc = req->bg_objcore;
+	req->bg_objcore = NULL;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(oc->flags & OC_F_BUSY);
+
+	sp = SES_Clone(req->sp);
+	req2 = SES_GetReq(wrk, sp);
+	CHECK_OBJ_NOTNULL(req2, REQ_MAGIC);
+
+	/* The client's workspace is recycled, so copy the request home */
+	HTTP_Setup(req2->http, req2->ws, req2->vsl, HTTP_Req);
+	HTTP_Copy(req2->http, req->http);
+	http_CopyHome(req2->http);
+	HTTP_Setup(req2->http0, req2->ws, req2->vsl, HTTP_Req);
+	HTTP_Copy(req2->http0, req2->http);
+	if (req->client_identity != NULL)
+		req2->client_identity = WS_Copy(req2->ws,
+		    req->client_identity, -1);
+
+	AN(req->vcl);
+	VCL_Ref(req->vcl);
+	req2->vcl = req->vcl;
+	req2->director = req->director;
+	req->director = NULL;
+	memcpy(req2->digest, req->digest, sizeof req2->digest);
+	req2->t_req = req->t_req;
+	req2->t_resp = req->t_resp;
+
+	req2->busyobj = oc->busyobj;
+	CHECK_OBJ_NOTNULL(req2->busyobj, BUSYOBJ_MAGIC);
+	/* One ref for req2, one for FetchBody */
+	assert(req2->busyobj->refcount == 1);
+	req2->busyobj->refcount = 2;
+	req2->objcore = oc;
+	req2->bgfetch = 1;
+	req2->req_step = R_STP_MISS;
+
+	sp->task.func = cnt_bgtask;
+	sp->task.priv = req2;
+	AZ(Pool_Task(wrk->pool, &sp->task, POOL_QUEUE_BACK));
+}
+
+static int
+cnt_bgdone(struct worker *wrk, struct req *req)
+{
+
+	AN(req->bgfetch);
+	req->bgfetch = 0;
+	AZ(req->objcore);
+	if (req->busyobj != NULL)
+		cnt_releasebo(wrk, req);
+	if (req->obj != NULL)
+		(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
+	req->director = NULL;
+	req->err_code = 0;
+	req->err_reason = NULL;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * We have a refcounted object on the session, and possibly the busyobj
  * which is fetching it, prepare a response.
@@ -104,6 +245,9 @@ cnt_prepresp(struct worker *wrk, struct req *req)
 	CHECK_OBJ_NOTNULL(req->obj, OBJECT_MAGIC);
 	CHECK_OBJ_NOTNULL(req->vcl, VCL_CONF_MAGIC);
 
+	if (req->bgfetch)
+		return (cnt_bgdone(wrk, req));
+
 	req->res_mode = 0;
 
 	if (bo == NULL) {
@@ -116,6 +260,10 @@ cnt_prepresp(struct worker *wrk, struct req *req)
 		}
 	} else {
 		AZ(bo->do_esi);
+		/* Passed through as is, the backend's length will hold */
+		if (bo->body_status == BS_LENGTH &&
+		    !bo->do_gzip && !bo->do_gunzip)
+			req->res_mode |= RES_LEN;
 	}
 
 	if (req->esi_level > 0) {
@@ -167,11 +315,11 @@ cnt_prepresp(struct worker *wrk, struct req *req)
 			break;
 		if (bo != NULL) {
 			AN(bo->do_stream);
-			(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
-			VBO_DerefBusyObj(wrk, &req->busyobj);
-		} else {
-			(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
+			cnt_releasebo(wrk, req);
 		}
+		if (req->bg_objcore != NULL)
+			cnt_bgdrop(wrk, req);
+		(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
 		AZ(req->obj);
 		http_Teardown(req->resp);
 		req->req_step = R_STP_RESTART;
@@ -195,6 +343,7 @@ DOT }
 DOT deliver -> DONE [style=bold,color=green]
 DOT deliver -> DONE [style=bold,color=red]
 DOT deliver -> DONE [style=bold,color=blue]
+DOT deliver -> miss [label="grace_bgfetch",style=dotted]
  *
  */
 
@@ -210,26 +359,27 @@ cnt_deliver(struct worker *wrk, struct req *req)
 	CHECK_OBJ_ORNULL(bo, BUSYOBJ_MAGIC);
 
 	if (bo != NULL) {
-		while (bo->state < BOS_FAILED)
-			(void)usleep(10000);
-		assert(bo->state >= BOS_FAILED);
-
+		/* The body follows the fetch, see RES_WriteObj() */
+		VBO_waitstate(bo, BOS_FETCHING);
 		if (bo->state == BOS_FAILED) {
-			HSH_Deref(&wrk->stats, NULL, &req->obj);
-			VBO_DerefBusyObj(wrk, &req->busyobj);
+			cnt_releasebo(wrk, req);
+			(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
 			req->err_code = 503;
 			req->req_step = R_STP_ERROR;
 			return (0);
 		}
-		VBO_DerefBusyObj(wrk, &req->busyobj);
 	}
 
-	AZ(req->busyobj);
-	req->director = NULL;
+	/* A background fetch still needs the director */
+	if (req->bg_objcore == NULL)
+		req->director = NULL;
 	req->restarts = 0;
 
 	RES_WriteObj(req);
 
+	if (req->busyobj != NULL)
+		cnt_releasebo(wrk, req);
+
 	/* No point in saving the body if it is hit-for-pass */
 	if (req->obj->objcore->flags & OC_F_PASS)
 		STV_Freestore(req->obj);
@@ -237,6 +387,9 @@ cnt_deliver(struct worker *wrk, struct req *req)
 	assert(WRW_IsReleased(wrk));
 	(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
 	http_Teardown(req->resp);
+
+	if (req->bg_objcore != NULL)
+		cnt_bgstart(wrk, req);
 	return (1);
 }
 /*--------------------------------------------------------------------
@@ -267,6 +420,9 @@ cnt_error(struct worker *wrk, struct req *req)
 	AZ(req->obj);
 	AZ(req->busyobj);
 
+	if (req->bgfetch)
+		return (cnt_bgdone(wrk, req));
+
 	bo = VBO_GetBusyObj(wrk);
 	req->busyobj = bo;
 	AZ(bo->stats);
@@ -394,6 +550,18 @@ cnt_fetch(struct worker *wrk, struct req *req)
 		 */
 		bo->body_status = RFC2616_Body(bo, &wrk->stats);
 
+		/*
+		 * A 304 to our conditional request means we can reuse the
+		 * body of the stale object, under the headers merged from
+		 * both.  Anything else and we have no use for it.
+		 */
+		if (bo->ims_obj != NULL && http_GetStatus(bo->beresp) == 304) {
+			assert(bo->body_status == BS_NONE);
+			http_Merge(bo->ims_obj->http, bo->beresp);
+			wrk->stats.fetch_revalidated++;
+		} else if (bo->ims_obj != NULL)
+			(void)HSH_Deref(&wrk->stats, NULL, &bo->ims_obj);
+
 		req->err_code = http_GetStatus(bo->beresp);
 
 		/*
@@ -513,6 +681,10 @@ cnt_fetchbody(struct worker *wrk, struct req *req)
 	if (!cache_param->http_gzip_support)
 		bo->do_gzip = bo->do_gunzip = 0;
 
+	/* A revalidated body is reused as it was stored */
+	if (bo->ims_obj != NULL)
+		bo->do_esi = bo->do_gzip = bo->do_gunzip = 0;
+
 	bo->is_gzip = http_HdrIs(bo->beresp, H_Content_Encoding, "gzip");
 
 	bo->is_gunzip = !http_GetHdr(bo->beresp, H_Content_Encoding, NULL);
@@ -555,7 +727,9 @@ cnt_fetchbody(struct worker *wrk, struct req *req)
 		bo->do_stream = 0;
 
 	/* No reason to try streaming a non-existing body */
-	if (bo->body_status == BS_NONE)
+	if (bo->body_status == BS_NONE || bo->body_status == BS_ZERO ||
+	    (bo->body_status == BS_LENGTH &&
+	    strtoll(bo->h_content_length, NULL, 10) == 0))
 		bo->do_stream = 0;
 
 	l = http_EstimateWS(bo->beresp,
@@ -676,11 +850,11 @@ cnt_fetchbody(struct worker *wrk, struct req *req)
 		HSH_Ref(req->obj->objcore);
 
 	if (bo->state == BOS_FINISHED) {
-		VBO_DerefBusyObj(wrk, &req->busyobj);
+		cnt_releasebo(wrk, req);
 	} else if (bo->state == BOS_FAILED) {
 		/* handle early failures */
-		HSH_Deref(&wrk->stats, NULL, &req->obj);
-		VBO_DerefBusyObj(wrk, &req->busyobj);
+		cnt_releasebo(wrk, req);
+		(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
 		req->err_code = 503;
 		req->req_step = R_STP_ERROR;
 		return (0);
@@ -718,7 +892,8 @@ cnt_hit(struct worker *wrk, struct req *req)
 	CHECK_OBJ_NOTNULL(req->obj, OBJECT_MAGIC);
 	CHECK_OBJ_NOTNULL(req->vcl, VCL_CONF_MAGIC);
 	AZ(req->objcore);
-	AZ(req->busyobj);
+	/* If the object is still being fetched, we stream it */
+	CHECK_OBJ_ORNULL(req->busyobj, BUSYOBJ_MAGIC);
 
 	assert(!(req->obj->objcore->flags & OC_F_PASS));
 
@@ -733,6 +908,10 @@ cnt_hit(struct worker *wrk, struct req *req)
 	}
 
 	/* Drop our object, we won't need it */
+	if (req->busyobj != NULL)
+		VBO_DerefBusyObj(wrk, &req->busyobj);
+	if (req->bg_objcore != NULL)
+		cnt_bgdrop(wrk, req);
 	(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
 	req->objcore = NULL;
 
@@ -751,6 +930,26 @@ cnt_hit(struct worker *wrk, struct req *req)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Hand the stale object HSH_Lookup() found to the fetch, which will
+ * try to revalidate it, see cnt_miss().
+ */
+
+static void
+cnt_ims(struct worker *wrk, struct req *req, struct busyobj *bo)
+{
+	struct objcore *oc;
+
+	oc = req->ims_oc;
+	req->ims_oc = NULL;
+	if (oc == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(bo->ims_obj);
+	bo->ims_obj = oc_getobj(&wrk->stats, oc);
+	CHECK_OBJ_NOTNULL(bo->ims_obj, OBJECT_MAGIC);
+}
+
 /*--------------------------------------------------------------------
  * LOOKUP
  * Hash things together and look object up in hash-table.
@@ -814,6 +1013,7 @@ cnt_lookup(struct worker *wrk, struct req *req)
 		VRY_Finish(req, bo);
 
 		oc->busyobj = bo;
+		cnt_ims(wrk, req, bo);
 		wrk->stats.cache_miss++;
 
 		req->objcore = oc;
@@ -821,14 +1021,24 @@ cnt_lookup(struct worker *wrk, struct req *req)
 		return (0);
 	}
 
-	/* We are not prepared to do streaming yet */
-	XXXAZ(req->busyobj);
+	/* A busyobj here means the body is still arriving */
+	CHECK_OBJ_ORNULL(req->busyobj, BUSYOBJ_MAGIC);
+	AZ(oc->flags & OC_F_PASS && req->busyobj != NULL);
 
 	o = oc_getobj(&wrk->stats, oc);
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 	req->obj = o;
 
-	VRY_Finish(req, NULL);
+	if (req->bg_objcore != NULL) {
+		/* Refresh the graced object after delivering it */
+		bo = VBO_GetBusyObj(wrk);
+		bo->refcount = 1;
+		VRY_Finish(req, bo);
+		req->bg_objcore->busyobj = bo;
+		cnt_ims(wrk, req, bo);
+		wrk->stats.cache_bgfetch++;
+	} else
+		VRY_Finish(req, NULL);
 
 	if (oc->flags & OC_F_PASS) {
 		wrk->stats.cache_hitpass++;
@@ -863,6 +1073,7 @@ static int
 cnt_miss(struct worker *wrk, struct req *req)
 {
 	struct busyobj *bo;
+	char *p;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -885,6 +1096,15 @@ cnt_miss(struct worker *wrk, struct req *req)
 		http_SetHeader(bo->bereq, "Accept-Encoding: gzip");
 	}
 
+	if (bo->ims_obj != NULL) {
+		/* Ask if our stale copy is still good, see cnt_fetch() */
+		if (http_GetHdr(bo->ims_obj->http, H_Last_Modified, &p))
+			http_PrintfHeader(bo->bereq,
+			    "If-Modified-Since: %s", p);
+		if (http_GetHdr(bo->ims_obj->http, H_ETag, &p))
+			http_PrintfHeader(bo->bereq, "If-None-Match: %s", p);
+	}
+
 	VCL_miss_method(req);
 
 	if (req->handling == VCL_RET_FETCH) {
@@ -943,6 +1163,9 @@ cnt_pass(struct worker *wrk, struct req *req)
 	AZ(req->obj);
 	AZ(req->busyobj);
 
+	if (req->bgfetch)
+		return (cnt_bgdone(wrk, req));
+
 	req->busyobj = VBO_GetBusyObj(wrk);
 	bo = req->busyobj;
 	bo->refcount = 2;
@@ -1035,12 +1258,15 @@ DOT err_restart [label="ERROR",shape=plaintext]
  */
 
 static int
-cnt_restart(const struct worker *wrk, struct req *req)
+cnt_restart(struct worker *wrk, struct req *req)
 {
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
+	if (req->bgfetch)
+		return (cnt_bgdone(wrk, req));
+
 	req->director = NULL;
 	if (++req->restarts >= cache_param->max_restarts) {
 		req->err_code = 503;
@@ -1192,7 +1418,8 @@ CNT_Request(struct worker *wrk, struct req *req)
 	 */
 	assert(
 	    req->req_step == R_STP_LOOKUP ||
-	    req->req_step == R_STP_RECV);
+	    req->req_step == R_STP_RECV ||
+	    (req->req_step == R_STP_MISS && req->bgfetch));
 
 	AN(req->vsl->wid & VSL_CLIENTMARKER);
 
@@ -29,75 +29,178 @@
 
 #include "config.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "cache.h"
 
 #include "vct.h"
 #include "vtim.h"
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Range support [RFC2616 14.35]
+ *
+ * A single range is sent as a plain 206, several as multipart/byteranges.
+ * The part headers live on the workspace, the bodies are written
+ * straight from the storage segments.
+ */
 
-static void
-res_dorange(const struct req *req, const char *r, ssize_t *plow, ssize_t *phigh)
+#define RES_MAXRANGE	32
+
+struct res_range {
+	ssize_t		low;
+	ssize_t		high;
+	const char	*hdr;
+	unsigned	hdrlen;
+};
+
+static int
+res_parserange(ssize_t len, const char *r, struct res_range *rr)
 {
-	ssize_t low, high, has_low;
+	ssize_t low, high, has_low, sum;
+	int n, nr;
 
-	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	assert(req->obj->response == 200);
 	if (strncmp(r, "bytes=", 6))
-		return;
+		return (0);
 	r += 6;
 
-	/* The low end of range */
-	has_low = low = 0;
-	if (!vct_isdigit(*r) && *r != '-')
-		return;
-	while (vct_isdigit(*r)) {
-		has_low = 1;
-		low *= 10;
-		low += *r - '0';
+	n = nr = 0;
+	sum = 0;
+	while (1) {
+		/* The low end of range */
+		has_low = low = 0;
+		if (!vct_isdigit(*r) && *r != '-')
+			return (0);
+		while (vct_isdigit(*r)) {
+			has_low = 1;
+			low *= 10;
+			low += *r - '0';
+			r++;
+		}
+
+		if (*r != '-')
+			return (0);
 		r++;
+
+		/* The high end of range */
+		if (vct_isdigit(*r)) {
+			high = 0;
+			while (vct_isdigit(*r)) {
+				high *= 10;
+				high += *r - '0';
+				r++;
+			}
+			if (!has_low) {
+				low = len - high;
+				high = len - 1;
+			}
+		} else
+			high = len - 1;
+
+		if (low < 0)
+			low = 0;
+		if (high >= len)
+			high = len - 1;
+
+		if (++n > RES_MAXRANGE)
+			return (0);
+		/* Unsatisfiable ranges are dropped */
+		if (low < len && low <= high) {
+			rr[nr].low = low;
+			rr[nr].high = high;
+			sum += 1 + high - low;
+			nr++;
+		}
+
+		while (vct_issp(*r))
+			r++;
+		if (*r == '\0')
+			break;
+		if (*r != ',')
+			return (0);
+		while (*r == ',' || vct_issp(*r))
+			r++;
+		if (*r == '\0')
+			break;
 	}
 
-	if (low >= req->obj->len)
-		return;
+	/* Overlapping ranges would only make us send more than the object */
+	if (sum > len)
+		return (0);
+	return (nr);
+}
 
-	if (*r != '-')
-		return;
-	r++;
+static int
+res_dorange(struct req *req, const char *r, struct res_range *rr)
+{
+	char boundary[17];
+	char *ct;
+	ssize_t cl, len;
+	unsigned u;
+	int i, l, n;
 
-	/* The high end of range */
-	if (vct_isdigit(*r)) {
-		high = 0;
-		while (vct_isdigit(*r)) {
-			high *= 10;
-			high += *r - '0';
-			r++;
-		}
-		if (!has_low) {
-			low = req->obj->len - high;
-			high = req->obj->len - 1;
-		}
-	} else
-		high = req->obj->len - 1;
-	if (*r != '\0')
-		return;
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	assert(req->obj->response == 200);
+	assert(req->res_mode & RES_LEN);
 
-	if (high >= req->obj->len)
-		high = req->obj->len - 1;
+	/* A fetch in progress will end up as long as the backend said */
+	if (req->busyobj != NULL)
+		len = (ssize_t)strtoll(req->busyobj->h_content_length,
+		    NULL, 10);
+	else
+		len = req->obj->len;
 
-	if (low > high)
-		return;
+	n = res_parserange(len, r, rr);
+	if (n == 0)
+		return (0);
+
+	if (n == 1) {
+		http_PrintfHeader(req->resp, "Content-Range: bytes %jd-%jd/%jd",
+		    (intmax_t)rr[0].low, (intmax_t)rr[0].high, (intmax_t)len);
+		cl = 1 + rr[0].high - rr[0].low;
+	} else {
+		if (!http_GetHdr(req->resp, H_Content_Type, &ct))
+			ct = NULL;
+		bprintf(boundary, "%08lx%08lx",
+		    random() & 0xffffffffUL, random() & 0xffffffffUL);
+		cl = 0;
+		/* rr[n] holds the closing delimiter */
+		for (i = 0; i <= n; i++) {
+			u = WS_Reserve(req->ws, 0);
+			if (i < n)
+				l = snprintf(req->ws->f, u,
+				    "\r\n--%s\r\n%s%s%s"
+				    "Content-Range: bytes %jd-%jd/%jd\r\n\r\n",
+				    boundary,
+				    ct != NULL ? "Content-Type: " : "",
+				    ct != NULL ? ct : "",
+				    ct != NULL ? "\r\n" : "",
+				    (intmax_t)rr[i].low, (intmax_t)rr[i].high,
+				    (intmax_t)len);
+			else
+				l = snprintf(req->ws->f, u, "\r\n--%s--\r\n",
+				    boundary);
+			if (l < 0 || (unsigned)l >= u) {
+				/* Out of workspace, send the entire object */
+				WS_Release(req->ws, 0);
+				return (0);
+			}
+			rr[i].hdr = req->ws->f;
+			rr[i].hdrlen = l;
+			WS_Release(req->ws, l);
+			cl += l;
+			if (i < n)
+				cl += 1 + rr[i].high - rr[i].low;
+		}
+		http_Unset(req->resp, H_Content_Type);
+		http_PrintfHeader(req->resp,
+		    "Content-Type: multipart/byteranges; boundary=%s", boundary);
+	}
 
-	http_PrintfHeader(req->resp, "Content-Range: bytes %jd-%jd/%jd",
-	    (intmax_t)low, (intmax_t)high, (intmax_t)req->obj->len);
 	http_Unset(req->resp, H_Content_Length);
-	assert(req->res_mode & RES_LEN);
-	http_PrintfHeader(req->resp, "Content-Length: %jd",
-	    (intmax_t)(1 + high - low));
+	http_PrintfHeader(req->resp, "Content-Length: %jd", (intmax_t)cl);
 	http_SetResp(req->resp, "HTTP/1.1", 206, "Partial Content");
-
-	*plow = low;
-	*phigh = high;
+	return (n);
 }
 
 /*--------------------------------------------------------------------*/
@@ -115,9 +218,16 @@ RES_BuildHttp(struct req *req)
 
 	if (!(req->res_mode & RES_LEN)) {
 		http_Unset(req->resp, H_Content_Length);
-	} else if (cache_param->http_range_support) {
+	} else {
+		if (req->busyobj != NULL) {
+			/* Still fetching, but the backend told us the length */
+			http_Unset(req->resp, H_Content_Length);
+			http_PrintfHeader(req->resp, "Content-Length: %s",
+			    req->busyobj->h_content_length);
+		}
 		/* We only accept ranges if we know the length */
-		http_SetHeader(req->resp, "Accept-Ranges: bytes");
+		if (cache_param->http_range_support)
+			http_SetHeader(req->resp, "Accept-Ranges: bytes");
 	}
 
 	if (req->res_mode & RES_GUNZIP)
@@ -152,17 +262,126 @@ RES_BuildHttp(struct req *req)
 	    req->doclose ? "close" : "keep-alive");
 }
 
+/*--------------------------------------------------------------------
+ * Walk the storage segments of the object.
+ *
+ * If it is still being fetched, we follow the fetch: we flush what we
+ * have sent so far and wait for the busyobj to tell us there is more.
+ * Only the tail segment can still grow, and it is never moved while
+ * streaming (see vfp_nop_end()).
+ *
+ * Returns 1 with a piece of a segment, 0 at the end, -1 if the fetch
+ * failed.
+ */
+
+struct res_iter {
+	struct req		*req;
+	struct busyobj		*bo;
+	struct storage		*st;
+	ssize_t			off;	/* Consumed of st */
+	ssize_t			ptr;	/* Consumed of the object */
+};
+
+static void
+res_iter_init(struct res_iter *ri, struct req *req)
+{
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	memset(ri, 0, sizeof *ri);
+	ri->req = req;
+	ri->bo = req->busyobj;
+	CHECK_OBJ_ORNULL(ri->bo, BUSYOBJ_MAGIC);
+}
+
+static int
+res_iter_next(struct res_iter *ri, struct storage **pst, ssize_t *poff,
+    ssize_t *plen)
+{
+	struct object *obj;
+	struct busyobj *bo;
+	struct storage *st;
+	ssize_t l;
+	int flushed = 0;
+
+	obj = ri->req->obj;
+	CHECK_OBJ_NOTNULL(obj, OBJECT_MAGIC);
+	bo = ri->bo;
+
+	if (bo == NULL) {
+		if (ri->st == NULL)
+			st = VTAILQ_FIRST(&obj->store);
+		else
+			st = VTAILQ_NEXT(ri->st, list);
+		if (st == NULL)
+			return (0);
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		ri->st = st;
+		ri->ptr += st->len;
+		*pst = st;
+		*poff = 0;
+		*plen = st->len;
+		return (1);
+	}
+
+	Lck_Lock(&bo->mtx);
+	while (1) {
+		if (bo->state == BOS_FAILED) {
+			Lck_Unlock(&bo->mtx);
+			return (-1);
+		}
+		st = ri->st;
+		if (st != NULL && ri->off < st->len && ri->ptr < obj->len) {
+			l = st->len - ri->off;
+			if (l > obj->len - ri->ptr)
+				l = obj->len - ri->ptr;
+			break;
+		}
+		if (ri->ptr < obj->len) {
+			/* The rest is in the next segment */
+			if (st == NULL)
+				st = VTAILQ_FIRST(&obj->store);
+			else
+				st = VTAILQ_NEXT(st, list);
+			CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+			ri->st = st;
+			ri->off = 0;
+			continue;
+		}
+		if (bo->state == BOS_FINISHED) {
+			Lck_Unlock(&bo->mtx);
+			return (0);
+		}
+		if (!flushed) {
+			/* Send what we have before we wait for more */
+			Lck_Unlock(&bo->mtx);
+			(void)WRW_Flush(ri->req->wrk);
+			flushed = 1;
+			Lck_Lock(&bo->mtx);
+			continue;
+		}
+		(void)Lck_CondWait(&bo->cond, &bo->mtx, NULL);
+	}
+	Lck_Unlock(&bo->mtx);
+	*pst = st;
+	*poff = ri->off;
+	*plen = l;
+	ri->off += l;
+	ri->ptr += l;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * We have a gzip'ed object and need to ungzip it for a client which
  * does not understand gzip.
  * XXX: handle invalid gzip data better (how ?)
  */
 
-static void
+static int
 res_WriteGunzipObj(struct req *req)
 {
+	struct res_iter ri;
 	struct storage *st;
-	unsigned u = 0;
+	ssize_t off, len, u = 0;
 	struct vgz *vg;
 	int i;
 
@@ -171,39 +390,44 @@ res_WriteGunzipObj(struct req *req)
 	vg = VGZ_NewUngzip(req->vsl, "U D -");
 	AZ(VGZ_WrwInit(vg));
 
-	VTAILQ_FOREACH(st, &req->obj->store, list) {
-		CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	res_iter_init(&ri, req);
+	while ((i = res_iter_next(&ri, &st, &off, &len)) > 0) {
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
-		u += st->len;
+		u += len;
 
-		i = VGZ_WrwGunzip(req, vg, st->ptr, st->len);
 		/* XXX: error check */
-		(void)i;
+		(void)VGZ_WrwGunzip(req, vg, st->ptr + off, len);
 	}
 	VGZ_WrwFlush(req, vg);
 	(void)VGZ_Destroy(&vg);
-	assert(u == req->obj->len);
+	if (ri.bo == NULL)
+		assert(u == req->obj->len);
+	return (i);
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Send bytes low...high of the object, high < 0 means all of it.
+ */
 
-static void
+static int
 res_WriteDirObj(struct req *req, ssize_t low, ssize_t high)
 {
-	ssize_t u = 0;
-	size_t ptr, off, len;
+	struct res_iter ri;
+	ssize_t ptr, off, len;
 	struct storage *st;
+	int i;
+#ifdef SENDFILE_WORKS
+	off_t where;
+	int fd;
+#endif
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
 	ptr = 0;
-	VTAILQ_FOREACH(st, &req->obj->store, list) {
-		CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	res_iter_init(&ri, req);
+	while ((i = res_iter_next(&ri, &st, &off, &len)) > 0) {
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
-		u += st->len;
-		len = st->len;
-		off = 0;
-		if (ptr + len <= low) {
+		if (high >= 0 && ptr + len <= low) {
 			/* This segment is too early */
 			ptr += len;
 			continue;
@@ -214,16 +438,35 @@ res_WriteDirObj(struct req *req, ssize_t low, ssize_t high)
 			len -= (low - ptr);
 			ptr += (low - ptr);
 		}
-		if (ptr + len > high)
+		if (high >= 0 && ptr + len > high)
 			/* Chop tail of segment off */
 			len = 1 + high - ptr;
 
 		ptr += len;
 
 		req->acct_req.bodybytes += len;
-		(void)WRW_Write(req->wrk, st->ptr + off, len);
+#ifdef SENDFILE_WORKS
+		/*
+		 * If the storage is backed by a file, let the kernel send
+		 * it from there instead of copying it out of our mapping.
+		 */
+		if (!(req->res_mode & RES_CHUNKED) &&
+		    cache_param->sendfile_threshold > 0 &&
+		    len >= cache_param->sendfile_threshold &&
+		    (fd = STV_Sendfile(st, &where)) >= 0) {
+			WRW_Sendfile(req->wrk, fd, where + off, len);
+			req->wrk->stats.s_sendfile += len;
+		} else
+#endif
+			(void)WRW_Write(req->wrk, st->ptr + off, len);
+
+		/* Don't wait for the rest of a fetch we have no use for */
+		if (high >= 0 && ptr > high)
+			return (0);
 	}
-	assert(u == req->obj->len);
+	if (i == 0 && ri.bo == NULL && high < 0)
+		assert(ptr == req->obj->len);
+	return (i);
 }
 
 /*--------------------------------------------------------------------
@@ -234,24 +477,25 @@ res_WriteDirObj(struct req *req, ssize_t low, ssize_t high)
 void
 RES_WriteObj(struct req *req)
 {
+	struct res_range rr[RES_MAXRANGE + 1];
 	char *r;
-	ssize_t low, high;
+	int i, nrange, failed;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
 	/*
 	 * If nothing special planned, we can attempt Range support
 	 */
-	low = 0;
-	high = req->obj->len - 1;
+	nrange = 0;
 	if (
 	    req->wantbody &&
 	    (req->res_mode & RES_LEN) &&
 	    !(req->res_mode & (RES_ESI|RES_ESI_CHILD|RES_GUNZIP)) &&
 	    cache_param->http_range_support &&
 	    req->obj->response == 200 &&
-	    http_GetHdr(req->http, H_Range, &r))
-		res_dorange(req, r, &low, &high);
+	    http_GetHdr(req->http, H_Range, &r) &&
+	    RFC2616_Do_IfRange(req))
+		nrange = res_dorange(req, r, rr);
 
 	WRW_Reserve(req->wrk, &req->sp->fd, req->vsl, req->t_resp);
 
@@ -268,9 +512,10 @@ RES_WriteObj(struct req *req)
 	if (req->res_mode & RES_CHUNKED)
 		WRW_Chunked(req->wrk);
 
+	failed = 0;
 	if (!req->wantbody) {
 		/* This was a HEAD or conditional request */
-	} else if (req->obj->len == 0) {
+	} else if (req->busyobj == NULL && req->obj->len == 0) {
 		/* Nothing to do here */
 	} else if (req->res_mode & RES_ESI) {
 		ESI_Deliver(req);
@@ -278,11 +523,32 @@ RES_WriteObj(struct req *req)
 		ESI_DeliverChild(req);
 	} else if (req->res_mode & RES_ESI_CHILD &&
 	    !req->gzip_resp && req->obj->gziped) {
-		res_WriteGunzipObj(req);
+		failed = res_WriteGunzipObj(req);
 	} else if (req->res_mode & RES_GUNZIP) {
-		res_WriteGunzipObj(req);
+		failed = res_WriteGunzipObj(req);
+	} else if (nrange > 1) {
+		for (i = 0; i <= nrange && !failed; i++) {
+			(void)WRW_Write(req->wrk, rr[i].hdr, rr[i].hdrlen);
+			req->acct_req.bodybytes += rr[i].hdrlen;
+			if (i < nrange)
+				failed = res_WriteDirObj(req,
+				    rr[i].low, rr[i].high);
+		}
+	} else if (nrange == 1) {
+		failed = res_WriteDirObj(req, rr[0].low, rr[0].high);
 	} else {
-		res_WriteDirObj(req, low, high);
+		failed = res_WriteDirObj(req, 0, -1);
+	}
+
+	/*
+	 * If the fetch we were streaming from failed, the client must
+	 * not mistake what it got for the complete body.
+	 */
+	if (failed) {
+		(void)WRW_FlushRelease(req->wrk);
+		if (req->sp->fd >= 0)
+			SES_Close(req->sp, SC_TX_ERROR);
+		return;
 	}
 
 	if (req->res_mode & RES_CHUNKED &&
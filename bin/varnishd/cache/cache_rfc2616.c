@@ -339,3 +339,29 @@ RFC2616_Do_Cond(const struct req *req)
 
 	return (do_cond);
 }
+
+/*--------------------------------------------------------------------
+ * If-Range [RFC2616 14.27]
+ *
+ * Only honour a Range if the validator still matches the object.
+ * Weak entity tags never match.
+ */
+
+int
+RFC2616_Do_IfRange(const struct req *req)
+{
+	char *p, *e;
+	double d;
+
+	if (!http_GetHdr(req->http, H_If_Range, &p))
+		return (1);
+	if (*p == '"')
+		return (http_GetHdr(req->obj->http, H_ETag, &e) &&
+		    !strcmp(p, e));
+	if (!strncmp(p, "W/", 2))
+		return (0);
+	if (!http_GetHdr(req->obj->http, H_Last_Modified, &e))
+		return (0);
+	d = VTIM_parse(p);
+	return (d != 0 && d == req->obj->last_modified);
+}
@@ -60,6 +60,7 @@ struct sesspool {
 	struct pool		*pool;
 	struct mempool		*mpl_req;
 	struct mempool		*mpl_sess;
+	void			*waiter_priv;
 };
 
 /*--------------------------------------------------------------------
@@ -287,6 +288,21 @@ SES_Handle(struct sess *sp, double now)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Hand a session to the waiter of its pool
+ */
+
+void
+SES_Wait(struct sess *sp)
+{
+	struct sesspool *pp;
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	pp = sp->sesspool;
+	CHECK_OBJ_NOTNULL(pp, SESSPOOL_MAGIC);
+	WAIT_Enter(pp->waiter_priv, sp);
+}
+
 /*--------------------------------------------------------------------
  * Close a sessions connection.
  * XXX: Technically speaking we should catch a t_end timestamp here
@@ -336,6 +352,48 @@ SES_Delete(struct sess *sp, enum sess_close reason, double now)
 	MPL_Free(pp->mpl_sess, sp);
 }
 
+/*--------------------------------------------------------------------
+ * A copy of the session, without the connection, for work which may
+ * outlive it, see cnt_bgstart().
+ */
+
+struct sess *
+SES_Clone(const struct sess *sp)
+{
+	struct sess *sp2;
+	int i;
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	sp2 = ses_new(sp->sesspool);
+	sp2->fd = -1;
+	sp2->vxid = sp->vxid;
+	sp2->sockaddrlen = sp->sockaddrlen;
+	sp2->sockaddr = sp->sockaddr;
+	sp2->mysockaddrlen = sp->mysockaddrlen;
+	sp2->mysockaddr = sp->mysockaddr;
+	/* server.ip is looked up lazily, and only the original has an fd */
+	if (sp2->mysockaddr.ss_family == AF_UNSPEC && sp->fd >= 0) {
+		i = getsockname(sp->fd,
+		    (void*)&sp2->mysockaddr, &sp2->mysockaddrlen);
+		assert(VTCP_Check(i));
+	}
+	memcpy(sp2->addr, sp->addr, sizeof sp2->addr);
+	memcpy(sp2->port, sp->port, sizeof sp2->port);
+	sp2->t_open = sp->t_open;
+	sp2->t_idle = sp->t_idle;
+	return (sp2);
+}
+
+void
+SES_Free(struct sess *sp)
+{
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(sp->sesspool, SESSPOOL_MAGIC);
+	assert(sp->fd < 0);
+	MPL_Free(sp->sesspool->mpl_sess, sp);
+}
+
 /*--------------------------------------------------------------------
  * Alloc/Free a request
  */
@@ -366,19 +424,19 @@ SES_GetReq(struct worker *wrk, struct sess *sp)
 	assert(p < e);
 
 	nhttp = (uint16_t)cache_param->http_max_hdr;
-	hl = HTTP_estimate(nhttp);
+	hl = HTTP_estimate(nhttp, 1);
 
-	req->http = HTTP_create(p, nhttp);
+	req->http = HTTP_create(p, nhttp, 1);
 	p += hl;
 	p = (void*)PRNDUP(p);
 	assert(p < e);
 
-	req->http0 = HTTP_create(p, nhttp);
+	req->http0 = HTTP_create(p, nhttp, 1);
 	p += hl;
 	p = (void*)PRNDUP(p);
 	assert(p < e);
 
-	req->resp = HTTP_create(p, nhttp);
+	req->resp = HTTP_create(p, nhttp, 1);
 	p += hl;
 	p = (void*)PRNDUP(p);
 	assert(p < e);
@@ -440,6 +498,7 @@ SES_NewPool(struct pool *wp, unsigned pool_no)
 	    &cache_param->workspace_client);
 	bprintf(nb, "sess%u", pool_no);
 	pp->mpl_sess = MPL_New(nb, &cache_param->sess_pool, &ses_size);
+	pp->waiter_priv = WAIT_NewPool(pool_no);
 	return (pp);
 }
 
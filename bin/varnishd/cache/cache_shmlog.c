@@ -37,16 +37,46 @@
 
 #include "cache_backend.h"	// For wrk->vbc
 
+#include "vatomic.h"
 #include "vmb.h"
 #include "vtim.h"
 
 /* These cannot be struct lock, which depends on vsm/vsl working */
 static pthread_mutex_t vsl_mtx;
+static pthread_cond_t vsl_cond;
+static pthread_cond_t vsl_idle;
 static pthread_mutex_t vsm_mtx;
 
+/*
+ * Space in the log is reserved by atomically adding to vsl_next, whose
+ * top 32 bits hold the cycle number, so a writer can tell which trip
+ * through the buffer its reservation belongs to.
+ *
+ * Rather than having each writer put an ENDMARKER behind its record,
+ * which would race the header of the next record, the space ahead of
+ * the writers is prefilled with ENDMARKERs a segment at a time.
+ * Everything below vsl_clear has been prefilled.
+ *
+ * Unless the vsl_lockless parameter is set, writers still serialize
+ * on vsl_mtx, otherwise it is only taken to prefill, wrap or wait for
+ * a wrap.  All offsets are in words from vsl_start.
+ *
+ * vsl_busy counts writers between their reservation and the commit of
+ * their record, a wrap must wait for them before starting over.  While
+ * vsl_wrapping is set, the writer which takes vsl_busy to zero signals
+ * vsl_idle.
+ */
+
+#define VSL_SEGMENTS		16
+
 static uint32_t			*vsl_start;
-static const uint32_t		*vsl_end;
-static uint32_t			*vsl_ptr;
+static volatile uint64_t	vsl_next;
+static volatile unsigned	vsl_clear;
+static volatile unsigned	vsl_cycle;
+static volatile unsigned	vsl_busy;
+static volatile unsigned	vsl_wrapping;
+static unsigned			vsl_limit;
+static unsigned			vsl_segsize;
 
 struct VSC_C_main       *VSC_C_main;
 
@@ -83,24 +113,110 @@ vsl_hdr(enum VSL_tag_e tag, uint32_t *p, unsigned len, uint32_t vxid)
 	p[0] = vsl_w0(tag, len);
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Prefill the next segment with ENDMARKERs, call with vsl_mtx held
+ */
 
 static void
-vsl_wrap(void)
+vsl_prefill(void)
 {
+	unsigned u, e;
+
+	e = vsl_clear + vsl_segsize;
+	if (e > vsl_limit)
+		e = vsl_limit;
+	for (u = vsl_clear; u < e; u++)
+		vsl_start[u] = VSL_ENDMARKER;
+	VWMB();
+	vsl_clear = e;
+}
+
+/*--------------------------------------------------------------------
+ * A writer is done with its reservation, or gave it up.
+ */
+
+static void
+vsl_unbusy(int locked)
+{
+
+	assert(vsl_busy > 0);
+	if (VATOMIC_SUB(&vsl_busy, 1) > 0 || !vsl_wrapping)
+		return;
+	if (!locked)
+		AZ(pthread_mutex_lock(&vsl_mtx));
+	AZ(pthread_cond_broadcast(&vsl_idle));
+	if (!locked)
+		AZ(pthread_mutex_unlock(&vsl_mtx));
+}
+
+/*--------------------------------------------------------------------
+ * Start over from the front, leaving a WRAPMARKER at offset o.
+ * Call with vsl_mtx held, which is dropped while we wait for the
+ * writers still in this cycle.
+ */
+
+static void
+vsl_wrap(unsigned o)
+{
+	uint64_t u;
+
+	assert(o >= 1);
+	assert(o < vsl_limit);
 
-	assert(vsl_ptr >= vsl_start + 1);
-	assert(vsl_ptr < vsl_end);
-	vsl_start[1] = VSL_ENDMARKER;
+	/* Records in flight in this cycle must have their ENDMARKERs */
+	while (vsl_clear <= o)
+		vsl_prefill();
+
+	/* And must be written before we reuse their space */
+	vsl_wrapping = 1;
+	VMB();
+	while (vsl_busy > 0)
+		AZ(pthread_cond_wait(&vsl_idle, &vsl_mtx));
+	vsl_wrapping = 0;
+
+	vsl_clear = 1;
+	vsl_prefill();
 	do
 		vsl_start[0]++;
 	while (vsl_start[0] == 0);
 	VWMB();
-	if (vsl_ptr != vsl_start + 1) {
-		*vsl_ptr = VSL_WRAPMARKER;
-		vsl_ptr = vsl_start + 1;
-	}
+	if (o != 1)
+		vsl_start[o] = VSL_WRAPMARKER;
+	vsl_cycle++;
+	do
+		u = vsl_next;
+	while (!VATOMIC_CAS(&vsl_next, u, ((uint64_t)vsl_cycle << 32) | 1));
 	VSC_C_main->shm_cycles++;
+	AZ(pthread_cond_broadcast(&vsl_cond));
+}
+
+/*--------------------------------------------------------------------
+ * Sort out a reservation which did not fit in the prefilled space.
+ * Call with vsl_mtx held, returns non-zero if the reservation is good.
+ */
+
+static int
+vsl_slow(unsigned c, unsigned o, unsigned w)
+{
+
+	if (c != vsl_cycle) {
+		/* Wrapped under us, the space may already be reused */
+		return (0);
+	}
+	if (o >= vsl_limit) {
+		/* Somebody else straddles the end, wait for the wrap */
+		VSC_C_main->shm_cont++;
+		while (c == vsl_cycle)
+			AZ(pthread_cond_wait(&vsl_cond, &vsl_mtx));
+		return (0);
+	}
+	if (o + w >= vsl_limit) {
+		vsl_wrap(o);
+		return (0);
+	}
+	while (o + w >= vsl_clear)
+		vsl_prefill();
+	return (1);
 }
 
 /*--------------------------------------------------------------------
@@ -110,33 +226,74 @@ vsl_wrap(void)
 static uint32_t *
 vsl_get(unsigned len, unsigned records, unsigned flushes)
 {
-	uint32_t *p;
+	uint64_t u;
+	unsigned w, o, c;
+	int locked = 0;
+
+	w = 2 + VSL_WORDS(len);
+
+	if (!cache_param->vsl_lockless) {
+		if (pthread_mutex_trylock(&vsl_mtx)) {
+			AZ(pthread_mutex_lock(&vsl_mtx));
+			VSC_C_main->shm_cont++;
+		}
+		locked = 1;
+	}
 
-	if (pthread_mutex_trylock(&vsl_mtx)) {
-		AZ(pthread_mutex_lock(&vsl_mtx));
-		VSC_C_main->shm_cont++;
+	while (1) {
+		(void)VATOMIC_ADD(&vsl_busy, 1);
+		u = VATOMIC_FADD(&vsl_next, w);
+		c = (unsigned)(u >> 32);
+		o = (unsigned)u;
+		if (c == vsl_cycle && o + w < vsl_clear)
+			break;
+		vsl_unbusy(locked);
+		if (!locked)
+			AZ(pthread_mutex_lock(&vsl_mtx));
+		if (vsl_slow(c, o, w)) {
+			/* No wrap can happen while we hold vsl_mtx */
+			(void)VATOMIC_ADD(&vsl_busy, 1);
+			if (!locked)
+				AZ(pthread_mutex_unlock(&vsl_mtx));
+			break;
+		}
+		if (!locked)
+			AZ(pthread_mutex_unlock(&vsl_mtx));
+	}
+	VRMB();
+
+	/* Prefill the next segment before anybody needs it */
+	if (o + w + vsl_segsize >= vsl_clear && vsl_clear < vsl_limit) {
+		if (locked)
+			vsl_prefill();
+		else if (!pthread_mutex_trylock(&vsl_mtx)) {
+			vsl_prefill();
+			AZ(pthread_mutex_unlock(&vsl_mtx));
+		}
 	}
-	assert(vsl_ptr < vsl_end);
-	assert(((uintptr_t)vsl_ptr & 0x3) == 0);
 
-	VSC_C_main->shm_writes++;
-	VSC_C_main->shm_flushes += flushes;
-	VSC_C_main->shm_records += records;
+	if (locked)
+		AZ(pthread_mutex_unlock(&vsl_mtx));
 
-	/* Wrap if necessary */
-	if (VSL_END(vsl_ptr, len) >= vsl_end)
-		vsl_wrap();
+	(void)VATOMIC_ADD(&VSC_C_main->shm_writes, 1);
+	if (flushes)
+		(void)VATOMIC_ADD(&VSC_C_main->shm_flushes, flushes);
+	(void)VATOMIC_ADD(&VSC_C_main->shm_records, records);
 
-	p = vsl_ptr;
-	vsl_ptr = VSL_END(vsl_ptr, len);
+	assert(o >= 1);
+	assert(o + w < vsl_limit);
+	return (vsl_start + o);
+}
 
-	*vsl_ptr = VSL_ENDMARKER;
+/*--------------------------------------------------------------------
+ * The record reserved by vsl_get() has been written
+ */
 
-	assert(vsl_ptr < vsl_end);
-	assert(((uintptr_t)vsl_ptr & 0x3) == 0);
-	AZ(pthread_mutex_unlock(&vsl_mtx));
+static inline void
+vsl_put(void)
+{
 
-	return (p);
+	vsl_unbusy(0);
 }
 
 /*--------------------------------------------------------------------
@@ -160,6 +317,7 @@ vslr(enum VSL_tag_e tag, uint32_t vxid, const char *b, unsigned len)
 
 	memcpy(p + 2, b, len);
 	vsl_hdr(tag, p, len, vxid);
+	vsl_put();
 }
 
 /*--------------------------------------------------------------------*/
@@ -206,6 +364,7 @@ VSL_Flush(struct vsl_log *vsl, int overflow)
 	memcpy(p + 1, vsl->wlb + 1, l - 4);
 	VWMB();
 	p[0] = vsl->wlb[0];
+	vsl_put();
 	vsl->wlp = vsl->wlb;
 	vsl->wlr = 0;
 }
@@ -358,6 +517,8 @@ VSM_Init(void)
 	pthread_t tp;
 
 	AZ(pthread_mutex_init(&vsl_mtx, NULL));
+	AZ(pthread_cond_init(&vsl_cond, NULL));
+	AZ(pthread_cond_init(&vsl_idle, NULL));
 	AZ(pthread_mutex_init(&vsm_mtx, NULL));
 
 	vsl_log_start = VSM_Alloc(cache_param->vsl_space, VSL_CLASS, "", "");
@@ -370,15 +531,18 @@ VSM_Init(void)
 	VWMB();
 
 	vsl_start = vsl_log_start;
-	vsl_end = vsl_start +
-	    cache_param->vsl_space / (unsigned)sizeof *vsl_end;
-	vsl_ptr = vsl_start + 1;
+	vsl_limit = cache_param->vsl_space / (unsigned)sizeof *vsl_start;
+	assert(vsl_limit < (1U << 31));
+	vsl_segsize = vsl_limit / VSL_SEGMENTS;
+	vsl_clear = 1;
+	vsl_cycle = 0;
+	vsl_next = 1;
 
 	VSC_C_main = VSM_Alloc(sizeof *VSC_C_main,
 	    VSC_CLASS, VSC_TYPE_MAIN, "");
 	AN(VSC_C_main);
 
-	vsl_wrap();
+	vsl_wrap(1);
 	// VSM_head->starttime = (intmax_t)VTIM_real();
 	memset(VSC_C_main, 0, sizeof *VSC_C_main);
 	// VSM_head->child_pid = getpid();
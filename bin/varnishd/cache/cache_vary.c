@@ -65,8 +65,9 @@ struct vsb *
 VRY_Create(struct req *req, const struct http *hp)
 {
 	char *v, *p, *q, *h, *e;
-	struct vsb *sb, *sbh;
-	unsigned l;
+	struct vsb *sb;
+	char hdr[256];
+	unsigned l, ln;
 
 	/* No Vary: header, no worries */
 	if (!http_GetHdr(hp, H_Vary, &v))
@@ -76,10 +77,6 @@ VRY_Create(struct req *req, const struct http *hp)
 	sb = VSB_new_auto();
 	AN(sb);
 
-	/* For header matching strings */
-	sbh = VSB_new_auto();
-	AN(sbh);
-
 	if (*v == ':') {
 		VSLb(req->vsl, SLT_Error,
 		    "Vary header had extra ':', fix backend");
@@ -94,29 +91,35 @@ VRY_Create(struct req *req, const struct http *hp)
 			continue;
 
 		/* Build a header-matching string out of it */
-		VSB_clear(sbh);
-		VSB_printf(sbh, "%c%.*s:%c",
-		    (char)(1 + (q - p)), (int)(q - p), p, 0);
-		AZ(VSB_finish(sbh));
-
-		if (http_GetHdr(req->http, VSB_data(sbh), &h)) {
-			AZ(vct_issp(*h));
-			/* Trim trailing space */
-			e = strchr(h, '\0');
-			while (e > h && vct_issp(e[-1]))
-				e--;
-			/* Encode two byte length and contents */
-			l = e - h;
-			assert(!(l & ~0xffff));
+		ln = q - p;
+		if (ln + 3 > sizeof hdr) {
+			VSLb(req->vsl, SLT_Error,
+			    "Vary header name too long, ignored");
 		} else {
-			e = h;
-			l = 0xffff;
+			hdr[0] = (char)(1 + ln);
+			memcpy(hdr + 1, p, ln);
+			hdr[ln + 1] = ':';
+			hdr[ln + 2] = '\0';
+
+			if (http_GetHdr(req->http, hdr, &h)) {
+				AZ(vct_issp(*h));
+				/* Trim trailing space */
+				e = strchr(h, '\0');
+				while (e > h && vct_issp(e[-1]))
+					e--;
+				/* Encode two byte length and contents */
+				l = e - h;
+				assert(!(l & ~0xffff));
+			} else {
+				e = h;
+				l = 0xffff;
+			}
+			VSB_printf(sb, "%c%c", (int)(l >> 8), (int)(l & 0xff));
+			/* Append to vary matching string */
+			VSB_bcat(sb, hdr, ln + 3);
+			if (e != h)
+				VSB_bcat(sb, h, e - h);
 		}
-		VSB_printf(sb, "%c%c", (int)(l >> 8), (int)(l & 0xff));
-		/* Append to vary matching string */
-		VSB_bcat(sb, VSB_data(sbh), VSB_len(sbh));
-		if (e != h)
-			VSB_bcat(sb, h, e - h);
 
 		while (vct_issp(*q))
 			q++;
@@ -128,7 +131,6 @@ VRY_Create(struct req *req, const struct http *hp)
 	/* Terminate vary matching string */
 	VSB_printf(sb, "%c%c%c", 0xff, 0xff, 0);
 
-	VSB_delete(sbh);
 	AZ(VSB_finish(sb));
 	return(sb);
 }
@@ -194,6 +196,7 @@ VRY_Prep(struct req *req)
 	}
 	req->vary_b = (void*)req->ws->f;
 	req->vary_e = (void*)req->ws->r;
+	req->vary_nmemo = 0;
 	if (req->vary_b + 2 < req->vary_e)
 		req->vary_b[2] = '\0';
 }
@@ -314,6 +317,141 @@ VRY_Match(struct req *req, const uint8_t *vary)
 	}
 }
 
+/**********************************************************************
+ * Vary signatures
+ *
+ * The vary string of an object is condensed into two hashes: the
+ * "skeleton" covers the header names, the "signature" covers names
+ * and values.  A request computes its signature only once for each
+ * skeleton it meets, so most of the non-matching variants on an
+ * objhead are rejected by comparing two integers, rather than by
+ * walking and rebuilding vary strings.
+ *
+ * A matching signature proves nothing, VRY_Match() has the final say.
+ * A different signature must prove a mismatch however, so the memo is
+ * checked against the header names, not just the skeleton hash.  The
+ * vary strings it points to are safe under the objhead mutex, and the
+ * memo does not outlive HSH_Lookup(), see VRY_Prep().
+ *
+ * Accept-Encoding never goes into the signature, because vry_cmp()
+ * may ignore it, depending on http_gzip_support.
+ */
+
+#define VRY_FNV_INIT	2166136261U
+#define VRY_FNV_PRIME	16777619U
+
+static uint32_t
+vry_hash(uint32_t h, const void *ptr, unsigned len)
+{
+	const uint8_t *p = ptr;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= VRY_FNV_PRIME;
+	}
+	return (h);
+}
+
+static uint32_t
+vry_sig(uint32_t sig, const uint8_t *vary, const char *h, unsigned l)
+{
+	uint8_t b[2];
+
+	if (!strcasecmp(H_Accept_Encoding, (const char*)vary + 2))
+		return (sig);
+	sig = vry_hash(sig, vary + 2, vary[2] + 1);
+	vbe16enc(b, (uint16_t)l);
+	sig = vry_hash(sig, b, 2);
+	if (l != 0xffff)
+		sig = vry_hash(sig, h, l);
+	return (sig);
+}
+
+static void
+vry_sign(struct objcore *oc, const uint8_t *vary)
+{
+	uint32_t skel = VRY_FNV_INIT, sig = VRY_FNV_INIT;
+
+	for (; vary[2]; vary += vry_len(vary)) {
+		skel = vry_hash(skel, vary + 2, vary[2] + 1);
+		sig = vry_sig(sig, vary, (const char*)vary + 4 + vary[2],
+		    vbe16dec(vary));
+	}
+	oc->vary_skel = skel | 1;	/* zero means not signed yet */
+	oc->vary_sig = sig;
+}
+
+static int
+vry_skel_eq(const uint8_t *a, const uint8_t *b)
+{
+
+	if (a == b)
+		return (1);
+	for (; a[2] && b[2]; a += vry_len(a), b += vry_len(b))
+		if (a[2] != b[2] || memcmp(a + 3, b + 3, a[2]))
+			return (0);
+	return (a[2] == b[2]);
+}
+
+static uint32_t
+vry_req_sig(struct req *req, uint32_t skel, const uint8_t *vary)
+{
+	uint32_t sig = VRY_FNV_INIT;
+	unsigned u, l;
+	char *h, *e;
+	const uint8_t *v = vary;
+
+	for (u = 0; u < req->vary_nmemo; u++)
+		if (req->vary_mskel[u] == skel &&
+		    vry_skel_eq(req->vary_mvary[u], vary))
+			return (req->vary_msig[u]);
+
+	for (; v[2]; v += vry_len(v)) {
+		if (http_GetHdr(req->http, (const char*)(v + 2), &h)) {
+			/* Trim trailing space */
+			e = strchr(h, '\0');
+			while (e > h && vct_issp(e[-1]))
+				e--;
+			l = e - h;
+		} else {
+			h = NULL;
+			l = 0xffff;
+		}
+		sig = vry_sig(sig, v, h, l);
+	}
+
+	if (req->vary_nmemo < VRY_NMEMO) {
+		req->vary_mskel[req->vary_nmemo] = skel;
+		req->vary_mvary[req->vary_nmemo] = vary;
+		req->vary_msig[req->vary_nmemo] = sig;
+		req->vary_nmemo++;
+	}
+	return (sig);
+}
+
+/*
+ * Like VRY_Match(), for an objects vary string.  Caller holds the
+ * objhead mutex, which protects the signature in the objcore.
+ */
+
+int
+VRY_MatchObj(struct req *req, struct objcore *oc, const uint8_t *vary)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(vary);
+	if (oc->vary_skel == 0)
+		vry_sign(oc, vary);
+
+	/* Let the first one build the predictive vary string */
+	if (req->vary_l != NULL &&
+	    vry_req_sig(req, oc->vary_skel, vary) != oc->vary_sig) {
+		req->wrk->stats.n_vary_reject++;
+		return (0);
+	}
+	return (VRY_Match(req, vary));
+}
+
 void
 VRY_Validate(const uint8_t *vary)
 {
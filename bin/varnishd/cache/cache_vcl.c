@@ -108,6 +108,17 @@ VCL_Refresh(struct VCL_conf **vcc)
 	VCL_Get(vcc);
 }
 
+void
+VCL_Ref(struct VCL_conf *vc)
+{
+
+	AN(vc);
+	Lck_Lock(&vcl_mtx);
+	assert(vc->busy > 0);
+	vc->busy++;
+	Lck_Unlock(&vcl_mtx);
+}
+
 void
 VCL_Rel(struct VCL_conf **vcc)
 {
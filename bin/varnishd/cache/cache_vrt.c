@@ -397,6 +397,7 @@ VRT_Rollback(struct req *req)
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	HTTP_Copy(req->http, req->http0);
+	req->re_memo = NULL;
 	WS_Reset(req->ws, req->ws_req);
 }
 
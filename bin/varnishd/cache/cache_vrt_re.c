@@ -80,6 +80,131 @@ VRT_re_match(struct req *req, const char *s, void *re)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Regexp sets
+ *
+ * VCC collects the regexps tested against the same variable into a set.
+ * We remember, per request and subject, the outcome of the tests, so a
+ * test repeated elsewhere in the VCL is answered from the memo.
+ *
+ * The first test against a subject is just matched, so that a chain
+ * which stops there pays for one regexp.  When a second test follows,
+ * the chain is likely to go on, so we take one pass over the subject
+ * to find the members which can possibly match, and from then on only
+ * those are run through PCRE.
+ */
+
+#define VRT_RE_UNKNOWN		0
+#define VRT_RE_NOMATCH		1
+#define VRT_RE_MATCH		2
+
+struct vrt_re_memo {
+	unsigned		magic;
+#define VRT_RE_MEMO_MAGIC	0x3b9a4e61
+	struct vrt_re_memo	*next;
+	const void		*set;
+	const char		*subject;
+	unsigned		len;
+	unsigned		nexec;
+	unsigned char		*may;		/* See VRE_set_filter() */
+	unsigned char		res[];
+};
+
+void
+VRT_re_set_init(void **rep, unsigned n, const char * const *re)
+{
+	vre_set_t *t;
+	const char *error;
+	int erroroffset;
+
+	/* These were already check-compiled by the VCL compiler */
+	t = VRE_set_compile(re, n, 0, &error, &erroroffset);
+	AN(t);
+	*rep = t;
+}
+
+void
+VRT_re_set_fini(void *rep)
+{
+	vre_set_t *vv;
+
+	vv = rep;
+	if (rep != NULL)
+		VRE_set_free(&vv);
+}
+
+static struct vrt_re_memo *
+vrt_re_set_memo(struct req *req, const char *s, const vre_set_t *t)
+{
+	struct vrt_re_memo *rm;
+	unsigned n;
+	size_t l;
+
+	for (rm = req->re_memo; rm != NULL; rm = rm->next) {
+		CHECK_OBJ_NOTNULL(rm, VRT_RE_MEMO_MAGIC);
+		if (rm->set == t && !strcmp(rm->subject, s))
+			return (rm);
+	}
+
+	n = VRE_set_count(t);
+	l = strlen(s);
+	rm = (void*)WS_Alloc(req->ws, sizeof *rm + 2 * n);
+	if (rm == NULL)
+		return (NULL);
+	memset(rm, 0, sizeof *rm + n);
+	rm->magic = VRT_RE_MEMO_MAGIC;
+	rm->set = t;
+	rm->len = l;
+	rm->subject = WS_Copy(req->ws, s, l + 1);
+	if (rm->subject == NULL)
+		return (NULL);
+	rm->next = req->re_memo;
+	req->re_memo = rm;
+	return (rm);
+}
+
+int
+VRT_re_set_match(struct req *req, const char *s, void *re, unsigned idx)
+{
+	struct vrt_re_memo *rm;
+	vre_set_t *t;
+	int i;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (s == NULL)
+		s = "";
+	AN(re);
+	t = re;
+	assert(idx < VRE_set_count(t));
+	rm = vrt_re_set_memo(req, s, t);
+	if (rm == NULL) {
+		/* Out of workspace, go it alone */
+		i = VRE_set_exec_one(t, idx, s, strlen(s),
+		    &cache_param->vre_limits);
+	} else if (rm->res[idx] != VRT_RE_UNKNOWN) {
+		return (rm->res[idx] == VRT_RE_MATCH);
+	} else {
+		if (rm->nexec > 0 && rm->may == NULL) {
+			rm->may = rm->res + VRE_set_count(t);
+			VRE_set_filter(t, rm->subject, rm->len, rm->may);
+		}
+		if (rm->may != NULL && !rm->may[idx])
+			i = VRE_ERROR_NOMATCH;
+		else {
+			i = VRE_set_exec_one(t, idx, rm->subject, rm->len,
+			    &cache_param->vre_limits);
+			rm->nexec++;
+		}
+		if (i >= VRE_ERROR_NOMATCH)
+			rm->res[idx] = i >= 0 ? VRT_RE_MATCH : VRT_RE_NOMATCH;
+	}
+	if (i >= 0)
+		return (1);
+	if (i < VRE_ERROR_NOMATCH )
+		VSLb(req->vsl, SLT_VCL_Error, "Regexp matching returned %d", i);
+	return (0);
+}
+
 const char *
 VRT_regsub(struct req *req, int all, const char *str, void *re,
     const char *sub)
@@ -483,7 +483,8 @@ VRT_r_server_ip(const struct req *req)
 	int i;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	if (req->sp->mysockaddr.ss_family == AF_UNSPEC) {
+	if (req->sp->mysockaddr.ss_family == AF_UNSPEC &&
+	    req->sp->fd >= 0) {
 		i = getsockname(req->sp->fd,
 		    (void*)&req->sp->mysockaddr, &req->sp->mysockaddrlen);
 		assert(VTCP_Check(i));
@@ -523,7 +524,8 @@ VRT_r_server_port(const struct req *req)
 	int i;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	if (req->sp->mysockaddr.ss_family == AF_UNSPEC) {
+	if (req->sp->mysockaddr.ss_family == AF_UNSPEC &&
+	    req->sp->fd >= 0) {
 		i = getsockname(req->sp->fd,
 		    (void*)&req->sp->mysockaddr, &req->sp->mysockaddrlen);
 		assert(VTCP_Check(i));
@@ -40,40 +40,35 @@
 
 static struct lock		wstat_mtx;
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Pool workers fold their stats into the counter block of their pool,
+ * see Pool_SumStat().  Only threads outside the pools touch wstat_mtx.
+ */
 
 static void
-wrk_sumstat(struct worker *w)
+wrk_pubstat(struct dstat *ds)
 {
 
-	Lck_AssertHeld(&wstat_mtx);
+	Lck_Lock(&wstat_mtx);
 #define L0(n)
-#define L1(n) (VSC_C_main->n += w->stats.n)
+#define L1(n) (VSC_C_main->n += ds->n)
 #define VSC_F(n, t, l, f, d, e) L##l(n);
 #include "tbl/vsc_f_main.h"
 #undef VSC_F
 #undef L0
 #undef L1
-	memset(&w->stats, 0, sizeof w->stats);
+	Lck_Unlock(&wstat_mtx);
+	memset(ds, 0, sizeof *ds);
 }
 
 void
 WRK_SumStat(struct worker *w)
 {
 
-	Lck_Lock(&wstat_mtx);
-	wrk_sumstat(w);
-	Lck_Unlock(&wstat_mtx);
-}
-
-int
-WRK_TrySumStat(struct worker *w)
-{
-	if (Lck_Trylock(&wstat_mtx))
-		return (0);
-	wrk_sumstat(w);
-	Lck_Unlock(&wstat_mtx);
-	return (1);
+	if (w->pool != NULL)
+		Pool_SumStat(w);
+	else
+		wrk_pubstat(&w->stats);
 }
 
 /*--------------------------------------------------------------------
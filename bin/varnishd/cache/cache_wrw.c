@@ -36,6 +36,14 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>
+#ifdef SENDFILE_WORKS
+#  if defined(__FreeBSD__)
+#    include <sys/socket.h>
+#  elif defined(__linux__)
+#    include <sys/sendfile.h>
+#    include <sys/socket.h>
+#  endif
+#endif
 
 #include <limits.h>
 #include <stdio.h>
@@ -266,6 +274,77 @@ WRW_Write(const struct worker *wrk, const void *ptr, int len)
 	return (len);
 }
 
+#ifdef SENDFILE_WORKS
+/*--------------------------------------------------------------------
+ * Send len bytes from offset off in file fd, after whatever is already
+ * queued.  Cannot be used while chunking, as we do not add chunk headers.
+ */
+
+void
+WRW_Sendfile(const struct worker *wrk, int fd, off_t off, unsigned len)
+{
+	struct wrw *wrw;
+	ssize_t i;
+	size_t left;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	wrw = wrk->wrw;
+	CHECK_OBJ_NOTNULL(wrw, WRW_MAGIC);
+	AN(wrw->wfd);
+	assert(fd >= 0);
+	assert(len > 0);
+	assert(wrw->ciov == wrw->siov);
+
+	if (WRW_Flush(wrk) || *wrw->wfd < 0)
+		return;
+
+	left = len;
+	while (left > 0) {
+#if defined(__FreeBSD__)
+		off_t sent = 0;
+
+		i = sendfile(fd, *wrw->wfd, off, left, NULL, &sent, 0);
+		if (i < 0 && sent > 0)
+			i = sent;
+		else if (i == 0)
+			i = sent;
+		off += sent;
+#elif defined(__linux__)
+		i = sendfile(*wrw->wfd, fd, &off, left);
+#else
+#error Unknown sendfile() implementation
+#endif
+		if (i <= 0)
+			break;
+		left -= i;
+		if (left == 0)
+			break;
+		/* We hit a timeout, but some data was sent */
+		if (VTIM_real() - wrw->t0 > cache_param->send_timeout) {
+			VSLb(wrw->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "sendfile = %zu/%u; not retrying",
+			    len - left, len);
+			wrw->werr++;
+			return;
+		}
+		VSLb(wrw->vsl, SLT_Debug,
+		    "Hit send timeout, sendfile = %zu/%u; retrying",
+		    len - left, len);
+	}
+	if (left > 0) {
+		wrw->werr++;
+		if (i < 0)
+			VSLb(wrw->vsl, SLT_Debug,
+			    "Sendfile error, retval = %zd, len = %u, errno = %s",
+			    i, len, strerror(errno));
+		else
+			VSLb(wrw->vsl, SLT_Debug,
+			    "Sendfile short, sent = %zu/%u", len - left, len);
+	}
+}
+#endif
+
 void
 WRW_Chunked(const struct worker *wrk)
 {
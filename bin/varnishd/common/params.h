@@ -69,6 +69,9 @@ struct params {
 	/* Default grace period */
 	double			default_grace;
 
+	/* Refresh graced objects after delivering them */
+	unsigned		grace_bgfetch;
+
 	/* Default keep period */
 	double			default_keep;
 
@@ -87,6 +90,8 @@ struct params {
 	double			wthread_stats_rate;
 	ssize_t			wthread_stacksize;
 	unsigned		wthread_queue_limit;
+	unsigned		wthread_steal;
+	double			wthread_delay_target;
 
 	/* Memory allocation hints */
 	unsigned		workspace_client;
@@ -94,6 +99,7 @@ struct params {
 	unsigned		workspace_thread;
 
 	unsigned		vsl_buffer;
+	unsigned		vsl_lockless;
 
 	unsigned		shm_workspace;
 	unsigned		http_req_size;
@@ -108,9 +114,14 @@ struct params {
 	double			timeout_idle;
 	double			timeout_req;
 	unsigned		pipe_timeout;
+	unsigned		pipe_splice;
+	unsigned		pipe_eventloop;
 	unsigned		send_timeout;
 	unsigned		idle_send_timeout;
 
+	/* Delivery hints */
+	ssize_t			sendfile_threshold;
+
 	/* Management hints */
 	unsigned		auto_restart;
 
@@ -150,6 +161,9 @@ struct params {
 	/* Default connection_timeout */
 	double			connect_timeout;
 
+	/* Idle backend connections to keep open */
+	unsigned		backend_idle_min;
+
 	/* Read timeouts for backend */
 	double			first_byte_timeout;
 	double			between_bytes_timeout;
@@ -168,6 +182,7 @@ struct params {
 
 	/* Expiry pacer parameters */
 	double			expiry_sleep;
+	unsigned		expiry_wheel;
 
 	/* Acceptor pacer parameters */
 	double			acceptor_sleep_max;
@@ -180,6 +195,9 @@ struct params {
 	/* How long time does the ban lurker sleep */
 	double			ban_lurker_sleep;
 
+	/* Number of ban shards, each with its own lurker */
+	unsigned		ban_shards;
+
 	/* Max size of the saintmode list. 0 == no saint mode. */
 	unsigned		saintmode_threshold;
 
@@ -195,6 +213,7 @@ struct params {
 	unsigned		obj_readonly;
 
 	double			critbit_cooloff;
+	unsigned		critbit_snapshot;
 
 	double			shortlived;
 
@@ -480,6 +480,21 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	}
 }
 
+/*
+ * Lockless lookup for HSH_Lookup()'s snapshot path.  No reference is
+ * taken, the objhead is only safe to look at because deleted objheads
+ * sit on the cooloff list for a while.
+ */
+
+static struct objhead * __match_proto__(hash_peek_f)
+hcb_peek(struct worker *wrk, const void *digest)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	return (hcb_insert(wrk, &hcb_root, digest, NULL));
+}
+
 static void __match_proto__(hash_prep_f)
 hcb_prep(struct worker *wrk)
 {
@@ -499,4 +514,5 @@ const struct hash_slinger hcb_slinger = {
 	.lookup =	hcb_lookup,
 	.prep =		hcb_prep,
 	.deref  =	hcb_deref,
+	.peek	=	hcb_peek,
 };
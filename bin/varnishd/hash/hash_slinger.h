@@ -39,6 +39,7 @@ typedef void hash_prep_f(struct worker *);
 typedef struct objhead *hash_lookup_f(struct worker *wrk, const void *digest,
     struct objhead **nobj);
 typedef int hash_deref_f(struct objhead *obj);
+typedef struct objhead *hash_peek_f(struct worker *wrk, const void *digest);
 
 struct hash_slinger {
 	unsigned		magic;
@@ -49,6 +50,7 @@ struct hash_slinger {
 	hash_prep_f		*prep;
 	hash_lookup_f		*lookup;
 	hash_deref_f		*deref;
+	hash_peek_f		*peek;
 };
 
 /* cache_hash.c */
@@ -80,6 +82,7 @@ struct objhead {
 	VTAILQ_HEAD(,objcore)	objcs;
 	unsigned char		digest[DIGEST_LEN];
 	struct waitinglist	*waitinglist;
+	struct objcore * volatile snap_oc;	/* See HSH_Lookup() */
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
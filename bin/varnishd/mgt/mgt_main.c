@@ -165,6 +165,7 @@ usage(void)
 	fprintf(stderr, FMT,
 	    "-s kind[,storageoptions]", "Backend storage specification");
 	fprintf(stderr, FMT, "", "  -s malloc");
+	fprintf(stderr, FMT, "", "  -s slab[,<size>]");
 #ifdef HAVE_LIBUMEM
 	fprintf(stderr, FMT, "", "  -s umem");
 #endif
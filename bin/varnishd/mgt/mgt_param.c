@@ -219,7 +219,7 @@ tweak_generic_bool(struct cli *cli, volatile unsigned *dest, const char *arg)
 
 /*--------------------------------------------------------------------*/
 
-static void
+void
 tweak_bool(struct cli *cli, const struct parspec *par, const char *arg)
 {
 	volatile unsigned *dest;
@@ -765,6 +765,13 @@ static const struct parspec input_parspec[] = {
 		"Minimum is 1k bytes.",
 		0,
 		"4k", "bytes" },
+	{ "vsl_lockless", tweak_bool, &mgt_param.vsl_lockless, 0, 0,
+		"Reserve space in the VSL fifo buffer with atomic"
+		" operations instead of serializing all writers on"
+		" the VSL mutex.\n"
+		"The mutex is still taken when the buffer wraps.",
+		EXPERIMENTAL,
+		"off", "bool" },
 	{ "shm_reclen",
 		tweak_bytes_u, &mgt_param.shm_reclen, 16, 65535,
 		"Maximum number of bytes in SHM log record.\n"
@@ -780,6 +787,14 @@ static const struct parspec input_parspec[] = {
 		"made until they are fetched from the backend again.\n",
 		DELAYED_EFFECT,
 		"10", "seconds" },
+	{ "grace_bgfetch", tweak_bool, &mgt_param.grace_bgfetch, 0, 0,
+		"When a request finds an object in grace, and nobody is "
+		"fetching a new copy, deliver the graced object right away "
+		"and have the request fetch the new copy after the response "
+		"has been sent.\n"
+		"Without this, the request waits for the backend.",
+		0,
+		"off", "bool" },
 	{ "default_keep", tweak_timeout_double, &mgt_param.default_keep,
 		0, UINT_MAX,
 		"Default keep period.  We will keep a useless object "
@@ -807,12 +822,32 @@ static const struct parspec input_parspec[] = {
 		"for it to do.\n",
 		0,
 		"1", "seconds" },
+	{ "expiry_wheel", tweak_bool, &mgt_param.expiry_wheel, 0, 0,
+		"Use sharded hierarchical timer wheels for object expiry, "
+		"instead of a single binary heap.\n"
+		"Insert and rearm become O(1), and expiry is done a "
+		"bucket at a time, at a resolution of 0.1 second.",
+		MUST_RESTART | EXPERIMENTAL,
+		"off", "bool" },
 	{ "pipe_timeout", tweak_timeout, &mgt_param.pipe_timeout, 0, 0,
 		"Idle timeout for PIPE sessions. "
 		"If nothing have been received in either direction for "
 		"this many seconds, the session is closed.\n",
 		0,
 		"60", "seconds" },
+	{ "pipe_splice", tweak_bool, &mgt_param.pipe_splice, 0, 0,
+		"Relay PIPE sessions with splice(2), so the data is moved "
+		"between the sockets by the kernel, without being copied "
+		"through userland.\n"
+		"Has no effect on platforms without splice(2).",
+		0,
+		"on", "bool" },
+	{ "pipe_eventloop", tweak_bool, &mgt_param.pipe_eventloop, 0, 0,
+		"Hand PIPE sessions to a shared event loop thread once the "
+		"request has been sent to the backend, instead of having "
+		"each tie up a worker thread until it closes.",
+		EXPERIMENTAL,
+		"off", "bool" },
 	{ "send_timeout", tweak_timeout, &mgt_param.send_timeout, 0, 0,
 		"Send timeout for client connections. "
 		"If the HTTP response hasn't been transmitted in this many\n"
@@ -856,6 +891,18 @@ static const struct parspec input_parspec[] = {
 		"fragmentation.\n",
 		EXPERIMENTAL,
 		"256m", "bytes" },
+	{ "sendfile_threshold",
+		tweak_bytes,
+		    &mgt_param.sendfile_threshold, 0, UINT_MAX,
+		"The minimum size of storage segments delivered with "
+		"sendfile(2) rather than written from memory.  "
+		"Only storage backed by a file, such as -sfile, "
+		"supports this, and only for objects which are delivered "
+		"unchanged and unchunked.  Storage which was sent this "
+		"way is not reused until a second after it was freed.  "
+		"Zero disables sendfile(2).",
+		EXPERIMENTAL,
+		"0", "bytes" },
 	{ "accept_filter", tweak_bool, &mgt_param.accept_filter, 0, 0,
 		"Enable kernel accept-filters, if supported by the kernel.",
 		MUST_RESTART,
@@ -884,7 +931,7 @@ static const struct parspec input_parspec[] = {
 		" this limit, the reponse code will be 201 instead of"
 		" 200 and the last line will indicate the truncation.",
 		0,
-		"48k", "bytes" },
+		"64k", "bytes" },
 	{ "cli_timeout", tweak_timeout, &mgt_param.cli_timeout, 0, 0,
 		"Timeout for the childs replies to CLI requests from "
 		"the mgt_param.",
@@ -942,6 +989,15 @@ static const struct parspec input_parspec[] = {
 		"backend request.",
 		0,
 		"0.7", "s" },
+	{ "backend_idle_min", tweak_uint, &mgt_param.backend_idle_min,
+		0, 128,
+		"Number of idle connections to keep open to each backend.  "
+		"When fewer than this are idle, new connections are opened "
+		"in the background, so that requests do not have to wait "
+		"for the TCP handshake.  Only backends of loaded VCLs which "
+		"are not known to be sick are pre-warmed.",
+		EXPERIMENTAL,
+		"0", "connections" },
 	{ "first_byte_timeout", tweak_timeout_double,
 		&mgt_param.first_byte_timeout,0, UINT_MAX,
 		"Default timeout for receiving first byte from backend. "
@@ -1044,6 +1100,12 @@ static const struct parspec input_parspec[] = {
 		"A value of zero disables the ban lurker.",
 		0,
 		"0.01", "s" },
+	{ "ban_shards", tweak_uint, &mgt_param.ban_shards, 1, 64,
+		"Number of shards the objects on the ban list are split "
+		"into.  Each shard has its own lock and ban lurker thread, "
+		"and the shards are processed in parallel.",
+		MUST_RESTART | EXPERIMENTAL,
+		"1", "shards" },
 	{ "saintmode_threshold", tweak_uint,
 		&mgt_param.saintmode_threshold, 0, UINT_MAX,
 		"The maximum number of objects held off by saint mode before "
@@ -1101,6 +1163,14 @@ static const struct parspec input_parspec[] = {
 		"on the cooloff list.\n",
 		WIZARD,
 		"180.0", "s" },
+	{ "critbit_snapshot", tweak_bool, &mgt_param.critbit_snapshot, 0, 0,
+		"Publish the newest object on each objhead, so that hits "
+		"on fresh, non-busy objects without Vary can be found "
+		"without taking the objhead lock.\n"
+		"Objcores which have been published are kept on a cooloff "
+		"list for critbit_cooloff after they are freed.",
+		EXPERIMENTAL,
+		"off", "bool" },
 	{ "vcl_dir", tweak_string, &mgt_vcl_dir, 0, 0,
 		"Directory from which relative VCL filenames (vcl.load and "
 		"include) are opened.",
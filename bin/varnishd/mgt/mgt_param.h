@@ -56,6 +56,7 @@ void tweak_uint(struct cli *cli, const struct parspec *par, const char *arg);
 void tweak_timeout_double(struct cli *cli,
     const struct parspec *par, const char *arg);
 void tweak_bytes(struct cli *cli, const struct parspec *par, const char *arg);
+void tweak_bool(struct cli *cli, const struct parspec *par, const char *arg);
 
 /* mgt_param_vsl.c */
 extern const struct parspec VSL_parspec[];
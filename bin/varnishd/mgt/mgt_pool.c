@@ -185,12 +185,13 @@ const struct parspec WRK_parspec[] = {
 		"0.2", "seconds" },
 	{ "thread_stats_rate",
 		tweak_uint, &mgt_param.wthread_stats_rate, 0, UINT_MAX,
-		"Worker threads accumulate statistics, and dump these into "
-		"the global stats counters if the lock is free when they "
-		"finish a request.\n"
+		"Worker threads accumulate statistics, and fold these into "
+		"their thread pool now and then, and when they go idle.  The "
+		"pools are published in the global stats counters by the "
+		"pool herders.\n"
 		"This parameters defines the maximum number of requests "
-		"a worker thread may handle, before it is forced to dump "
-		"its accumulated stats into the global counters.\n",
+		"a worker thread may handle on one session, before it is "
+		"forced to fold its accumulated stats into its pool.\n",
 		EXPERIMENTAL,
 		"10", "requests" },
 	{ "thread_queue_limit", tweak_uint, &mgt_param.wthread_queue_limit,
@@ -202,6 +203,30 @@ const struct parspec WRK_parspec[] = {
 		"be dropped instead of queued.\n",
 		EXPERIMENTAL,
 		"20", "" },
+	{ "thread_pool_steal", tweak_bool, &mgt_param.wthread_steal, 0, 0,
+		"Let thread pools steal work from each other.\n"
+		"\n"
+		"A pool with no idle thread hands new tasks to an idle "
+		"thread in another pool, and a thread which runs out of "
+		"work takes queued tasks from other pools, before going "
+		"idle.\n"
+		"Other pools are only ever try-locked.",
+		EXPERIMENTAL,
+		"off", "bool" },
+	{ "thread_pool_delay_target",
+		tweak_timeout_double, &mgt_param.wthread_delay_target,
+		0, UINT_MAX,
+		"Target for the 99th percentile of the time tasks wait "
+		"for a worker thread.\n"
+		"\n"
+		"Once a second, each pool grows by an eighth if it missed "
+		"this target, and retires a thread which was idle the "
+		"entire second, if it made half the target.\n"
+		"thread_pool_min and thread_pool_max are still obeyed.\n"
+		"\n"
+		"Zero disables this, leaving only thread_pool_timeout.",
+		EXPERIMENTAL,
+		"0", "seconds" },
 	{ "rush_exponent", tweak_uint, &mgt_param.rush_exponent, 2, UINT_MAX,
 		"How many parked request we start for each completed "
 		"request on the object.\n"
@@ -156,6 +156,20 @@ stv_pick_stevedore(struct vsl_log *vsl, const char **hint)
 	return (stv);
 }
 
+/*-------------------------------------------------------------------
+ * Space a stevedore holds on to after it was freed, see smf_free().
+ * A nuke which only adds to it does not count against nuke_limit.
+ */
+
+static uintmax_t
+stv_held(const struct stevedore *stv)
+{
+
+	if (stv->held == NULL)
+		return (0);
+	return (stv->held(stv));
+}
+
 /*-------------------------------------------------------------------*/
 
 static struct storage *
@@ -164,6 +178,7 @@ stv_alloc(struct busyobj *bo, size_t size)
 	struct storage *st;
 	struct stevedore *stv;
 	unsigned fail = 0;
+	uintmax_t held;
 	struct object *obj;
 
 	/*
@@ -194,8 +209,11 @@ stv_alloc(struct busyobj *bo, size_t size)
 		}
 
 		/* no luck; try to free some space and keep trying */
+		held = stv_held(stv);
 		if (EXP_NukeOne(bo, stv->lru) == -1)
 			break;
+		if (stv_held(stv) > held)
+			continue;
 
 		/* Enough is enough: try another if we have one */
 		if (++fail >= cache_param->nuke_limit)
@@ -254,7 +272,7 @@ STV_MkObject(struct stevedore *stv, struct busyobj *bo, struct objcore **ocp,
 	l = PRNDDN(ltot - (sizeof *o + soc->lhttp));
 	assert(l >= soc->wsl);
 
-	o->http = HTTP_create(o + 1, soc->nhttp);
+	o->http = HTTP_create(o + 1, soc->nhttp, 0);
 	WS_Init(o->ws_o, "obj", (char *)(o + 1) + soc->lhttp, soc->wsl);
 	WS_Assert(o->ws_o);
 	assert(o->ws_o->e <= (char*)ptr + ltot);
@@ -319,6 +337,7 @@ STV_NewObject(struct busyobj *bo, struct objcore **ocp, const char *hint,
 	struct stevedore *stv, *stv0;
 	unsigned lhttp, ltot;
 	struct stv_objsecrets soc;
+	uintmax_t held;
 	int i;
 
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
@@ -326,7 +345,7 @@ STV_NewObject(struct busyobj *bo, struct objcore **ocp, const char *hint,
 	assert(wsl > 0);
 	wsl = PRNDUP(wsl);
 
-	lhttp = HTTP_estimate(nhttp);
+	lhttp = HTTP_estimate(nhttp, 0);
 	lhttp = PRNDUP(lhttp);
 
 	memset(&soc, 0, sizeof soc);
@@ -349,9 +368,12 @@ STV_NewObject(struct busyobj *bo, struct objcore **ocp, const char *hint,
 	}
 	if (o == NULL) {
 		/* no luck; try to free some space and keep trying */
-		for (i = 0; o == NULL && i < cache_param->nuke_limit; i++) {
+		for (i = 0; o == NULL && i < cache_param->nuke_limit;) {
+			held = stv_held(stv);
 			if (EXP_NukeOne(bo, stv->lru) == -1)
 				break;
+			if (stv_held(stv) <= held)
+				i++;
 			o = stv->allocobj(stv, bo, ocp, ltot, &soc);
 		}
 	}
@@ -403,6 +425,36 @@ STV_trim(struct storage *st, size_t size, int move_ok)
 		st->stevedore->trim(st, size, move_ok);
 }
 
+/*--------------------------------------------------------------------
+ * Copy a segment into a smaller one, for when the original cannot be
+ * trimmed because somebody may be using it.  Nuking objects to make
+ * room for this is not worth it.
+ */
+
+struct storage *
+STV_trimcopy(const struct storage *st)
+{
+	struct storage *st2;
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	AN(st->stevedore);
+	AN(st->stevedore->alloc);
+	assert(st->len > 0);
+	st2 = st->stevedore->alloc(st->stevedore, st->len);
+	if (st2 == NULL)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(st2, STORAGE_MAGIC);
+	if (st2->space >= st->space) {
+		STV_free(st2);
+		return (NULL);
+	}
+	memcpy(st2->ptr, st->ptr, st->len);
+	st2->len = st->len;
+	if (st2->len < st2->space)
+		STV_trim(st2, st2->len, 0);
+	return (st2);
+}
+
 void
 STV_free(struct storage *st)
 {
@@ -413,6 +465,22 @@ STV_free(struct storage *st)
 	st->stevedore->free(st);
 }
 
+/*--------------------------------------------------------------------
+ * Find the file and offset of a storage segment, if it has one, so it
+ * can be delivered with sendfile(2).
+ */
+
+int
+STV_Sendfile(const struct storage *st, off_t *where)
+{
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	AN(st->stevedore);
+	if (st->stevedore->sendfile == NULL)
+		return (-1);
+	return (st->stevedore->sendfile(st, where));
+}
+
 void
 STV_open(void)
 {
@@ -463,6 +531,24 @@ STV_BanInfo(enum baninfo event, const uint8_t *ban, unsigned len)
 			stv->baninfo(stv, event, ban, len);
 }
 
+/*--------------------------------------------------------------------
+ * The calling thread is about to run out of work, let the stevedores
+ * tidy up whatever per-thread state they keep.
+ */
+
+void
+STV_Idle(void)
+{
+	struct stevedore *stv;
+
+	VTAILQ_FOREACH(stv, &stv_stevedores, list)
+		if (stv->idle != NULL)
+			stv->idle(stv);
+	stv = stv_transient;
+	if (stv->idle != NULL)
+		stv->idle(stv);
+}
+
 /*--------------------------------------------------------------------
  * VRT functions for stevedores
  */
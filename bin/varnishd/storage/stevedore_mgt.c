@@ -82,6 +82,7 @@ static const struct choice STV_choice[] = {
 	{ "file",	&smf_stevedore },
 	{ "malloc",	&sma_stevedore },
 	{ "persistent",	&smp_stevedore },
+	{ "slab",	&sml_stevedore },
 #ifdef HAVE_LIBUMEM
 	{ "umem",	&smu_stevedore },
 #endif
@@ -40,6 +40,8 @@
 #include "storage/storage.h"
 
 #include "vnum.h"
+#include "vtim.h"
+#include "vtree.h"
 
 #ifndef MAP_NOCORE
 #define MAP_NOCORE 0 /* XXX Linux */
@@ -52,14 +54,25 @@
 #define MINPAGES		128
 
 /*
- * Number of buckets on free-list.
+ * Free ranges smaller than this many pages are counted as fragments.
  *
- * Last bucket is "larger than" so choose number so that the second
- * to last bucket matches the 128k CHUNKSIZE in cache_fetch.c when
- * using the a 4K minimal page size
+ * Choose number so that it matches the 128k CHUNKSIZE in cache_fetch.c
+ * when using the a 4K minimal page size
  */
 #define NBUCKET			(128 / 4 + 1)
 
+/*
+ * Fragmentation histogram, free ranges are counted in buckets of
+ * powers of four, starting below 16k.
+ */
+#define SMF_NHIST		7
+
+/*
+ * Seconds a range which was sent with sendfile(2) is held after it is
+ * freed, see smf_sendfile().
+ */
+#define SMF_HOLD		1.0
+
 /*--------------------------------------------------------------------*/
 
 VTAILQ_HEAD(smfhead, smf);
@@ -78,9 +91,14 @@ struct smf {
 
 	VTAILQ_ENTRY(smf)	order;
 	VTAILQ_ENTRY(smf)	status;
-	struct smfhead		*flist;
+	VRB_ENTRY(smf)		tree;
+	int			infree;
+
+	double			t_sent;		/* See smf_sendfile() */
 };
 
+VRB_HEAD(smf_tree, smf);
+
 struct smf_sc {
 	unsigned		magic;
 #define SMF_SC_MAGIC		0x52962ee7
@@ -92,10 +110,32 @@ struct smf_sc {
 	unsigned		pagesize;
 	uintmax_t		filesize;
 	struct smfhead		order;
-	struct smfhead		free[NBUCKET];
+	struct smf_tree		free;
 	struct smfhead		used;
+	struct smfhead		held;
+	uint64_t		*hist[SMF_NHIST];
 };
 
+/*--------------------------------------------------------------------
+ * The free ranges are kept in a red-black tree ordered by size and then
+ * offset, so finding the smallest range which fits, lowest offset first,
+ * is O(log n).
+ */
+
+static inline int
+smf_cmp(const struct smf *a, const struct smf *b)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	if (a->offset != b->offset)
+		return (a->offset < b->offset ? -1 : 1);
+	return (0);
+}
+
+VRB_PROTOTYPE_STATIC(smf_tree, smf, tree, smf_cmp)
+VRB_GENERATE_STATIC(smf_tree, smf, tree, smf_cmp)
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -116,7 +156,6 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *size, *fn, *r;
 	struct smf_sc *sc;
-	unsigned u;
 	uintmax_t page_size;
 
 	AZ(av[ac]);
@@ -144,9 +183,9 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	ALLOC_OBJ(sc, SMF_SC_MAGIC);
 	XXXAN(sc);
 	VTAILQ_INIT(&sc->order);
-	for (u = 0; u < NBUCKET; u++)
-		VTAILQ_INIT(&sc->free[u]);
+	VRB_INIT(&sc->free);
 	VTAILQ_INIT(&sc->used);
+	VTAILQ_INIT(&sc->held);
 	sc->pagesize = page_size;
 
 	parent->priv = sc;
@@ -158,86 +197,73 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 }
 
 /*--------------------------------------------------------------------
- * Insert/Remove from correct freelist
+ * Insert/Remove from the free tree
  */
 
+static unsigned
+smf_hist(off_t size)
+{
+	unsigned u;
+
+	size >>= 14;
+	for (u = 0; size > 0 && u < SMF_NHIST - 1; u++)
+		size >>= 2;
+	return (u);
+}
+
 static void
 insfree(struct smf_sc *sc, struct smf *sp)
 {
-	size_t b;
-	struct smf *sp2;
-	size_t ns;
 
 	assert(sp->alloc == 0);
-	assert(sp->flist == NULL);
+	assert(sp->infree == 0);
 	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
+	if (sp->size / sc->pagesize >= NBUCKET)
 		sc->stats->g_smf_large++;
-	} else {
-		sc->stats->g_smf_frag++;
-	}
-	sp->flist = &sc->free[b];
-	ns = b * sc->pagesize;
-	VTAILQ_FOREACH(sp2, sp->flist, status) {
-		assert(sp2->size >= ns);
-		assert(sp2->alloc == 0);
-		assert(sp2->flist == sp->flist);
-		if (sp->offset < sp2->offset)
-			break;
-	}
-	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(sp->flist, sp, status);
 	else
-		VTAILQ_INSERT_BEFORE(sp2, sp, status);
+		sc->stats->g_smf_frag++;
+	(*sc->hist[smf_hist(sp->size)])++;
+	if ((uint64_t)sp->size > sc->stats->g_free_largest)
+		sc->stats->g_free_largest = sp->size;
+	AZ(VRB_INSERT(smf_tree, &sc->free, sp));
+	sp->infree = 1;
 }
 
 static void
-remfree(const struct smf_sc *sc, struct smf *sp)
+remfree(struct smf_sc *sc, struct smf *sp)
 {
-	size_t b;
+	struct smf *sp2;
 
 	assert(sp->alloc == 0);
-	assert(sp->flist != NULL);
+	assert(sp->infree != 0);
 	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
+	if (sp->size / sc->pagesize >= NBUCKET)
 		sc->stats->g_smf_large--;
-	} else {
+	else
 		sc->stats->g_smf_frag--;
+	(*sc->hist[smf_hist(sp->size)])--;
+	(void)VRB_REMOVE(smf_tree, &sc->free, sp);
+	sp->infree = 0;
+	if ((uint64_t)sp->size == sc->stats->g_free_largest) {
+		sp2 = VRB_MAX(smf_tree, &sc->free);
+		sc->stats->g_free_largest = sp2 == NULL ? 0 : sp2->size;
 	}
-	assert(sp->flist == &sc->free[b]);
-	VTAILQ_REMOVE(sp->flist, sp, status);
-	sp->flist = NULL;
 }
 
 /*--------------------------------------------------------------------
- * Allocate a range from the first free range that is large enough.
+ * Allocate a range from the smallest free range that is large enough,
+ * lowest offset first.
  */
 
 static struct smf *
 alloc_smf(struct smf_sc *sc, size_t bytes)
 {
-	struct smf *sp, *sp2;
-	size_t b;
+	struct smf *sp, *sp2, key;
 
 	assert(!(bytes % sc->pagesize));
-	b = bytes / sc->pagesize;
-	if (b >= NBUCKET)
-		b = NBUCKET - 1;
-	sp = NULL;
-	for (; b < NBUCKET - 1; b++) {
-		sp = VTAILQ_FIRST(&sc->free[b]);
-		if (sp != NULL)
-			break;
-	}
-	if (sp == NULL) {
-		VTAILQ_FOREACH(sp, &sc->free[NBUCKET -1], status)
-			if (sp->size >= bytes)
-				break;
-	}
+	key.size = bytes;
+	key.offset = 0;
+	sp = VRB_NFIND(smf_tree, &sc->free, &key);
 	if (sp == NULL)
 		return (sp);
 
@@ -269,8 +295,8 @@ alloc_smf(struct smf_sc *sc, size_t bytes)
 }
 
 /*--------------------------------------------------------------------
- * Free a range.  Attempt merge forward and backward, then sort into
- * free list according to age.
+ * Free a range.  Attempt merge forward and backward, then insert into
+ * the free tree.
  */
 
 static void
@@ -434,6 +460,13 @@ smf_open(const struct stevedore *st)
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	sc->stats = VSM_Alloc(sizeof *sc->stats,
 	    VSC_CLASS, VSC_TYPE_SMF, st->ident);
+	sc->hist[0] = &sc->stats->g_free_16k;
+	sc->hist[1] = &sc->stats->g_free_64k;
+	sc->hist[2] = &sc->stats->g_free_256k;
+	sc->hist[3] = &sc->stats->g_free_1m;
+	sc->hist[4] = &sc->stats->g_free_4m;
+	sc->hist[5] = &sc->stats->g_free_16m;
+	sc->hist[6] = &sc->stats->g_free_large;
 	Lck_New(&sc->mtx, lck_smf);
 	Lck_Lock(&sc->mtx);
 	smf_open_chunk(sc, sc->filesize, 0, &fail, &sum);
@@ -448,6 +481,45 @@ smf_open(const struct stevedore *st)
 	sc->stats->g_space += sc->filesize;
 }
 
+/*--------------------------------------------------------------------
+ * Free a range, and account for it.
+ */
+
+static void
+smf_release(struct smf_sc *sc, struct smf *smf)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	sc->stats->g_alloc--;
+	sc->stats->c_freed += smf->size;
+	sc->stats->g_bytes -= smf->size;
+	sc->stats->g_space += smf->size;
+	free_smf(smf);
+}
+
+/*
+ * Release the held ranges whose time is up.  They are held in the order
+ * they were freed, and usually for the same time, so we stop at the
+ * first one which is not due.
+ */
+
+static void
+smf_reap(struct smf_sc *sc, double now)
+{
+	struct smf *smf;
+
+	Lck_AssertHeld(&sc->mtx);
+	while (1) {
+		smf = VTAILQ_FIRST(&sc->held);
+		if (smf == NULL || smf->t_sent + SMF_HOLD > now)
+			break;
+		VTAILQ_REMOVE(&sc->held, smf, status);
+		VTAILQ_INSERT_TAIL(&sc->used, smf, status);
+		sc->stats->g_held -= smf->size;
+		smf_release(sc, smf);
+	}
+}
+
 /*--------------------------------------------------------------------*/
 
 static struct storage *
@@ -461,6 +533,7 @@ smf_alloc(struct stevedore *st, size_t size)
 	size += (sc->pagesize - 1);
 	size &= ~(sc->pagesize - 1);
 	Lck_Lock(&sc->mtx);
+	smf_reap(sc, VTIM_real());
 	sc->stats->c_req++;
 	smf = alloc_smf(sc, size);
 	if (smf == NULL) {
@@ -530,12 +603,58 @@ smf_free(struct storage *s)
 	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
 	sc = smf->sc;
 	Lck_Lock(&sc->mtx);
-	sc->stats->g_alloc--;
-	sc->stats->c_freed += smf->size;
-	sc->stats->g_bytes -= smf->size;
-	sc->stats->g_space += smf->size;
-	free_smf(smf);
+	if (smf->t_sent + SMF_HOLD > VTIM_real()) {
+		VTAILQ_REMOVE(&sc->used, smf, status);
+		VTAILQ_INSERT_TAIL(&sc->held, smf, status);
+		sc->stats->g_held += smf->size;
+	} else
+		smf_release(sc, smf);
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * The storage is a MAP_SHARED mapping of our file, so the kernel can
+ * send it from there.
+ *
+ * sendfile(2) returns while the pages are still in the socket buffer,
+ * and if the range were reused for another object before they are sent,
+ * the client would get its bytes.  Instead of waiting for the client,
+ * smf_free() holds such ranges for SMF_HOLD seconds after they were last
+ * sent, which is plenty for the socket buffer to drain to any client
+ * which keeps up.  The hold is kept short because the space cannot be
+ * used for anything else meanwhile, see smf_held().
+ */
+
+static int __match_proto__(storage_sendfile_f)
+smf_sendfile(const struct storage *s, off_t *where)
+{
+	struct smf *smf;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
+	AN(where);
+	smf->t_sent = VTIM_real();
+	*where = smf->offset;
+	return (smf->sc->fd);
+}
+
+/*--------------------------------------------------------------------
+ * How much of our space is held, so nuking an object whose space only
+ * went on the held list is not counted as a failure by stv_alloc().
+ */
+
+static uintmax_t __match_proto__(storage_held_f)
+smf_held(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+	uintmax_t u;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	Lck_Lock(&sc->mtx);
+	smf_reap(sc, VTIM_real());
+	u = sc->stats->g_held;
 	Lck_Unlock(&sc->mtx);
+	return (u);
 }
 
 /*--------------------------------------------------------------------*/
@@ -548,6 +667,8 @@ const struct stevedore smf_stevedore = {
 	.alloc	=	smf_alloc,
 	.trim	=	smf_trim,
 	.free	=	smf_free,
+	.sendfile =	smf_sendfile,
+	.held	=	smf_held,
 };
 
 #ifdef INCLUDE_TEST_DRIVER
@@ -578,7 +699,7 @@ dumpit(void)
 		    s, s->offset, s->size, s->offset + s->size);
 	}
 	printf("Free:\n");
-	VTAILQ_FOREACH(s, &sc->free, status) {
+	VRB_FOREACH(s, smf_tree, &sc->free) {
 		printf("%10p %12ju %12ju %12ju\n",
 		    s, s->offset, s->size, s->offset + s->size);
 	}
@@ -0,0 +1,622 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage method based on size-class slabs in an anonymous mmap'ed arena.
+ *
+ * The arena is carved, front to back, into SML_SLAB sized slabs, each of
+ * which is cut into chunks of a single size class.  Class zero holds the
+ * struct sml which carries the struct storage, the rest are powers of two
+ * from SML_MIN to SML_SLAB.
+ *
+ * Every thread has a magazine of free chunks per class, so the common
+ * case of alloc and free touches neither locks nor shared cache lines.
+ * Full magazines are pushed, as one chain, on a per class depot, empty
+ * magazines are refilled by popping a chain off the depot, or failing
+ * that, by carving a fresh slab.  The magazines also collect the
+ * statistics, which are only folded into the shared counters when a
+ * magazine is exchanged with the depot.  A thread holds no more than
+ * SML_TLBYTES in its magazines, besides the one it is working on.
+ *
+ * The depot is a lock-free stack whose head is an index into the arena
+ * tagged with a generation count, so that it is immune to ABA.
+ *
+ * Memory does not move between classes once a slab has been carved.
+ * When a class runs dry, a larger class is used instead, and trim
+ * moves the tail of an object into the smallest class which fits.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache.h"
+#include "storage/storage.h"
+
+#include "vatomic.h"
+#include "vnum.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define SML_UNIT	64		/* Arena index granularity */
+#define SML_MIN		256		/* Smallest data class */
+#define SML_SLAB	(1024*1024)	/* Largest data class, slab size */
+#define SML_NCLASS	14		/* meta + 256 ... 1M */
+#define SML_MAGMAX	64		/* Max chunks in a magazine */
+#define SML_MAGBYTES	(256*1024)	/* Magazine size in bytes */
+#define SML_TLBYTES	(512*1024)	/* Max bytes in a thread's magazines */
+
+#define SML_IDXBITS	40
+#define SML_IDXMASK	((1ULL << SML_IDXBITS) - 1)
+
+/* A free chunk */
+struct sml_free {
+	uint64_t		snext;		/* next chain in depot */
+	struct sml_free		*cnext;		/* next in this chain */
+	unsigned		n;		/* chunks in this chain */
+};
+
+struct sml_sc;
+
+struct sml {
+	unsigned		magic;
+#define SML_MAGIC		0x5b1a0c3e
+	unsigned		cls;
+	struct sml_sc		*sc;
+	struct storage		s;
+};
+
+struct sml_class {
+	size_t			size;
+	unsigned		cap;
+	volatile uint64_t	depot;
+	struct VSC_C_slab	*stats;
+};
+
+/* Counter deltas not yet folded into the class' VSC */
+struct sml_delta {
+#define VSC_F(n, t, l, f, e, dd)	int64_t n;
+#define VSC_DO_SLAB
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SLAB
+#undef VSC_F
+};
+
+struct sml_mag {
+	unsigned		n;
+	void			*chunk[SML_MAGMAX];
+	struct sml_delta	d;
+};
+
+struct sml_tl {
+	unsigned		magic;
+#define SML_TL_MAGIC		0x2e06a8d1
+	struct sml_sc		*sc;
+	size_t			bytes;		/* in the magazines */
+	struct sml_mag		mag[SML_NCLASS];
+};
+
+struct sml_sc {
+	unsigned		magic;
+#define SML_SC_MAGIC		0x4c1d39fa
+	size_t			size;
+	char			*base;
+	volatile size_t		next;
+	pthread_key_t		key;
+	struct sml_class	cls[SML_NCLASS];
+};
+
+/*--------------------------------------------------------------------
+ * The depot
+ */
+
+static inline uint64_t
+sml_idx(const struct sml_sc *sc, const void *p)
+{
+	uintptr_t u;
+
+	u = (uintptr_t)p - (uintptr_t)sc->base;
+	assert(!(u % SML_UNIT));
+	return (u / SML_UNIT + 1);
+}
+
+static inline struct sml_free *
+sml_ptr(const struct sml_sc *sc, uint64_t idx)
+{
+
+	idx &= SML_IDXMASK;
+	AN(idx);
+	return ((void*)(sc->base + (idx - 1) * SML_UNIT));
+}
+
+static void
+sml_push(const struct sml_sc *sc, struct sml_class *cl, struct sml_free *f)
+{
+	uint64_t o, n, i;
+
+	i = sml_idx(sc, f);
+	do {
+		o = cl->depot;
+		f->snext = o & SML_IDXMASK;
+		n = (((o >> SML_IDXBITS) + 1) << SML_IDXBITS) | i;
+	} while (!VATOMIC_CAS(&cl->depot, o, n));
+}
+
+static struct sml_free *
+sml_pop(const struct sml_sc *sc, struct sml_class *cl)
+{
+	uint64_t o, n;
+	struct sml_free *f;
+
+	do {
+		o = cl->depot;
+		if (!(o & SML_IDXMASK))
+			return (NULL);
+		/*
+		 * The arena is never unmapped, so reading snext is safe even
+		 * if somebody else got the chunk first, the tag makes our CAS
+		 * fail in that case.
+		 */
+		f = sml_ptr(sc, o);
+		n = (((o >> SML_IDXBITS) + 1) << SML_IDXBITS) | f->snext;
+	} while (!VATOMIC_CAS(&cl->depot, o, n));
+	return (f);
+}
+
+/*--------------------------------------------------------------------
+ * Magazines
+ */
+
+static void
+sml_fold(const struct sml_class *cl, struct sml_mag *m)
+{
+
+#define VSC_F(n, t, l, f, e, dd)				\
+	if (m->d.n != 0) {						\
+		(void)VATOMIC_ADD(&cl->stats->n, (uint64_t)m->d.n);	\
+		m->d.n = 0;						\
+	}
+#define VSC_DO_SLAB
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SLAB
+#undef VSC_F
+}
+
+static void
+sml_flush(const struct sml_sc *sc, struct sml_class *cl, struct sml_tl *tl,
+    struct sml_mag *m)
+{
+	struct sml_free *f;
+	unsigned u;
+
+	sml_fold(cl, m);
+	if (m->n == 0)
+		return;
+	for (u = 0; u < m->n; u++) {
+		f = m->chunk[u];
+		f->cnext = (u + 1 < m->n) ? m->chunk[u + 1] : NULL;
+	}
+	f = m->chunk[0];
+	f->n = m->n;
+	assert(tl->bytes >= m->n * cl->size);
+	tl->bytes -= m->n * cl->size;
+	m->n = 0;
+	sml_push(sc, cl, f);
+}
+
+/* Hand magazines, other than the one for class c, back to the depot */
+
+static void
+sml_limit(struct sml_sc *sc, struct sml_tl *tl, unsigned c)
+{
+	unsigned u;
+
+	for (u = SML_NCLASS; u-- > 0 && tl->bytes > SML_TLBYTES; )
+		if (u != c)
+			sml_flush(sc, &sc->cls[u], tl, &tl->mag[u]);
+}
+
+static void
+sml_tl_free(void *priv)
+{
+	struct sml_tl *tl;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(tl, priv, SML_TL_MAGIC);
+	for (u = 0; u < SML_NCLASS; u++)
+		sml_flush(tl->sc, &tl->sc->cls[u], tl, &tl->mag[u]);
+	AZ(tl->bytes);
+	FREE_OBJ(tl);
+}
+
+static struct sml_tl *
+sml_tl(struct sml_sc *sc)
+{
+	struct sml_tl *tl;
+
+	tl = pthread_getspecific(sc->key);
+	if (tl != NULL) {
+		CHECK_OBJ(tl, SML_TL_MAGIC);
+		return (tl);
+	}
+	ALLOC_OBJ(tl, SML_TL_MAGIC);
+	AN(tl);
+	tl->sc = sc;
+	AZ(pthread_setspecific(sc->key, tl));
+	return (tl);
+}
+
+/* Cut a fresh slab into the magazine, and the rest into depot chains */
+
+static int
+sml_carve(struct sml_sc *sc, struct sml_class *cl, struct sml_mag *m)
+{
+	struct sml_free *h, *f;
+	size_t o;
+	unsigned u, n, c;
+	char *p;
+
+	o = VATOMIC_FADD(&sc->next, SML_SLAB);
+	if (o + SML_SLAB > sc->size)
+		return (0);
+	p = sc->base + o;
+	n = SML_SLAB / cl->size;
+	m->d.g_slabs++;
+	m->d.g_free += (int64_t)n * cl->size;
+	sml_fold(cl, m);
+
+	for (u = 0; u < n && m->n < cl->cap; u++, p += cl->size)
+		m->chunk[m->n++] = p;
+	while (u < n) {
+		h = (void*)p;
+		for (c = 0; u < n && c < cl->cap; c++, u++) {
+			f = (void*)p;
+			p += cl->size;
+			f->cnext = (u + 1 < n && c + 1 < cl->cap) ?
+			    (void*)p : NULL;
+		}
+		h->n = c;
+		sml_push(sc, cl, h);
+	}
+	return (1);
+}
+
+static void *
+sml_get(struct sml_sc *sc, struct sml_tl *tl, unsigned c)
+{
+	struct sml_class *cl;
+	struct sml_mag *m;
+	struct sml_free *f;
+
+	cl = &sc->cls[c];
+	m = &tl->mag[c];
+	if (m->n == 0) {
+		sml_fold(cl, m);
+		f = sml_pop(sc, cl);
+		if (f != NULL) {
+			assert(f->n <= cl->cap);
+			for (; f != NULL; f = f->cnext)
+				m->chunk[m->n++] = f;
+		} else if (!sml_carve(sc, cl, m))
+			return (NULL);
+		tl->bytes += m->n * cl->size;
+		sml_limit(sc, tl, c);
+	}
+	AN(m->n);
+	m->d.g_alloc++;
+	m->d.g_free -= cl->size;
+	tl->bytes -= cl->size;
+	return (m->chunk[--m->n]);
+}
+
+static void
+sml_put(struct sml_sc *sc, struct sml_tl *tl, unsigned c, void *p)
+{
+	struct sml_class *cl;
+	struct sml_mag *m;
+
+	cl = &sc->cls[c];
+	m = &tl->mag[c];
+	if (m->n == cl->cap)
+		sml_flush(sc, cl, tl, m);
+	m->chunk[m->n++] = p;
+	m->d.g_alloc--;
+	m->d.g_free += cl->size;
+	tl->bytes += cl->size;
+	if (tl->bytes > SML_TLBYTES)
+		sml_limit(sc, tl, c);
+}
+
+/*--------------------------------------------------------------------*/
+
+static unsigned
+sml_class(size_t size)
+{
+	unsigned c;
+	size_t sz;
+
+	for (c = 1, sz = SML_MIN; sz < size && c < SML_NCLASS - 1; c++)
+		sz <<= 1;
+	return (c);
+}
+
+static struct storage *
+sml_alloc(struct stevedore *st, size_t size)
+{
+	struct sml_sc *sc;
+	struct sml_tl *tl;
+	struct sml_class *cl;
+	struct sml *sml;
+	unsigned c, u;
+	void *p = NULL;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SML_SC_MAGIC);
+	tl = sml_tl(sc);
+	c = sml_class(size);
+	tl->mag[c].d.c_req++;
+
+	sml = sml_get(sc, tl, 0);
+	if (sml != NULL) {
+		for (u = c; p == NULL && u < SML_NCLASS; u++)
+			p = sml_get(sc, tl, u);
+		if (p == NULL)
+			sml_put(sc, tl, 0, sml);
+	}
+	if (p == NULL) {
+		(void)VATOMIC_ADD(&sc->cls[c].stats->c_fail, 1);
+		return (NULL);
+	}
+	if (--u != c)
+		tl->mag[c].d.c_fallback++;
+
+	cl = &sc->cls[u];
+	tl->mag[u].d.g_bytes += cl->size;
+
+	memset(sml, 0, sizeof *sml);
+	sml->magic = SML_MAGIC;
+	sml->cls = u;
+	sml->sc = sc;
+	sml->s.magic = STORAGE_MAGIC;
+	sml->s.priv = sml;
+	sml->s.ptr = p;
+	sml->s.len = 0;
+	sml->s.space = cl->size;
+	sml->s.stevedore = st;
+	return (&sml->s);
+}
+
+static void __match_proto__(storage_free_f)
+sml_free(struct storage *s)
+{
+	struct sml_sc *sc;
+	struct sml_tl *tl;
+	struct sml_class *cl;
+	struct sml_mag *m;
+	struct sml *sml;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sml, s->priv, SML_MAGIC);
+	sc = sml->sc;
+	cl = &sc->cls[sml->cls];
+	assert(s->space <= cl->size);
+	tl = sml_tl(sc);
+	m = &tl->mag[sml->cls];
+	m->d.g_bytes -= s->space;
+	m->d.g_waste -= cl->size - s->space;
+
+	sml_put(sc, tl, sml->cls, s->ptr);
+	sml->magic = 0;
+	s->magic = 0;
+	sml_put(sc, tl, 0, sml);
+}
+
+/*--------------------------------------------------------------------
+ * Move the chunk to a smaller class if possible, otherwise just account
+ * the unused tail as waste.
+ */
+
+static void
+sml_trim(struct storage *s, size_t size, int move_ok)
+{
+	struct sml_sc *sc;
+	struct sml_tl *tl;
+	struct sml_class *cl, *cl2;
+	struct sml *sml;
+	unsigned c;
+	void *p;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sml, s->priv, SML_MAGIC);
+	sc = sml->sc;
+	cl = &sc->cls[sml->cls];
+	assert(size < s->space);
+	tl = sml_tl(sc);
+
+	c = sml_class(size);
+	if (move_ok && c < sml->cls &&
+	    (p = sml_get(sc, tl, c)) != NULL) {
+		cl2 = &sc->cls[c];
+		memcpy(p, s->ptr, size);
+		tl->mag[sml->cls].d.g_bytes -= s->space;
+		tl->mag[sml->cls].d.g_waste -= cl->size - s->space;
+		sml_put(sc, tl, sml->cls, s->ptr);
+		tl->mag[c].d.g_bytes += cl2->size;
+		sml->cls = c;
+		s->ptr = p;
+		s->space = cl2->size;
+		cl = cl2;
+		if (size == s->space)
+			return;
+	}
+	tl->mag[sml->cls].d.g_bytes -= s->space - size;
+	tl->mag[sml->cls].d.g_waste += s->space - size;
+	s->space = size;
+}
+
+/*--------------------------------------------------------------------
+ * Fold this thread's statistics before it goes idle, so they do not lag
+ * until its next magazine exchange.
+ */
+
+static void __match_proto__(storage_idle_f)
+sml_idle(const struct stevedore *st)
+{
+	struct sml_sc *sc;
+	struct sml_tl *tl;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SML_SC_MAGIC);
+	tl = pthread_getspecific(sc->key);
+	if (tl == NULL)
+		return;
+	CHECK_OBJ(tl, SML_TL_MAGIC);
+	for (u = 0; u < SML_NCLASS; u++)
+		sml_fold(&sc->cls[u], &tl->mag[u]);
+}
+
+/*--------------------------------------------------------------------*/
+
+static double
+sml_used_space(const struct stevedore *st)
+{
+	struct sml_sc *sc;
+	double d = 0;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SML_SC_MAGIC);
+	for (u = 1; u < SML_NCLASS; u++)
+		d += sc->cls[u].stats->g_bytes;
+	return (d);
+}
+
+static double
+sml_free_space(const struct stevedore *st)
+{
+	struct sml_sc *sc;
+	double d = 0;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SML_SC_MAGIC);
+	if (sc->next < sc->size)
+		d = sc->size - sc->next;
+	for (u = 1; u < SML_NCLASS; u++)
+		d += sc->cls[u].stats->g_free;
+	return (d);
+}
+
+static void
+sml_init(struct stevedore *parent, int ac, char * const *av)
+{
+	const char *e;
+	uintmax_t u;
+	struct sml_sc *sc;
+
+	ASSERT_MGT();
+	ALLOC_OBJ(sc, SML_SC_MAGIC);
+	AN(sc);
+	sc->size = 1024 * 1024 * 1024;
+	parent->priv = sc;
+
+	AZ(av[ac]);
+	if (ac > 1)
+		ARGV_ERR("(-sslab) too many arguments\n");
+
+	if (ac == 0 || *av[0] == '\0')
+		 return;
+
+	e = VNUM_2bytes(av[0], &u, 0);
+	if (e != NULL)
+		ARGV_ERR("(-sslab) size \"%s\": %s\n", av[0], e);
+	if ((u != (uintmax_t)(size_t)u))
+		ARGV_ERR("(-sslab) size \"%s\": too big\n", av[0]);
+	if (u < (uintmax_t)SML_SLAB * SML_NCLASS * 2)
+		ARGV_ERR("(-sslab) size \"%s\": too small, "
+			 "need at least %dM\n", av[0], SML_NCLASS * 2);
+
+	sc->size = u - u % SML_SLAB;
+}
+
+static void
+sml_open(const struct stevedore *st)
+{
+	struct sml_sc *sc;
+	struct sml_class *cl;
+	char buf[64];
+	unsigned u;
+	void *p;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SML_SC_MAGIC);
+	assert(sizeof(struct sml_free) <= SML_UNIT);
+	p = mmap(NULL, sc->size, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "SLAB.%s: mmap of %zu bytes failed: %s\n",
+		    st->ident, sc->size, strerror(errno));
+		exit(2);
+	}
+	sc->base = p;
+	AZ(pthread_key_create(&sc->key, sml_tl_free));
+
+	for (u = 0; u < SML_NCLASS; u++) {
+		cl = &sc->cls[u];
+		if (u == 0)
+			cl->size = RUP2(sizeof(struct sml), SML_UNIT);
+		else
+			cl->size = (size_t)SML_MIN << (u - 1);
+		cl->cap = SML_MAGBYTES / cl->size;
+		if (cl->cap > SML_MAGMAX)
+			cl->cap = SML_MAGMAX;
+		if (cl->cap == 0)
+			cl->cap = 1;
+		if (u == 0)
+			bprintf(buf, "%s.meta", st->ident);
+		else
+			bprintf(buf, "%s.%zu", st->ident, cl->size);
+		cl->stats = VSM_Alloc(sizeof *cl->stats,
+		    VSC_CLASS, VSC_TYPE_SLAB, buf);
+		memset(cl->stats, 0, sizeof *cl->stats);
+	}
+	assert(sc->cls[SML_NCLASS - 1].size == SML_SLAB);
+}
+
+const struct stevedore sml_stevedore = {
+	.magic	=	STEVEDORE_MAGIC,
+	.name	=	"slab",
+	.init	=	sml_init,
+	.open	=	sml_open,
+	.alloc	=	sml_alloc,
+	.free	=	sml_free,
+	.trim	=	sml_trim,
+	.idle	=	sml_idle,
+	.var_free_space =	sml_free_space,
+	.var_used_space =	sml_used_space,
+};
@@ -62,8 +62,23 @@ WAIT_Init(void)
 	waiter_priv = waiter->init();
 }
 
+/*--------------------------------------------------------------------
+ * Waiters which run one instance per thread pool return its priv here,
+ * all others get the global one.
+ */
+
+void *
+WAIT_NewPool(unsigned pool_no)
+{
+
+	AN(waiter);
+	if (waiter->pool == NULL)
+		return (waiter_priv);
+	return (waiter->pool(waiter_priv, pool_no));
+}
+
 void
-WAIT_Enter(struct sess *sp)
+WAIT_Enter(void *priv, struct sess *sp)
 {
 
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
@@ -75,5 +90,5 @@ WAIT_Enter(struct sess *sp)
 	*/
 	if (VTCP_nonblocking(sp->fd))
 		SES_Close(sp, SC_REM_CLOSE);
-	waiter->pass(waiter_priv, sp);
+	waiter->pass(priv, sp);
 }
@@ -26,9 +26,16 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  *
- * XXX: We need to pass sessions back into the event engine when they are
- * reused.  Not sure what the most efficient way is for that.  For now
- * write the session pointer to a pipe which the event engine monitors.
+ * There is one epoll loop per thread pool, so that idle sessions stay
+ * with the pool which accepted them, and no single thread has to babysit
+ * all idle sessions.
+ *
+ * Sessions are passed to a loop on a lock-free stack, and the loop is
+ * woken by an eventfd when the stack goes from empty to non-empty.
+ *
+ * Sessions are kept on a list in the order they arrived, which, since
+ * timeout_idle is the same for all of them, is also the order they time
+ * out in.  The loop sleeps in epoll_wait() until the first one is due.
  */
 
 #include "config.h"
@@ -36,13 +43,15 @@
 #if defined(HAVE_EPOLL_CTL)
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
-#include <fcntl.h>
+#include <math.h>
 #include <stdlib.h>
 
 #include "cache/cache.h"
 
 #include "waiter/waiter.h"
+#include "vatomic.h"
 #include "vtim.h"
 
 #ifndef EPOLLRDHUP
@@ -56,91 +65,86 @@ struct vwe {
 #define VWE_MAGIC		0x6bd73424
 
 	pthread_t		epoll_thread;
-	pthread_t		timer_thread;
 	int			epfd;
+	int			efd;
 
 	VTAILQ_HEAD(,sess)	sesshead;
-	int			pipes[2];
-	int			timer_pipes[2];
+
+	/* Sessions passed to us, linked through list.vtqe_next */
+	struct sess * volatile	inbox;
 };
 
 static void
-vwe_modadd(struct vwe *vwe, int fd, void *data, short arm)
+vwe_modadd(const struct vwe *vwe, struct sess *sp)
 {
 
 	/* XXX: EPOLLET (edge triggered) can cause rather Bad Things to
 	 * XXX: happen: If NEEV+1 threads get stuck in write(), all threads
 	 * XXX: will hang. See #644.
 	 */
-	assert(fd >= 0);
-	if (data == vwe->pipes || data == vwe->timer_pipes) {
-		struct epoll_event ev = {
-		    EPOLLIN | EPOLLPRI , { data }
-		};
-		AZ(epoll_ctl(vwe->epfd, arm, fd, &ev));
-	} else {
-		struct sess *sp = (struct sess *)data;
-		CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
-		sp->ev.data.ptr = data;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	assert(sp->fd >= 0);
+	if (sp->ev.data.ptr)
+		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_MOD, sp->fd, &sp->ev));
+	else {
+		sp->ev.data.ptr = sp;
 		sp->ev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT | EPOLLRDHUP;
-		AZ(epoll_ctl(vwe->epfd, arm, fd, &sp->ev));
+		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, sp->fd, &sp->ev));
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Empty the inbox.  It is a stack, so reverse it to keep the sessions
+ * in order of arrival.
+ */
+
 static void
-vwe_cond_modadd(struct vwe *vwe, int fd, void *data)
+vwe_inbox(struct vwe *vwe)
 {
-	struct sess *sp = (struct sess *)data;
-
-	assert(fd >= 0);
-	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
-	if (sp->ev.data.ptr)
-		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_MOD, fd, &sp->ev));
-	else {
-		sp->ev.data.ptr = data;
-		sp->ev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT | EPOLLRDHUP;
-		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, fd, &sp->ev));
+	struct sess *sp, *sp2, *head;
+	uint64_t u;
+
+	if (read(vwe->efd, &u, sizeof u) != sizeof u)
+		assert(errno == EAGAIN);
+	do
+		head = vwe->inbox;
+	while (head != NULL && !VATOMIC_CAS(&vwe->inbox, head, NULL));
+
+	sp2 = NULL;
+	while (head != NULL) {
+		sp = head;
+		head = VTAILQ_NEXT(sp, list);
+		VTAILQ_NEXT(sp, list) = sp2;
+		sp2 = sp;
+	}
+	while (sp2 != NULL) {
+		CHECK_OBJ_NOTNULL(sp2, SESS_MAGIC);
+		sp = VTAILQ_NEXT(sp2, list);
+		VTAILQ_INSERT_TAIL(&vwe->sesshead, sp2, list);
+		vwe_modadd(vwe, sp2);
+		sp2 = sp;
 	}
 }
 
 static void
 vwe_eev(struct vwe *vwe, const struct epoll_event *ep, double now)
 {
-	struct sess *ss[NEEV], *sp;
-	int i, j;
+	struct sess *sp;
 
 	AN(ep->data.ptr);
-	if (ep->data.ptr == vwe->pipes) {
-		if (ep->events & EPOLLIN || ep->events & EPOLLPRI) {
-			j = 0;
-			i = read(vwe->pipes[0], ss, sizeof ss);
-			if (i == -1 && errno == EAGAIN)
-				return;
-			while (i >= sizeof ss[0]) {
-				CHECK_OBJ_NOTNULL(ss[j], SESS_MAGIC);
-				assert(ss[j]->fd >= 0);
-				VTAILQ_INSERT_TAIL(&vwe->sesshead, ss[j], list);
-				vwe_cond_modadd(vwe, ss[j]->fd, ss[j]);
-				j++;
-				i -= sizeof ss[0];
-			}
-			assert(i == 0);
-		}
-	} else {
-		CAST_OBJ_NOTNULL(sp, ep->data.ptr, SESS_MAGIC);
-		if (ep->events & EPOLLIN || ep->events & EPOLLPRI) {
-			VTAILQ_REMOVE(&vwe->sesshead, sp, list);
-			SES_Handle(sp, now);
-		} else if (ep->events & EPOLLERR) {
-			VTAILQ_REMOVE(&vwe->sesshead, sp, list);
-			SES_Delete(sp, SC_REM_CLOSE, now);
-		} else if (ep->events & EPOLLHUP) {
-			VTAILQ_REMOVE(&vwe->sesshead, sp, list);
-			SES_Delete(sp, SC_REM_CLOSE, now);
-		} else if (ep->events & EPOLLRDHUP) {
-			VTAILQ_REMOVE(&vwe->sesshead, sp, list);
-			SES_Delete(sp, SC_REM_CLOSE, now);
-		}
+	CAST_OBJ_NOTNULL(sp, ep->data.ptr, SESS_MAGIC);
+	if (ep->events & EPOLLIN || ep->events & EPOLLPRI) {
+		VTAILQ_REMOVE(&vwe->sesshead, sp, list);
+		SES_Handle(sp, now);
+	} else if (ep->events & EPOLLERR) {
+		VTAILQ_REMOVE(&vwe->sesshead, sp, list);
+		SES_Delete(sp, SC_REM_CLOSE, now);
+	} else if (ep->events & EPOLLHUP) {
+		VTAILQ_REMOVE(&vwe->sesshead, sp, list);
+		SES_Delete(sp, SC_REM_CLOSE, now);
+	} else if (ep->events & EPOLLRDHUP) {
+		VTAILQ_REMOVE(&vwe->sesshead, sp, list);
+		SES_Delete(sp, SC_REM_CLOSE, now);
 	}
 }
 
@@ -149,38 +153,39 @@ vwe_eev(struct vwe *vwe, const struct epoll_event *ep, double now)
 static void *
 vwe_thread(void *priv)
 {
-	struct epoll_event ev[NEEV], *ep;
+	struct epoll_event ev[NEEV], *ep, eev;
 	struct sess *sp;
-	char junk;
 	double now, deadline;
-	int dotimer, i, n;
+	int i, n, tmo;
 	struct vwe *vwe;
 
 	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
 
 	THR_SetName("cache-epoll");
 
-	vwe->epfd = epoll_create(1);
-	assert(vwe->epfd >= 0);
-
-	vwe_modadd(vwe, vwe->pipes[0], vwe->pipes, EPOLL_CTL_ADD);
-	vwe_modadd(vwe, vwe->timer_pipes[0], vwe->timer_pipes, EPOLL_CTL_ADD);
+	memset(&eev, 0, sizeof eev);
+	eev.events = EPOLLIN | EPOLLPRI;
+	eev.data.ptr = vwe;
+	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, vwe->efd, &eev));
 
 	while (1) {
-		dotimer = 0;
-		n = epoll_wait(vwe->epfd, ev, NEEV, -1);
+		sp = VTAILQ_FIRST(&vwe->sesshead);
+		if (sp == NULL)
+			tmo = -1;
+		else {
+			deadline = sp->t_idle + cache_param->timeout_idle;
+			tmo = (int)ceil(1e3 * (deadline - VTIM_real()));
+			if (tmo < 0)
+				tmo = 0;
+		}
+		n = epoll_wait(vwe->epfd, ev, NEEV, tmo);
 		now = VTIM_real();
 		for (ep = ev, i = 0; i < n; i++, ep++) {
-			if (ep->data.ptr == vwe->timer_pipes &&
-			    (ep->events == EPOLLIN || ep->events == EPOLLPRI))
-			{
-				assert(read(vwe->timer_pipes[0], &junk, 1));
-				dotimer = 1;
-			} else
+			if (ep->data.ptr == vwe)
+				vwe_inbox(vwe);
+			else
 				vwe_eev(vwe, ep, now);
 		}
-		if (!dotimer)
-			continue;
 
 		/* check for timeouts */
 		deadline = now - cache_param->timeout_idle;
@@ -200,64 +205,48 @@ vwe_thread(void *priv)
 
 /*--------------------------------------------------------------------*/
 
-static void *
-vwe_timeout_idle_ticker(void *priv)
-{
-	char ticker = 'R';
-	struct vwe *vwe;
-
-	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	THR_SetName("cache-epoll-timeout_idle_ticker");
-
-	while (1) {
-		/* ticking */
-		assert(write(vwe->timer_pipes[1], &ticker, 1));
-		VTIM_sleep(100 * 1e-3);
-	}
-	return (NULL);
-}
-
-/*--------------------------------------------------------------------*/
-
 static void
-vwe_pass(void *priv, const struct sess *sp)
+vwe_pass(void *priv, struct sess *sp)
 {
 	struct vwe *vwe;
+	struct sess *head;
+	uint64_t u = 1;
 
 	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	assert(sizeof sp == write(vwe->pipes[1], &sp, sizeof sp));
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	do {
+		head = vwe->inbox;
+		VTAILQ_NEXT(sp, list) = head;
+	} while (!VATOMIC_CAS(&vwe->inbox, head, sp));
+	if (head == NULL)
+		assert(write(vwe->efd, &u, sizeof u) == sizeof u);
 }
 
 /*--------------------------------------------------------------------*/
 
 static void *
-vwe_init(void)
+vwe_pool(void *priv, unsigned pool_no)
 {
-	int i;
 	struct vwe *vwe;
 
+	(void)priv;
+	(void)pool_no;
 	ALLOC_OBJ(vwe, VWE_MAGIC);
 	AN(vwe);
 	VTAILQ_INIT(&vwe->sesshead);
-	AZ(pipe(vwe->pipes));
-	AZ(pipe(vwe->timer_pipes));
-
-	i = fcntl(vwe->pipes[0], F_GETFL);
-	assert(i != -1);
-	i |= O_NONBLOCK;
-	i = fcntl(vwe->pipes[0], F_SETFL, i);
-	assert(i != -1);
-
-	i = fcntl(vwe->timer_pipes[0], F_GETFL);
-	assert(i != -1);
-	i |= O_NONBLOCK;
-	i = fcntl(vwe->timer_pipes[0], F_SETFL, i);
-	assert(i != -1);
-
-	AZ(pthread_create(&vwe->timer_thread,
-	    NULL, vwe_timeout_idle_ticker, vwe));
+	vwe->epfd = epoll_create(1);
+	assert(vwe->epfd >= 0);
+	vwe->efd = eventfd(0, EFD_NONBLOCK);
+	assert(vwe->efd >= 0);
 	AZ(pthread_create(&vwe->epoll_thread, NULL, vwe_thread, vwe));
-	return(vwe);
+	return (vwe);
+}
+
+static void *
+vwe_init(void)
+{
+
+	return (NULL);
 }
 
 /*--------------------------------------------------------------------*/
@@ -265,6 +254,7 @@ vwe_init(void)
 const struct waiter waiter_epoll = {
 	.name =		"epoll",
 	.init =		vwe_init,
+	.pool =		vwe_pool,
 	.pass =		vwe_pass,
 };
 
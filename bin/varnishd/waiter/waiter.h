@@ -31,13 +31,15 @@
 struct sess;
 
 typedef void* waiter_init_f(void);
-typedef void waiter_pass_f(void *priv, const struct sess *);
+typedef void* waiter_pool_f(void *priv, unsigned pool_no);
+typedef void waiter_pass_f(void *priv, struct sess *);
 
 #define WAITER_DEFAULT		"platform dependent"
 
 struct waiter {
 	const char		*name;
 	waiter_init_f		*init;
+	waiter_pool_f		*pool;		/* optional, per pool priv */
 	waiter_pass_f		*pass;
 };
 
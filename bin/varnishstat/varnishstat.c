@@ -184,6 +184,7 @@ do_once(struct VSM_data *vd, const struct VSC_C_main *VSC_C_main)
 	struct once_priv op;
 
 	memset(&op, 0, sizeof op);
+	(void)VSC_Main(vd);
 	op.up = VSC_C_main->uptime;
 	op.pad = 18;
 
@@ -1041,7 +1041,7 @@ cmd_http_timeout(CMD_ARGS)
 }
 
 /**********************************************************************
- * expect other end to close (server only)
+ * expect other end to close
  */
 
 static void
@@ -1056,7 +1056,6 @@ cmd_http_expect_close(CMD_ARGS)
 	(void)vl;
 	CAST_OBJ_NOTNULL(hp, priv, HTTP_MAGIC);
 	AZ(av[1]);
-	assert(hp->sfd != NULL);
 
 	vtc_log(vl, 4, "Expecting close (fd = %d)", hp->fd);
 	while (1) {
@@ -260,7 +260,7 @@ start_test(void)
 	ALLOC_OBJ(jp, JOB_MAGIC);
 	AN(jp);
 
-	jp->bufsiz = 256*1024;		/* XXX */
+	jp->bufsiz = 4*1024*1024;	/* XXX: c00075 logs a full VSL wrap */
 
 	jp->buf = mmap(NULL, jp->bufsiz, PROT_READ|PROT_WRITE,
 	    MAP_ANON | MAP_SHARED, -1, 0);
@@ -44,6 +44,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "binary_heap.h"
 #include "vapi/vsl.h"
 #include "vapi/vsm.h"
 #include "vas.h"
@@ -57,16 +58,33 @@
 #define AC(x) x
 #endif
 
+/*
+ * We track at most TOP_MAX distinct records, found through a hash table.
+ *
+ * When a new record arrives and we are full, it takes over the entry with
+ * the lowest count, including that count ("space-saving", Metwally et al.),
+ * so frequent records always make it to the top, while the memory stays
+ * bounded.  A binary heap on the count finds that entry.
+ *
+ * Once a second all counts decay, which does not change their order.
+ */
+
+#define TOP_MAX		4096
+#define TOP_NHASH	(TOP_MAX * 2)		/* Power of two */
+
 struct top {
 	uint8_t			tag;
 	char			*rec_data;
 	int			clen;
 	unsigned		hash;
-	VTAILQ_ENTRY(top)	list;
+	unsigned		idx;
+	VLIST_ENTRY(top)	hlist;
 	double			count;
 };
 
-static VTAILQ_HEAD(tophead, top) top_head = VTAILQ_HEAD_INITIALIZER(top_head);
+static VLIST_HEAD(tophash, top) top_hash[TOP_NHASH];
+static struct binheap *top_heap;
+static struct top *top_sort[TOP_MAX];
 
 static unsigned ntop;
 
@@ -78,33 +96,120 @@ static int f_flag = 0;
 
 static unsigned maxfieldlen = 0;
 
+static int
+top_cmp(void *priv, void *a, void *b)
+{
+	const struct top *ta, *tb;
+
+	(void)priv;
+	ta = a;
+	tb = b;
+	return (ta->count < tb->count);
+}
+
+static void
+top_update(void *priv, void *a, unsigned u)
+{
+	struct top *tp;
+
+	(void)priv;
+	tp = a;
+	tp->idx = u;
+}
+
+static int
+top_sortcmp(const void *a, const void *b)
+{
+	const struct top * const *ta = a;
+	const struct top * const *tb = b;
+
+	if ((*ta)->count > (*tb)->count)
+		return (-1);
+	return ((*ta)->count < (*tb)->count);
+}
+
+static unsigned
+top_hashfn(enum VSL_tag_e tag, const char *p, unsigned len)
+{
+	unsigned u;
+
+	/* FNV-1a */
+	u = 2166136261U ^ tag;
+	while (len-- > 0) {
+		u ^= (uint8_t)*p++;
+		u *= 16777619U;
+	}
+	return (u);
+}
+
+static void
+top_set(struct top *tp, enum VSL_tag_e tag, const char *ptr, unsigned len,
+    unsigned u)
+{
+
+	free(tp->rec_data);
+	tp->rec_data = malloc(len + 1L);
+	assert(tp->rec_data != NULL);
+	memcpy(tp->rec_data, ptr, len);
+	tp->rec_data[len] = '\0';
+	tp->clen = len;
+	tp->tag = tag;
+	tp->hash = u;
+	VLIST_INSERT_HEAD(&top_hash[u & (TOP_NHASH - 1)], tp, hlist);
+}
+
+static void
+top_delete(struct top *tp)
+{
+
+	binheap_delete(top_heap, tp->idx);
+	VLIST_REMOVE(tp, hlist);
+	free(tp->rec_data);
+	free(tp);
+	ntop--;
+}
+
+/* Return the entries sorted by count, highest first */
+
+static unsigned
+top_sorted(void)
+{
+	struct top *tp;
+	unsigned u, n;
+
+	n = 0;
+	for (u = 0; u < TOP_NHASH; u++)
+		VLIST_FOREACH(tp, &top_hash[u], hlist)
+			top_sort[n++] = tp;
+	assert(n == ntop);
+	qsort(top_sort, n, sizeof top_sort[0], top_sortcmp);
+	return (n);
+}
+
 static int
 accumulate(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
     unsigned spec, const char *ptr, uint64_t bm)
 {
-	struct top *tp, *tp2;
-	const char *q;
-	unsigned int u;
-	int i;
+	struct top *tp;
+	unsigned u, i;
 
 	(void)priv;
 	(void)fd;
 	(void)spec;
 	(void)bm;
-	// fprintf(stderr, "%p %08x %08x\n", p, p[0], p[1]);
 
-	u = 0;
-	q = ptr;
-	for (i = 0; i < len; i++, q++) {
-		if (f_flag && (*q == ':' || isspace(*q))) {
-			len = q - ptr;
-			break;
+	if (f_flag) {
+		for (i = 0; i < len; i++) {
+			if (ptr[i] == ':' || isspace(ptr[i])) {
+				len = i;
+				break;
+			}
 		}
-		u += *q;
 	}
+	u = top_hashfn(tag, ptr, len);
 
 	AZ(pthread_mutex_lock(&mtx));
-	VTAILQ_FOREACH(tp, &top_head, list) {
+	VLIST_FOREACH(tp, &top_hash[u & (TOP_NHASH - 1)], hlist) {
 		if (tp->hash != u)
 			continue;
 		if (tp->tag != tag)
@@ -113,36 +218,25 @@ accumulate(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
 			continue;
 		if (memcmp(ptr, tp->rec_data, len))
 			continue;
-		tp->count += 1.0;
 		break;
 	}
-	if (tp == NULL) {
+	if (tp != NULL) {
+		tp->count += 1.0;
+		binheap_reorder(top_heap, tp->idx);
+	} else if (ntop < TOP_MAX) {
 		ntop++;
 		tp = calloc(sizeof *tp, 1);
 		assert(tp != NULL);
-		tp->rec_data = calloc(len + 1, 1);
-		assert(tp->rec_data != NULL);
-		tp->hash = u;
+		top_set(tp, tag, ptr, len, u);
 		tp->count = 1.0;
-		tp->clen = len;
-		tp->tag = tag;
-		memcpy(tp->rec_data, ptr, len);
-		tp->rec_data[len] = '\0';
-		VTAILQ_INSERT_TAIL(&top_head, tp, list);
-	}
-	while (1) {
-		tp2 = VTAILQ_PREV(tp, tophead, list);
-		if (tp2 == NULL || tp2->count >= tp->count)
-			break;
-		VTAILQ_REMOVE(&top_head, tp2, list);
-		VTAILQ_INSERT_AFTER(&top_head, tp, tp2, list);
-	}
-	while (1) {
-		tp2 = VTAILQ_NEXT(tp, list);
-		if (tp2 == NULL || tp2->count <= tp->count)
-			break;
-		VTAILQ_REMOVE(&top_head, tp2, list);
-		VTAILQ_INSERT_BEFORE(tp, tp2, list);
+		binheap_insert(top_heap, tp);
+	} else {
+		tp = binheap_root(top_heap);
+		AN(tp);
+		VLIST_REMOVE(tp, hlist);
+		top_set(tp, tag, ptr, len, u);
+		tp->count += 1.0;
+		binheap_reorder(top_heap, tp->idx);
 	}
 	AZ(pthread_mutex_unlock(&mtx));
 
@@ -152,11 +246,12 @@ accumulate(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
 static void
 update(const struct VSM_data *vd, int period)
 {
-	struct top *tp, *tp2;
+	struct top *tp;
 	int l, len;
 	double t = 0;
 	static time_t last = 0;
 	static unsigned n;
+	unsigned u, nsort;
 	time_t now;
 
 	now = time(NULL);
@@ -170,7 +265,9 @@ update(const struct VSM_data *vd, int period)
 	AC(erase());
 	AC(mvprintw(0, 0, "%*s", COLS - 1, VSM_Name(vd)));
 	AC(mvprintw(0, 0, "list length %u", ntop));
-	VTAILQ_FOREACH_SAFE(tp, &top_head, list, tp2) {
+	nsort = top_sorted();
+	for (u = 0; u < nsort; u++) {
+		tp = top_sort[u];
 		if (++l < LINES) {
 			len = tp->clen;
 			if (len > COLS - 20)
@@ -181,14 +278,12 @@ update(const struct VSM_data *vd, int period)
 			    len, len, tp->rec_data));
 			t = tp->count;
 		}
+		/* Same for all entries, so the heap stays in order */
 		tp->count += (1.0/3.0 - tp->count) / (double)n;
-		if (tp->count * 10 < t || l > LINES * 10) {
-			VTAILQ_REMOVE(&top_head, tp, list);
-			free(tp->rec_data);
-			free(tp);
-			ntop--;
-		}
 	}
+	for (u = 0; u < nsort; u++)
+		if (top_sort[u]->count * 10 < t)
+			top_delete(top_sort[u]);
 	AC(refresh());
 }
 
@@ -275,9 +370,12 @@ do_curses(struct VSM_data *vd, int period)
 static void
 dump(void)
 {
-	struct top *tp, *tp2;
+	struct top *tp;
+	unsigned u, nsort;
 
-	VTAILQ_FOREACH_SAFE(tp, &top_head, list, tp2) {
+	nsort = top_sorted();
+	for (u = 0; u < nsort; u++) {
+		tp = top_sort[u];
 		if (tp->count <= 1.0)
 			break;
 		printf("%9.2f %s %*.*s\n",
@@ -310,6 +408,8 @@ main(int argc, char **argv)
 	float period = 60; /* seconds */
 
 	vd = VSM_New();
+	top_heap = binheap_new(NULL, top_cmp, top_update);
+	AN(top_heap);
 
 	while ((o = getopt(argc, argv, VSL_ARGS "1fVp:")) != -1) {
 		switch (o) {
@@ -34,6 +34,7 @@ LOCK(sma)
 LOCK(smf)
 LOCK(hsl)
 LOCK(hcb)
+LOCK(hshcool)
 LOCK(hcl)
 LOCK(vcl)
 LOCK(sessmem)
@@ -42,14 +43,18 @@ LOCK(herder)
 LOCK(wq)
 LOCK(objhdr)
 LOCK(exp)
+LOCK(expwheel)
 LOCK(lru)
 LOCK(cli)
 LOCK(ban)
+LOCK(banshard)
 LOCK(vbp)
 LOCK(backend)
+LOCK(vbeidle)
 LOCK(vcapace)
 LOCK(nbusyobj)
 LOCK(busyobj)
 LOCK(mempool)
 LOCK(vxid)
+LOCK(pipe)
 /*lint -restore */
@@ -51,6 +51,12 @@ VSC_DO(SMF, smf, VSC_TYPE_SMF)
 #undef VSC_DO_SMF
 VSC_DONE(SMF, smf, VSC_TYPE_SMF)
 
+VSC_DO(SLAB, slab, VSC_TYPE_SLAB)
+#define VSC_DO_SLAB
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SLAB
+VSC_DONE(SLAB, slab, VSC_TYPE_SLAB)
+
 VSC_DO(VBE, vbe, VSC_TYPE_VBE)
 #define VSC_DO_VBE
 #include "tbl/vsc_fields.h"
@@ -62,3 +68,9 @@ VSC_DO(MEMPOOL, mempool, VSC_TYPE_MEMPOOL)
 #include "tbl/vsc_fields.h"
 #undef VSC_DO_MEMPOOL
 VSC_DONE(MEMPOOL, mempool, VSC_TYPE_MEMPOOL)
+
+VSC_DO(BAN, ban, VSC_TYPE_BAN)
+#define VSC_DO_BAN
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_BAN
+VSC_DONE(BAN, ban, VSC_TYPE_BAN)
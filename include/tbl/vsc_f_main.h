@@ -32,6 +32,9 @@
  *    n - Name:		Field name, in C-source and stats programs
  *    t - Type:		C-type, uint64_t, unless marked in 'f'
  *    l - Local:	Local counter in worker thread.
+ *			Pool workers add these to a counter block of their
+ *			pool, which VSC_Main() and VSC_Iter() sum into the
+ *			main counters.
  *    f - Format:	Semantics of the value in this field
  *				'a' - Accumulator (deprecated, use 'c')
  *				'b' - Bitmap
@@ -108,6 +111,12 @@ VSC_F(cache_miss,		uint64_t, 1, 'a',
 	"  backend before delivering it to the backend."
 )
 
+VSC_F(cache_bgfetch,		uint64_t, 1, 'a',
+    "Background fetches",
+	"Count of graced objects delivered before they were refreshed,"
+	" see the grace_bgfetch parameter."
+)
+
 VSC_F(backend_conn,		uint64_t, 0, 'a',
     "Backend conn. success",
 	""
@@ -146,6 +155,11 @@ VSC_F(backend_retry,		uint64_t, 0, 'a',
     "Backend conn. retry",
 	""
 )
+VSC_F(backend_prewarm,		uint64_t, 0, 'a',
+    "Backend conn. pre-warmed",
+	"Count of idle backend connections opened in the background"
+	" to maintain the backend_idle_min parameter."
+)
 
 /*---------------------------------------------------------------------
  * Backend fetch statistics
@@ -195,6 +209,11 @@ VSC_F(fetch_304,		uint64_t, 1, 'c',
     "Fetch no body (304)",
 	"beresp with no body because of 304 response."
 )
+VSC_F(fetch_revalidated,	uint64_t, 1, 'c',
+    "Fetch revalidated stale object",
+	"beresp was a 304 to our conditional request, and the body of"
+	" the stale object was reused."
+)
 VSC_F(fetch_failed,		uint64_t, 1, 'c',
     "Fetch body failed",
 	"beresp body fetch failed."
@@ -261,19 +280,67 @@ VSC_F(busy_wakeup,		uint64_t, 1, 'c',
 	" and rescheduled."
 )
 
-VSC_F(sess_queued,		uint64_t, 0, 'c',
+VSC_F(busy_stream,		uint64_t, 1, 'c',
+    "Number of requests delivered from a busy object",
+	"Number of requests which found an object still being fetched"
+	" and were delivered from it as the body arrived."
+)
+
+VSC_F(sess_queued,		uint64_t, 1, 'c',
     "Sessions queued for thread",
 	"Number of times session was queued waiting for a thread."
 	"  See also param queue_max."
 )
 
-VSC_F(sess_dropped,		uint64_t, 0, 'c',
+VSC_F(sess_dropped,		uint64_t, 1, 'c',
     "Sessions dropped for thread",
 	"Number of times session was dropped because the queue were too"
 	" long already."
 	"  See also param queue_max."
 )
 
+VSC_F(sess_queue_wait,		uint64_t, 1, 'c',
+    "Task queue wait (us)",
+	"Total time, in microseconds, tasks waited on the thread pool"
+	" queues before a thread picked them up."
+)
+
+VSC_F(pool_steal,		uint64_t, 1, 'c',
+    "Tasks stolen",
+	"Number of tasks run by a thread from another thread pool."
+	"  See the thread_pool_steal parameter."
+)
+
+VSC_F(pool_delay_100us,		uint64_t, 1, 'c',
+    "Tasks waited < 100us",
+	"Number of tasks which waited less than 100 microseconds for a thread."
+)
+
+VSC_F(pool_delay_1ms,		uint64_t, 1, 'c',
+    "Tasks waited < 1ms",
+	"Number of tasks which waited 100 microseconds to 1 millisecond for a thread."
+)
+
+VSC_F(pool_delay_10ms,		uint64_t, 1, 'c',
+    "Tasks waited < 10ms",
+	"Number of tasks which waited 1 to 10 milliseconds for a thread."
+)
+
+VSC_F(pool_delay_100ms,		uint64_t, 1, 'c',
+    "Tasks waited < 100ms",
+	"Number of tasks which waited 10 to 100 milliseconds for a thread."
+)
+
+VSC_F(pool_delay_1s,		uint64_t, 1, 'c',
+    "Tasks waited < 1s",
+	"Number of tasks which waited 100 milliseconds to 1 second for a thread."
+)
+
+VSC_F(pool_delay_slow,		uint64_t, 1, 'c',
+    "Tasks waited >= 1s",
+	"Number of tasks which waited a second or more for a thread."
+)
+
 /*---------------------------------------------------------------------*/
 
 VSC_F(n_object,			uint64_t, 1, 'i',
@@ -296,6 +363,11 @@ VSC_F(n_waitinglist,		uint64_t, 1, 'i',
     "N struct waitinglist",
 	""
 )
+VSC_F(n_vary_reject,		uint64_t, 1, 'a',
+    "Vary signature rejects",
+	"Number of cached variants rejected by Vary signature"
+	" without comparing the Vary strings."
+)
 
 VSC_F(n_backend,		uint64_t, 0, 'i',
     "N backends",
@@ -332,6 +404,11 @@ VSC_F(s_pipe,			uint64_t, 1, 'a',
     "Total pipe",
 	""
 )
+VSC_F(n_pipe_loop,		uint64_t, 0, 'g',
+    "Number of pipes in the event loop",
+	"Number of piped connections handled by the shared pipe event"
+	" loop thread.  See the pipe_eventloop parameter."
+)
 VSC_F(s_pass,			uint64_t, 1, 'a',
     "Total pass",
 	""
@@ -348,6 +425,11 @@ VSC_F(s_bodybytes,		uint64_t, 1, 'a',
     "Total body bytes",
 	""
 )
+VSC_F(s_sendfile,		uint64_t, 1, 'a',
+    "Total body bytes sent with sendfile",
+	"Part of s_bodybytes which was sent from storage with"
+	" sendfile(2), without passing through our address space."
+)
 
 VSC_F(sess_closed,		uint64_t, 1, 'a',
     "Session Closed",
@@ -482,6 +564,11 @@ VSC_F(hcb_insert,		uint64_t, 0, 'a',
     "HCB Inserts",
 	""
 )
+VSC_F(hcb_snaphit,		uint64_t, 1, 'a',
+    "HCB Hits from snapshot",
+	"Hits found through the objhead snapshot, without taking"
+	" the objhead lock, see the critbit_snapshot parameter."
+)
 
 VSC_F(esi_errors,		uint64_t, 0, 'a',
     "ESI parse errors (unlock)",
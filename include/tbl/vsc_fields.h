@@ -133,6 +133,84 @@ VSC_F(g_smf_large,		uint64_t, 0, 'i',
     "N large free smf",
 	""
 )
+VSC_F(g_free_16k,		uint64_t, 0, 'i',
+    "Free ranges below 16k",
+	""
+)
+VSC_F(g_free_64k,		uint64_t, 0, 'i',
+    "Free ranges of 16k to 64k",
+	""
+)
+VSC_F(g_free_256k,		uint64_t, 0, 'i',
+    "Free ranges of 64k to 256k",
+	""
+)
+VSC_F(g_free_1m,		uint64_t, 0, 'i',
+    "Free ranges of 256k to 1M",
+	""
+)
+VSC_F(g_free_4m,		uint64_t, 0, 'i',
+    "Free ranges of 1M to 4M",
+	""
+)
+VSC_F(g_free_16m,		uint64_t, 0, 'i',
+    "Free ranges of 4M to 16M",
+	""
+)
+VSC_F(g_free_large,		uint64_t, 0, 'i',
+    "Free ranges of 16M or more",
+	""
+)
+VSC_F(g_free_largest,		uint64_t, 0, 'i',
+    "Largest free range",
+	"Size in bytes of the largest free range, the biggest allocation"
+	" which can succeed without nuking."
+)
+VSC_F(g_held,			uint64_t, 0, 'g',
+    "Bytes held for sendfile",
+	"Bytes freed after they were sent with sendfile(2), which are not"
+	" reused until a second has passed."
+)
+#endif
+
+/**********************************************************************/
+
+#ifdef VSC_DO_SLAB
+VSC_F(c_req,			uint64_t, 0, 'a',
+    "Allocator requests",
+	"Requests which mapped to this size class."
+)
+VSC_F(c_fail,			uint64_t, 0, 'a',
+    "Allocator failures",
+	""
+)
+VSC_F(c_fallback,		uint64_t, 0, 'a',
+    "Requests served from a larger class",
+	"This class was empty and no fresh slab could be carved, so"
+	" the request was served from a larger size class."
+)
+VSC_F(g_slabs,			uint64_t, 0, 'i',
+    "Slabs carved for this class",
+	""
+)
+VSC_F(g_alloc,			uint64_t, 0, 'i',
+    "Chunks outstanding",
+	""
+)
+VSC_F(g_bytes,			uint64_t, 0, 'i',
+    "Bytes outstanding",
+	"Usable bytes in outstanding chunks."
+)
+VSC_F(g_waste,			uint64_t, 0, 'i',
+    "Bytes lost to rounding",
+	"Bytes in outstanding chunks trimmed off, but which could not"
+	" be moved to a smaller class.  Internal fragmentation."
+)
+VSC_F(g_free,			uint64_t, 0, 'i',
+    "Bytes in free chunks",
+	"Bytes carved for this class, but not in use.  Memory does not"
+	" move between classes, so this is external fragmentation."
+)
 #endif
 
 /**********************************************************************/
@@ -199,3 +277,33 @@ VSC_F(randry,			uint64_t, 0, 'c',
 )
 
 #endif
+
+/**********************************************************************/
+#ifdef VSC_DO_BAN
+
+VSC_F(objcore,			uint64_t, 0, 'g',
+    "Number of objects",
+	"Number of objects on the ban lists of this shard"
+)
+VSC_F(tested,			uint64_t, 0, 'c',
+    "Count of objects tested",
+	""
+)
+VSC_F(tests_tested,		uint64_t, 0, 'c',
+    "Count of ban tests",
+	"Count of individual ban tests applied to objects of this shard"
+)
+VSC_F(lurker_tested,		uint64_t, 0, 'c',
+    "Count of objects tested by lurker",
+	""
+)
+VSC_F(lurker_banned,		uint64_t, 0, 'c',
+    "Count of objects banned by lurker",
+	""
+)
+VSC_F(lurker_passes,		uint64_t, 0, 'c',
+    "Count of lurker passes",
+	"Count of passes over the ban list by the lurker of this shard"
+)
+
+#endif
@@ -63,6 +63,10 @@ struct VSC_C_main *VSC_Main(struct VSM_data *vd);
 	/*
 	 * return Main stats structure
 	 * returns NULL until child has been started.
+	 *
+	 * This is a copy, with the counters of the thread pools added
+	 * in, and it is only refreshed by calling VSC_Main() or
+	 * VSC_Iter() again.
 	 */
 
 struct VSC_desc {
@@ -91,6 +95,9 @@ int VSC_Iter(struct VSM_data *vd, VSC_iter_f *func, void *priv);
 	 * Func is called with pt == NULL, whenever VSM allocations
 	 * change (child restart, allocations/deallocations)
 	 *
+	 * The main counters point into the copy VSC_Main() returns,
+	 * and are refreshed along with it.
+	 *
 	 * Returns:
 	 *	!=0:	func returned non-zero
 	 *	-1:	No VSC's available
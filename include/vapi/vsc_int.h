@@ -33,9 +33,12 @@
 #define VSC_TYPE_MAIN		""
 #define VSC_TYPE_SMA		"SMA"
 #define VSC_TYPE_SMF		"SMF"
+#define VSC_TYPE_SLAB		"SLAB"
 #define VSC_TYPE_VBE		"VBE"
 #define VSC_TYPE_LCK		"LCK"
 #define VSC_TYPE_MEMPOOL	"MEMPOOL"
+#define VSC_TYPE_BAN		"BAN"
+#define VSC_TYPE_WRK		"WRK"
 
 #define VSC_F(n, t, l, f, e, d)	t n;
 
@@ -47,3 +50,19 @@
 #undef VSC_DO
 #undef VSC_F
 #undef VSC_DONE
+
+/*
+ * The worker counters of VSC_C_main, one block per thread pool.  These
+ * are not presented on their own, VSC_Main() and VSC_Iter() add them up
+ * into the main counters.
+ */
+
+#define L0(t, n)
+#define L1(t, n)		t n;
+#define VSC_F(n, t, l, f, e, d)	L##l(t, n)
+struct VSC_C_wrk {
+#include "tbl/vsc_f_main.h"
+};
+#undef VSC_F
+#undef L0
+#undef L1
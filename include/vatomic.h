@@ -0,0 +1,52 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Atomic operations
+ *
+ * All of these imply a full memory barrier, see also vmb.h
+ */
+
+#ifndef VATOMIC_H_INCLUDED
+#define VATOMIC_H_INCLUDED
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__INTEL_COMPILER)
+
+/* Add v to *p, return the previous value of *p */
+#define VATOMIC_FADD(p, v)	__sync_fetch_and_add((p), (v))
+
+/* Add v to *p, return the new value of *p */
+#define VATOMIC_ADD(p, v)	__sync_add_and_fetch((p), (v))
+
+/* Subtract v from *p, return the new value of *p */
+#define VATOMIC_SUB(p, v)	__sync_sub_and_fetch((p), (v))
+
+/* If *p is o, set it to n.  Return true if the swap happened */
+#define VATOMIC_CAS(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+
+#else
+#error "Need compiler support for atomic operations (see vatomic.h)"
+#endif
+
+#endif /* VATOMIC_H_INCLUDED */
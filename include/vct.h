@@ -64,3 +64,5 @@ vct_is(unsigned char x, uint16_t y)
 
 /* NB: VCT always operate in ASCII, don't replace 0x0d with \r etc. */
 #define vct_skipcrlf(p) (p[0] == 0x0d && p[1] == 0x0a ? 2 : 1)
+
+size_t VCT_NotCRLF(const char *b, const char *e);
@@ -57,4 +57,20 @@ int VRE_exec(const vre_t *code, const char *subject, int length,
     const volatile struct vre_limits *lim);
 void VRE_free(vre_t **);
 
+/*
+ * A set of regexps matched against the same subject.  VRE_set_filter()
+ * tells in one pass over the subject which members may match it.
+ */
+struct vre_set;
+typedef struct vre_set vre_set_t;
+
+vre_set_t *VRE_set_compile(const char * const *patterns, unsigned n,
+    int options, const char **errptr, int *erroffset);
+unsigned VRE_set_count(const vre_set_t *set);
+void VRE_set_filter(const vre_set_t *set, const char *subject, int length,
+    unsigned char *may);
+int VRE_set_exec_one(const vre_set_t *set, unsigned idx, const char *subject,
+    int length, const volatile struct vre_limits *lim);
+void VRE_set_free(vre_set_t **);
+
 #endif /* VRE_H_INCLUDED */
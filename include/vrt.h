@@ -174,6 +174,9 @@ void VRT_acl_log(struct req *, const char *msg);
 void VRT_re_init(void **, const char *);
 void VRT_re_fini(void *);
 int VRT_re_match(struct req *, const char *, void *re);
+void VRT_re_set_init(void **, unsigned, const char * const *);
+void VRT_re_set_fini(void *);
+int VRT_re_set_match(struct req *, const char *, void *set, unsigned);
 const char *VRT_regsub(struct req *, int all, const char *,
     void *, const char *);
 
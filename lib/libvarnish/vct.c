@@ -30,8 +30,16 @@
 
 #include "config.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "vct.h"
 
 /* NB: VCT always operate in ASCII, don't replace 0x0d with \r etc. */
@@ -220,3 +228,185 @@ const uint16_t vct_typtab[256] = {
 	[0xfe]	=	VCT_XMLNAMESTART,
 	[0xff]	=	VCT_XMLNAMESTART,
 };
+
+/*--------------------------------------------------------------------
+ * Length of the prefix of [b, e) which contains no CR or LF.
+ *
+ * This is where HTTP header dissection spends its time, so we look
+ * at 32 or 16 bytes at a time if the compiler targets AVX2 or SSE2.
+ * Loads never go beyond e.
+ */
+
+static size_t
+vct_notcrlf_scalar(const char *b, const char *e)
+{
+	const char *p;
+
+	for (p = b; p < e && !vct_iscrlf(*p); p++)
+		continue;
+	return (p - b);
+}
+
+size_t
+VCT_NotCRLF(const char *b, const char *e)
+{
+	const char *p = b;
+#if defined(__AVX2__)
+	const __m256i cr32 = _mm256_set1_epi8(0x0d);
+	const __m256i lf32 = _mm256_set1_epi8(0x0a);
+	__m256i v32;
+#endif
+#if defined(__SSE2__)
+	const __m128i cr16 = _mm_set1_epi8(0x0d);
+	const __m128i lf16 = _mm_set1_epi8(0x0a);
+	__m128i v16;
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+	unsigned m;
+#endif
+
+#if defined(__AVX2__)
+	while (e - p >= 32) {
+		v32 = _mm256_loadu_si256((const void *)p);
+		m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+		    _mm256_cmpeq_epi8(v32, cr32),
+		    _mm256_cmpeq_epi8(v32, lf32)));
+		if (m != 0)
+			return ((p - b) + __builtin_ctz(m));
+		p += 32;
+	}
+#endif
+#if defined(__SSE2__)
+	while (e - p >= 16) {
+		v16 = _mm_loadu_si128((const void *)p);
+		m = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+		    _mm_cmpeq_epi8(v16, cr16),
+		    _mm_cmpeq_epi8(v16, lf16)));
+		if (m != 0)
+			return ((p - b) + __builtin_ctz(m));
+		p += 16;
+	}
+#endif
+	return ((p - b) + vct_notcrlf_scalar(p, e));
+}
+
+#ifdef VCT_C_TEST
+/* Compile with: "cc -o foo -DVCT_C_TEST -I../.. -I../../include vct.c" */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Typical request and response header sets */
+static const char * const vct_hdrsets[] = {
+	"GET /static/js/app.4f1c9e.js HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64) "
+	"AppleWebKit/537.36 (KHTML, like Gecko) "
+	"Chrome/28.0.1500.95 Safari/537.36\r\n"
+	"Accept: */*\r\n"
+	"Referer: http://www.example.com/article/2013/08/12/\r\n"
+	"Accept-Encoding: gzip,deflate,sdch\r\n"
+	"Accept-Language: en-US,en;q=0.8,nb;q=0.6\r\n"
+	"Cookie: __utma=11111111.2222222222.1376000000.1376000000."
+	"1376000000.1; __utmz=11111111.1376000000.1.1.utmcsr=(direct)|"
+	"utmccn=(direct)|utmcmd=(none)\r\n"
+	"\r\n",
+
+	"HTTP/1.1 200 OK\r\n"
+	"Server: Apache\r\n"
+	"Date: Mon, 12 Aug 2013 10:00:00 GMT\r\n"
+	"Content-Type: image/png\r\n"
+	"Content-Length: 1234\r\n"
+	"Last-Modified: Fri, 09 Aug 2013 08:00:00 GMT\r\n"
+	"ETag: \"4d2-4e37f2e2f9c00\"\r\n"
+	"Cache-Control: max-age=3600\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"\r\n",
+
+	"GET /api/v1/items?id=1 HTTP/1.1\r\n"
+	"Host: api.example.com\r\n"
+	"Accept: application/json\r\n"
+	"X-Forwarded-For: 192.0.2.1\r\n"
+	"\r\n",
+};
+
+#define NSETS	(sizeof vct_hdrsets / sizeof vct_hdrsets[0])
+
+static double
+vct_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+static size_t
+vct_scan(size_t f(const char *, const char *), const char *b, size_t l)
+{
+	const char *p = b, *e = b + l;
+	size_t n = 0;
+
+	while (p < e) {
+		p += f(p, e);
+		if (p < e)
+			p++;
+		n++;
+	}
+	return (n);
+}
+
+int
+main(int argc, char **argv)
+{
+	char buf[256];
+	size_t u, l, i, j, nb;
+	double t0, t1, t2;
+	unsigned long n;
+	int ec = 0;
+
+	(void)argc;
+
+	/* Compare with the scalar version at all offsets and lengths */
+	srandom(1);
+	for (n = 0; n < 10000; n++) {
+		for (u = 0; u < sizeof buf; u++)
+			buf[u] = (random() % 40) ? 'a' + random() % 26 :
+			    (random() & 1 ? 0x0d : 0x0a);
+		i = random() % sizeof buf;
+		j = i + random() % (sizeof buf - i);
+		if (VCT_NotCRLF(buf + i, buf + j) !=
+		    vct_notcrlf_scalar(buf + i, buf + j)) {
+			printf("%s: mismatch at [%zu, %zu)\n", *argv, i, j);
+			ec++;
+		}
+	}
+
+	/* Benchmark over the captured header sets */
+	nb = 0;
+	t0 = vct_now();
+	for (n = 0; n < 1000000; n++)
+		for (u = 0; u < NSETS; u++) {
+			l = strlen(vct_hdrsets[u]);
+			nb += vct_scan(vct_notcrlf_scalar, vct_hdrsets[u], l);
+		}
+	t1 = vct_now();
+	for (n = 0; n < 1000000; n++)
+		for (u = 0; u < NSETS; u++) {
+			l = strlen(vct_hdrsets[u]);
+			nb -= vct_scan(VCT_NotCRLF, vct_hdrsets[u], l);
+		}
+	t2 = vct_now();
+	if (nb != 0) {
+		printf("%s: benchmark mismatch\n", *argv);
+		ec++;
+	}
+	printf("%s: scalar %.3f s, VCT_NotCRLF %.3f s\n",
+	    *argv, t1 - t0, t2 - t1);
+	if (!ec)
+		printf("OK\n");
+	return (ec > 0);
+}
+#endif
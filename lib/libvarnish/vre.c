@@ -28,8 +28,11 @@
 
 #include "config.h"
 
+#include <ctype.h>
 #include <errno.h>
 #include <pcre.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "miniobj.h"
@@ -43,6 +46,10 @@
 #define VRE_STUDY_JIT_COMPILE 0
 #endif
 
+/* Initial and maximal size of the per-thread JIT stacks */
+#define VRE_JIT_STACK_MIN	(32 * 1024)
+#define VRE_JIT_STACK_MAX	(512 * 1024)
+
 #if PCRE_MAJOR < 8 || (PCRE_MAJOR == 8 && PCRE_MINOR < 20)
 #  define pcre_free_study pcre_free
 #endif
@@ -63,8 +70,73 @@ struct vre {
 const unsigned VRE_CASELESS = PCRE_CASELESS;
 const unsigned VRE_NOTEMPTY = PCRE_NOTEMPTY;
 
-vre_t *
-VRE_compile(const char *pattern, int options,
+/*--------------------------------------------------------------------
+ * JIT compiled expressions run on a stack of their own.  The one PCRE
+ * hangs off the pcre_extra would be shared by all threads executing
+ * the expression, so instead each thread gets its own stack, handed
+ * out by the callback below.  If we fail to allocate one, PCRE falls
+ * back to a small stack on the machine stack.
+ */
+
+#if PCRE_MAJOR > 8 || (PCRE_MAJOR == 8 && PCRE_MINOR >= 20)
+
+static pthread_once_t vre_jit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t vre_jit_key;
+
+static void
+vre_jit_stack_free(void *priv)
+{
+
+	pcre_jit_stack_free(priv);
+}
+
+static void
+vre_jit_init(void)
+{
+
+	AZ(pthread_key_create(&vre_jit_key, vre_jit_stack_free));
+}
+
+static pcre_jit_stack *
+vre_jit_stack(void *priv)
+{
+	pcre_jit_stack *js;
+
+	(void)priv;
+	js = pthread_getspecific(vre_jit_key);
+	if (js == NULL) {
+		js = pcre_jit_stack_alloc(VRE_JIT_STACK_MIN, VRE_JIT_STACK_MAX);
+		if (js != NULL)
+			AZ(pthread_setspecific(vre_jit_key, js));
+	}
+	return (js);
+}
+
+static void
+vre_jit_assign(pcre_extra *re_extra)
+{
+
+	if (!(re_extra->flags & PCRE_EXTRA_EXECUTABLE_JIT))
+		return;
+	AZ(pthread_once(&vre_jit_once, vre_jit_init));
+	pcre_assign_jit_stack(re_extra, vre_jit_stack, NULL);
+}
+
+#else
+
+static void
+vre_jit_assign(pcre_extra *re_extra)
+{
+
+	(void)re_extra;
+}
+
+#endif
+
+/*--------------------------------------------------------------------*/
+
+static vre_t *
+vre_compile(const char *pattern, int options, int study,
     const char **errptr, int *erroffset)
 {
 	vre_t *v;
@@ -80,7 +152,7 @@ VRE_compile(const char *pattern, int options,
 		VRE_free(&v);
 		return (NULL);
 	}
-	v->re_extra = pcre_study(v->re, VRE_STUDY_JIT_COMPILE, errptr);
+	v->re_extra = pcre_study(v->re, study, errptr);
 	if (*errptr != NULL) {
 		VRE_free(&v);
 		return (NULL);
@@ -94,34 +166,51 @@ VRE_compile(const char *pattern, int options,
 			VRE_free(&v);
 			return (NULL);
 		}
-	}
+	} else
+		vre_jit_assign(v->re_extra);
 	return (v);
 }
 
+vre_t *
+VRE_compile(const char *pattern, int options,
+    const char **errptr, int *erroffset)
+{
+
+	return (vre_compile(pattern, options, VRE_STUDY_JIT_COMPILE,
+	    errptr, erroffset));
+}
+
+/*--------------------------------------------------------------------
+ * The compiled expression is shared between threads, so the match
+ * limits go into a private copy of its pcre_extra.
+ */
+
 int
 VRE_exec(const vre_t *code, const char *subject, int length,
     int startoffset, int options, int *ovector, int ovecsize,
     const volatile struct vre_limits *lim)
 {
-	CHECK_OBJ_NOTNULL(code, VRE_MAGIC);
+	pcre_extra re_extra;
 	int ov[30];
 
+	CHECK_OBJ_NOTNULL(code, VRE_MAGIC);
 	if (ovector == NULL) {
 		ovector = ov;
 		ovecsize = sizeof(ov)/sizeof(ov[0]);
 	}
 
+	re_extra = *code->re_extra;
 	if (lim != NULL) {
-		code->re_extra->match_limit = lim->match;
-		code->re_extra->flags |= PCRE_EXTRA_MATCH_LIMIT;
-		code->re_extra->match_limit_recursion = lim->match_recursion;
-		code->re_extra->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+		re_extra.match_limit = lim->match;
+		re_extra.flags |= PCRE_EXTRA_MATCH_LIMIT;
+		re_extra.match_limit_recursion = lim->match_recursion;
+		re_extra.flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
 	} else {
-		code->re_extra->flags &= ~PCRE_EXTRA_MATCH_LIMIT;
-		code->re_extra->flags &= ~PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+		re_extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT;
+		re_extra.flags &= ~PCRE_EXTRA_MATCH_LIMIT_RECURSION;
 	}
 
-	return (pcre_exec(code->re, code->re_extra, subject, length,
+	return (pcre_exec(code->re, &re_extra, subject, length,
 	    startoffset, options, ovector, ovecsize));
 }
 
@@ -142,3 +231,589 @@ VRE_free(vre_t **vv)
 		pcre_free(v->re);
 	FREE_OBJ(v);
 }
+
+/*--------------------------------------------------------------------
+ * Regexp sets
+ *
+ * Most of the regexps in a VCL chain like
+ *
+ *	if (req.url ~ "^/static/") { ... }
+ *	elsif (req.url ~ "\.(css|js)$") { ... }
+ *	elsif (req.url ~ "/admin/") { ... }
+ *
+ * contain a literal string which any subject they match must contain.
+ * We pull out the longest one from each member of the set and put them
+ * in an Aho-Corasick automaton, so one pass over the subject tells us
+ * which members can possibly match.  Only those need to be run through
+ * PCRE, the others are known not to match.
+ *
+ * Members we do not find a literal in, or which we cannot be sure
+ * about, are always run through PCRE.
+ */
+
+struct vre_set_node {
+	unsigned		child;		/* First child, 0 if none */
+	unsigned		sibling;	/* Next child of our parent */
+	unsigned		fail;
+	unsigned		dict;		/* Next node with members */
+	unsigned		memb;		/* Member ending here, plus one */
+	unsigned char		c;
+};
+
+struct vre_set {
+	unsigned		magic;
+#define VRE_SET_MAGIC		0x7a5e1b2c
+	unsigned		n;
+	vre_t			**re;
+	unsigned char		*filt;		/* Has a literal */
+	unsigned		*mnext;		/* Next member, plus one */
+	unsigned		nnode;
+	struct vre_set_node	*node;
+	unsigned		root[256];
+};
+
+/*
+ * Find the longest literal run at the top level of a pattern.  We give
+ * up on anything we are not sure about: top level alternation, option
+ * settings, verbs and escapes which are not single character classes.
+ */
+
+static char *
+vre_set_literal(const char *p, int options)
+{
+	char *run, *best;
+	size_t rl, bl;
+	unsigned depth;
+	const char *q;
+
+	if (options & PCRE_CASELESS)
+		return (NULL);
+	run = malloc(strlen(p) + 1);
+	best = malloc(strlen(p) + 1);
+	if (run == NULL || best == NULL)
+		goto bail;
+	rl = bl = 0;
+	depth = 0;
+
+#define VRE_SET_BREAK()						\
+	do {								\
+		if (rl > bl) {						\
+			memcpy(best, run, rl);				\
+			bl = rl;					\
+		}							\
+		rl = 0;							\
+	} while (0)
+
+	for (q = p; *q != '\0'; q++) {
+		switch (*q) {
+		case '\\':
+			q++;
+			if (*q == '\0')
+				goto bail;
+			if (isalnum(*(const unsigned char *)q)) {
+				if (strchr("dDwWsSbBAzZGhHvVRKX", *q) == NULL)
+					goto bail;
+				VRE_SET_BREAK();
+			} else if (depth == 0)
+				run[rl++] = *q;
+			break;
+		case '[':
+			q++;
+			if (*q == '^')
+				q++;
+			if (*q == ']')
+				q++;
+			while (*q != '\0' && *q != ']') {
+				if (q[0] == '[' && q[1] == ':') {
+					q = strstr(q, ":]");
+					if (q == NULL)
+						goto bail;
+					q++;
+				} else if (q[0] == '\\' && q[1] != '\0')
+					q++;
+				q++;
+			}
+			if (*q == '\0')
+				goto bail;
+			VRE_SET_BREAK();
+			break;
+		case '(':
+			if (q[1] == '*')
+				goto bail;
+			if (q[1] == '?' &&
+			    (q[2] == '\0' || strchr(":=!<>|#", q[2]) == NULL))
+				goto bail;
+			depth++;
+			VRE_SET_BREAK();
+			break;
+		case ')':
+			if (depth == 0)
+				goto bail;
+			depth--;
+			VRE_SET_BREAK();
+			break;
+		case '|':
+			if (depth == 0)
+				goto bail;
+			break;
+		case '{':
+			if (!isdigit(((const unsigned char *)q)[1]))
+				goto bail;
+			q = strchr(q, '}');
+			if (q == NULL)
+				goto bail;
+			/* FALLTHROUGH */
+		case '?':
+		case '*':
+			/* The last character may not be there */
+			if (rl > 0)
+				rl--;
+			VRE_SET_BREAK();
+			break;
+		case '+':
+		case '.':
+		case '^':
+		case '$':
+			VRE_SET_BREAK();
+			break;
+		default:
+			if (depth == 0)
+				run[rl++] = *q;
+			break;
+		}
+	}
+	VRE_SET_BREAK();
+#undef VRE_SET_BREAK
+	if (depth != 0 || bl == 0)
+		goto bail;
+	free(run);
+	best[bl] = '\0';
+	return (best);
+
+    bail:
+	free(run);
+	free(best);
+	return (NULL);
+}
+
+static unsigned
+vre_set_goto(const struct vre_set *vs, unsigned v, unsigned char c)
+{
+	unsigned x;
+
+	if (v == 0)
+		return (vs->root[c]);
+	for (x = vs->node[v].child; x != 0; x = vs->node[x].sibling)
+		if (vs->node[x].c == c)
+			return (x);
+	return (0);
+}
+
+static int
+vre_set_insert(struct vre_set *vs, unsigned idx, const char *lit,
+    unsigned *lnode)
+{
+	struct vre_set_node *np;
+	unsigned v, x;
+
+	for (v = 0; *lit != '\0'; lit++, v = x) {
+		x = vre_set_goto(vs, v, *lit);
+		if (x != 0)
+			continue;
+		if (vs->nnode == *lnode) {
+			np = realloc(vs->node, 2 * *lnode * sizeof *np);
+			if (np == NULL)
+				return (-1);
+			vs->node = np;
+			*lnode *= 2;
+		}
+		x = vs->nnode++;
+		np = &vs->node[x];
+		memset(np, 0, sizeof *np);
+		np->c = *lit;
+		if (v == 0)
+			vs->root[np->c] = x;
+		else {
+			np->sibling = vs->node[v].child;
+			vs->node[v].child = x;
+		}
+	}
+	vs->mnext[idx] = vs->node[v].memb;
+	vs->node[v].memb = idx + 1;
+	vs->filt[idx] = 1;
+	return (0);
+}
+
+/* Breadth first, so the fail node of a node is done before it */
+
+static int
+vre_set_link(struct vre_set *vs)
+{
+	struct vre_set_node *np;
+	unsigned *q, qh, qt, v, x, f, c;
+
+	q = malloc(vs->nnode * sizeof *q);
+	if (q == NULL)
+		return (-1);
+	qh = qt = 0;
+	for (c = 0; c < 256; c++)
+		if (vs->root[c] != 0)
+			q[qt++] = vs->root[c];
+	while (qh < qt) {
+		v = q[qh++];
+		for (x = vs->node[v].child; x != 0; x = vs->node[x].sibling)
+			q[qt++] = x;
+		np = &vs->node[v];
+		np->dict = 0;
+		for (x = vs->node[v].child; x != 0; x = vs->node[x].sibling) {
+			f = np->fail;
+			while (f != 0 && vre_set_goto(vs, f, vs->node[x].c) == 0)
+				f = vs->node[f].fail;
+			vs->node[x].fail = vre_set_goto(vs, f, vs->node[x].c);
+		}
+		f = np->fail;
+		np->dict = vs->node[f].memb != 0 ? f : vs->node[f].dict;
+	}
+	free(q);
+	return (0);
+}
+
+vre_set_t *
+VRE_set_compile(const char * const *patterns, unsigned n, int options,
+    const char **errptr, int *erroffset)
+{
+	vre_set_t *vs;
+	unsigned u, lnode;
+	char *lit;
+
+	*errptr = NULL; *erroffset = 0;
+	AN(patterns);
+	ALLOC_OBJ(vs, VRE_SET_MAGIC);
+	if (vs == NULL) {
+		*errptr = "Out of memory for VRE set";
+		return (NULL);
+	}
+	lnode = 64;
+	vs->n = n;
+	vs->re = calloc(n + 1, sizeof *vs->re);
+	vs->filt = calloc(n + 1, sizeof *vs->filt);
+	vs->mnext = calloc(n + 1, sizeof *vs->mnext);
+	vs->node = calloc(lnode, sizeof *vs->node);
+	if (vs->re == NULL || vs->filt == NULL || vs->mnext == NULL ||
+	    vs->node == NULL) {
+		*errptr = "Out of memory for VRE set";
+		VRE_set_free(&vs);
+		return (NULL);
+	}
+	vs->nnode = 1;		/* The root */
+	for (u = 0; u < n; u++) {
+		vs->re[u] = VRE_compile(patterns[u], options,
+		    errptr, erroffset);
+		if (vs->re[u] == NULL) {
+			VRE_set_free(&vs);
+			return (NULL);
+		}
+		lit = vre_set_literal(patterns[u], options);
+		if (lit == NULL)
+			continue;
+		if (vre_set_insert(vs, u, lit, &lnode)) {
+			free(lit);
+			*errptr = "Out of memory for VRE set";
+			VRE_set_free(&vs);
+			return (NULL);
+		}
+		free(lit);
+	}
+	if (vre_set_link(vs)) {
+		*errptr = "Out of memory for VRE set";
+		VRE_set_free(&vs);
+		return (NULL);
+	}
+	return (vs);
+}
+
+unsigned
+VRE_set_count(const vre_set_t *vs)
+{
+
+	CHECK_OBJ_NOTNULL(vs, VRE_SET_MAGIC);
+	return (vs->n);
+}
+
+/*
+ * Set may[u] to one for the members which may match the subject, and
+ * to zero for those which cannot.  This takes one pass over the subject
+ * no matter how many members there are.
+ */
+
+void
+VRE_set_filter(const vre_set_t *vs, const char *subject, int length,
+    unsigned char *may)
+{
+	const unsigned char *p, *e;
+	unsigned u, v, x;
+
+	CHECK_OBJ_NOTNULL(vs, VRE_SET_MAGIC);
+	AN(may);
+	for (u = 0; u < vs->n; u++)
+		may[u] = !vs->filt[u];
+	p = (const unsigned char *)subject;
+	e = p + length;
+	for (v = 0; p < e; p++) {
+		while (v != 0 && (x = vre_set_goto(vs, v, *p)) == 0)
+			v = vs->node[v].fail;
+		v = vre_set_goto(vs, v, *p);
+		for (x = vs->node[v].memb != 0 ? v : vs->node[v].dict;
+		    x != 0; x = vs->node[x].dict)
+			for (u = vs->node[x].memb; u != 0; u = vs->mnext[u - 1])
+				may[u - 1] = 1;
+	}
+}
+
+int
+VRE_set_exec_one(const vre_set_t *vs, unsigned idx, const char *subject,
+    int length, const volatile struct vre_limits *lim)
+{
+
+	CHECK_OBJ_NOTNULL(vs, VRE_SET_MAGIC);
+	assert(idx < vs->n);
+	return (VRE_exec(vs->re[idx], subject, length, 0, 0, NULL, 0, lim));
+}
+
+void
+VRE_set_free(vre_set_t **vv)
+{
+	vre_set_t *vs = *vv;
+	unsigned u;
+
+	*vv = NULL;
+	CHECK_OBJ(vs, VRE_SET_MAGIC);
+	if (vs->re != NULL) {
+		for (u = 0; u < vs->n; u++)
+			if (vs->re[u] != NULL)
+				VRE_free(&vs->re[u]);
+		free(vs->re);
+	}
+	free(vs->filt);
+	free(vs->mnext);
+	free(vs->node);
+	FREE_OBJ(vs);
+}
+
+#ifdef VRE_C_BENCH
+/*
+ * Compare matching throughput with and without the PCRE JIT compiler,
+ * with a number of threads sharing the same compiled expressions.
+ *
+ * With -s, compare a chain of regexps tested one after the other until
+ * one matches, as VCL if/elsif does, with the same tests against a set.
+ *
+ * Compile with:
+ *  cc -o foo -DVRE_C_BENCH -I../.. -I../../include vre.c vas.c vtim.c \
+ *	-lpcre -lpthread -lm
+ * Run with:
+ *  ./foo [-n iterations] [-t threads] [regexp [subject]]
+ *  ./foo -s [-n iterations]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "vtim.h"
+
+static const char *b_subject =
+    "/some/rather/long/url/path/with/a/file.html?and=a&query=string";
+static unsigned b_niter = 1000000;
+static struct vre_limits b_lim = { 10000, 10000 };
+
+static void *
+b_thread(void *priv)
+{
+	const vre_t *v;
+	unsigned u;
+	int l;
+
+	v = priv;
+	l = strlen(b_subject);
+	for (u = 0; u < b_niter; u++)
+		(void)VRE_exec(v, b_subject, l, 0, 0, NULL, 0, &b_lim);
+	return (NULL);
+}
+
+static void
+b_run(const char *what, const char *pattern, int study, unsigned nthr)
+{
+	pthread_t thr[nthr];
+	const char *error;
+	int erroffset;
+	unsigned u;
+	vre_t *v;
+	double t0, t1;
+
+	v = vre_compile(pattern, 0, study, &error, &erroffset);
+	if (v == NULL) {
+		fprintf(stderr, "Illegal regexp at %d: %s\n",
+		    erroffset, error);
+		exit(2);
+	}
+	t0 = VTIM_mono();
+	for (u = 0; u < nthr; u++)
+		AZ(pthread_create(&thr[u], NULL, b_thread, v));
+	for (u = 0; u < nthr; u++)
+		AZ(pthread_join(thr[u], NULL));
+	t1 = VTIM_mono();
+	printf("%-6s %u x %u matches in %.3fs, %.0f matches/s\n",
+	    what, nthr, b_niter, t1 - t0, (nthr * (double)b_niter) / (t1 - t0));
+	VRE_free(&v);
+}
+
+static const char * const b_set[] = {
+	"^/healthcheck$",
+	"^/admin/",
+	"^/api/v[0-9]+/users/",
+	"^/api/v[0-9]+/orders/",
+	"^/static/",
+	"^/media/",
+	"\\.(jpg|jpeg|png|gif|webp|ico)$",
+	"\\.(css|js)(\\?.*)?$",
+	"\\.(woff2?|ttf|eot)$",
+	"[?&]utm_[a-z]+=",
+	"[?&]sessionid=",
+	"^/search\\?q=",
+	"^/cart(/|$)",
+	"^/checkout(/|$)",
+	"^/user/[0-9]+/profile",
+	"\\.php$",
+	"^/wp-(admin|login)",
+	"/feed/?$",
+	"/sitemap[^/]*\\.xml$",
+	"/robots\\.txt$",
+	"/nocache/",
+	"/private/",
+	"[Pp]review=true",
+	"/embed/",
+};
+
+static const char * const b_setsubj[] = {
+	"/healthcheck",
+	"/static/css/site.css",
+	"/products/shoes/running/trail-runner-2000.html?color=blue&size=44",
+	"/blog/2012/11/some-rather-long-article-title-goes-here/",
+	"/images/products/trail-runner-2000/large/front.jpg",
+	"/embed/video/12345?autoplay=1",
+};
+
+#define B_NSET		(sizeof b_set / sizeof b_set[0])
+#define B_NSETSUBJ	(sizeof b_setsubj / sizeof b_setsubj[0])
+
+static void
+b_set_run(void)
+{
+	const char *error;
+	int erroffset, l;
+	unsigned u, v, w, nre = 0;
+	vre_t *re[B_NSET];
+	vre_set_t *vs;
+	unsigned char may[B_NSET];
+	double t0, t1;
+
+	for (u = 0; u < B_NSET; u++) {
+		re[u] = VRE_compile(b_set[u], 0, &error, &erroffset);
+		AN(re[u]);
+	}
+	vs = VRE_set_compile(b_set, B_NSET, 0, &error, &erroffset);
+	AN(vs);
+
+	for (v = 0; v < B_NSETSUBJ; v++) {
+		l = strlen(b_setsubj[v]);
+
+		/* if/elsif, with every test a regexp of its own */
+		t0 = VTIM_mono();
+		for (w = 0; w < b_niter; w++)
+			for (u = 0; u < B_NSET; u++)
+				if (VRE_exec(re[u], b_setsubj[v], l,
+				    0, 0, NULL, 0, &b_lim) >= 0)
+					break;
+		t1 = VTIM_mono();
+		if (u < B_NSET)
+			printf("chain  match %2u %8.0f ns  %s\n", u + 1,
+			    1e9 * (t1 - t0) / b_niter, b_setsubj[v]);
+		else
+			printf("chain  none     %8.0f ns  %s\n",
+			    1e9 * (t1 - t0) / b_niter, b_setsubj[v]);
+
+		/* The same, the way VRT_re_set_match() does it */
+		t0 = VTIM_mono();
+		for (w = 0; w < b_niter; w++) {
+			nre = 1;
+			if (VRE_set_exec_one(vs, 0, b_setsubj[v], l,
+			    &b_lim) >= 0)
+				continue;
+			VRE_set_filter(vs, b_setsubj[v], l, may);
+			for (u = 1; u < B_NSET; u++) {
+				if (!may[u])
+					continue;
+				nre++;
+				if (VRE_set_exec_one(vs, u, b_setsubj[v], l,
+				    &b_lim) >= 0)
+					break;
+			}
+		}
+		t1 = VTIM_mono();
+		printf("set    PCRE %2u %8.0f ns\n", nre,
+		    1e9 * (t1 - t0) / b_niter);
+	}
+	for (u = 0; u < B_NSET; u++)
+		VRE_free(&re[u]);
+	VRE_set_free(&vs);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *pattern = "^/[^?]*/file\\.(html|css|js)(\\?.*)?$";
+	unsigned nthr = 1;
+	int ch, jit = 0, set = 0;
+
+	while ((ch = getopt(argc, argv, "n:st:")) != -1) {
+		switch (ch) {
+		case 'n':
+			b_niter = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			set = 1;
+			break;
+		case 't':
+			nthr = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-s] "
+			    "[-t threads] [regexp [subject]]\n", argv[0]);
+			exit(2);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 0)
+		pattern = argv[0];
+	if (argc > 1)
+		b_subject = argv[1];
+	if (nthr == 0)
+		nthr = 1;
+
+	if (set) {
+		b_set_run();
+		return (0);
+	}
+
+	b_run("nojit", pattern, 0, nthr);
+#if PCRE_MAJOR > 8 || (PCRE_MAJOR == 8 && PCRE_MINOR >= 20)
+	(void)pcre_config(PCRE_CONFIG_JIT, &jit);
+#endif
+	if (jit)
+		b_run("jit", pattern, PCRE_STUDY_JIT_COMPILE, nthr);
+	else
+		printf("jit    not supported by this PCRE\n");
+	return (0);
+}
+#endif
@@ -78,6 +78,7 @@ struct vsc {
 	VTAILQ_HEAD(, vsc_sf)	sf_list;
 	struct VSM_fantom	main_fantom;
 	struct VSM_fantom	iter_fantom;
+	struct VSC_C_main	main;		/* See vsc_sum_main() */
 };
 
 
@@ -226,6 +227,46 @@ VSC_Arg(struct VSM_data *vd, int arg, const char *opt)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * The worker counters in the main block only hold what threads outside
+ * the pools added, each pool has its own VSC_TYPE_WRK block.  We present
+ * a copy of the main block with the pools added in, refreshed whenever
+ * VSC_Main() or VSC_Iter() is called.
+ */
+
+static struct VSC_C_main *
+vsc_sum_main(struct VSM_data *vd, const struct VSM_fantom *mf)
+{
+	struct vsc *vsc = vsc_setup(vd);
+	struct VSM_fantom vf;
+	const volatile struct VSC_C_wrk *wp;
+
+	memcpy(&vsc->main, mf->b, sizeof vsc->main);
+	VSM_FOREACH_SAFE(&vf, vd) {
+		if (strcmp(vf.chunk->class, VSC_CLASS) ||
+		    strcmp(vf.chunk->type, VSC_TYPE_WRK))
+			continue;
+		wp = vf.b;
+#define L0(n)
+#define L1(n) (vsc->main.n += wp->n)
+#define VSC_F(n, t, l, f, d, e) L##l(n);
+#include "tbl/vsc_f_main.h"
+#undef VSC_F
+#undef L0
+#undef L1
+	}
+	return (&vsc->main);
+}
+
+static void *
+vsc_payload(struct vsc *vsc, const struct VSM_fantom *vf)
+{
+
+	if (!strcmp(vf->chunk->type, VSC_TYPE_MAIN))
+		return (&vsc->main);
+	return (vf->b);
+}
+
 /*--------------------------------------------------------------------*/
 
 struct VSC_C_main *
@@ -237,7 +278,7 @@ VSC_Main(struct VSM_data *vd)
 		return (NULL);
 	if (!VSM_Get(vd, &vsc->main_fantom, VSC_CLASS, "", ""))
 		return (NULL);
-	return ((void*)vsc->main_fantom.b);
+	return (vsc_sum_main(vd, &vsc->main_fantom));
 }
 
 /*--------------------------------------------------------------------
@@ -270,7 +311,7 @@ vsc_add_pt(struct vsc *vsc, const char *class, const char *ident,
 		const char *class = t;					\
 									\
 		CHECK_OBJ_NOTNULL(vsc, VSC_MAGIC);			\
-		st = vf->b;						\
+		st = vsc_payload(vsc, vf);				\
 
 #define VSC_F(nn,tt,ll,ff,dd,ee)					\
 		vsc_add_pt(vsc, class, vf->chunk->ident, descs++,	\
@@ -390,6 +431,7 @@ VSC_Iter(struct VSM_data *vd, VSC_iter_f *func, void *priv)
 		vsc_filter_pt_list(vd);
 	}
 	AN(vd->head);
+	(void)vsc_sum_main(vd, &vsc->iter_fantom);
 	VTAILQ_FOREACH(pt, &vsc->pt_list, list) {
 		i = func(priv, &pt->point);
 		if (i)
@@ -501,6 +501,7 @@ vcc_NewVcc(const struct vcc *tl0)
 	VTAILQ_INIT(&tl->membits);
 	VTAILQ_INIT(&tl->tokens);
 	VTAILQ_INIT(&tl->sources);
+	VTAILQ_INIT(&tl->re_sets);
 
 	tl->nsources = 0;
 	tl->ndirector = 1;
@@ -682,6 +683,8 @@ vcc_CompileSource(const struct vcc *tl0, struct vsb *sb, struct source *sp)
 
 	LocTable(tl);
 
+	vcc_regexp_emit(tl);
+
 	EmitInitFunc(tl);
 
 	EmitFiniFunc(tl);
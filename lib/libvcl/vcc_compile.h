@@ -63,6 +63,7 @@ void vcl_output_lang_h(struct vsb *sb);
 
 struct acl_e;
 struct proc;
+struct re_set;
 struct expr;
 struct vcc;
 struct symbol;
@@ -182,6 +183,8 @@ struct vcc {
 
 	VTAILQ_HEAD(, acl_e)	acl;
 
+	VTAILQ_HEAD(, re_set)	re_sets;
+
 	int			nprobe;
 
 	int			defaultdir;
@@ -295,6 +298,8 @@ sym_wildcard_t vcc_Stv_Wildcard;
 
 /* vcc_string.c */
 char *vcc_regexp(struct vcc *tl);
+char *vcc_regexp_set(struct vcc *tl, const char *subject, unsigned *idx);
+void vcc_regexp_emit(struct vcc *tl);
 
 /* vcc_symb.c */
 struct symbol *VCC_AddSymbolStr(struct vcc *tl, const char *name, enum symkind);
@@ -928,10 +928,12 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, enum var_type fmt)
 	char buf[256];
 	char *re;
 	const char *not;
-	struct token *tk;
+	struct token *tk, *t0;
+	unsigned u;
 
 	*e = NULL;
 
+	t0 = tl->t;
 	vcc_expr_strfold(tl, e, fmt);
 	ERRCHK(tl);
 
@@ -962,10 +964,19 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, enum var_type fmt)
 	        not = tl->t->tok == '~' ? "" : "!";
 		vcc_NextToken(tl);
 		ExpectErr(tl, CSTR);
-		re = vcc_regexp(tl);
-		ERRCHK(tl);
-		vcc_NextToken(tl);
-		bprintf(buf, "%sVRT_re_match(req, \v1, %s)", not, re);
+		if (t0->tok == ID && VTAILQ_NEXT(t0, list) == tk) {
+			/* A plain variable, join the others tested on it */
+			re = vcc_regexp_set(tl, VSB_data((*e)->vsb), &u);
+			ERRCHK(tl);
+			vcc_NextToken(tl);
+			bprintf(buf, "%sVRT_re_set_match(req, \v1, %s, %u)",
+			    not, re, u);
+		} else {
+			re = vcc_regexp(tl);
+			ERRCHK(tl);
+			vcc_NextToken(tl);
+			bprintf(buf, "%sVRT_re_match(req, \v1, %s)", not, re);
+		}
 		*e = vcc_expr_edit(BOOL, buf, *e, NULL);
 		return;
 	}
@@ -39,26 +39,34 @@
 
 /*--------------------------------------------------------------------*/
 
-char *
-vcc_regexp(struct vcc *tl)
+static int
+vcc_regexp_check(struct vcc *tl)
 {
-	char buf[BUFSIZ], *p;
 	vre_t *t;
 	const char *error;
 	int erroroffset;
 
 	Expect(tl, CSTR);
 	if (tl->err)
-		return (NULL);
-	memset(&t, 0, sizeof t);
+		return (0);
 	t = VRE_compile(tl->t->dec, 0, &error, &erroroffset);
 	if (t == NULL) {
 		VSB_printf(tl->sb,
 		    "Regexp compilation error:\n\n%s\n\n", error);
 		vcc_ErrWhere(tl, tl->t);
-		return (NULL);
+		return (0);
 	}
 	VRE_free(&t);
+	return (1);
+}
+
+char *
+vcc_regexp(struct vcc *tl)
+{
+	char buf[BUFSIZ], *p;
+
+	if (!vcc_regexp_check(tl))
+		return (NULL);
 	sprintf(buf, "VGC_re_%u", tl->unique++);
 	p = TlAlloc(tl, strlen(buf) + 1);
 	strcpy(p, buf);
@@ -70,3 +78,79 @@ vcc_regexp(struct vcc *tl)
 	Ff(tl, 0, "\tVRT_re_fini(%s);\n", buf);
 	return (p);
 }
+
+/*--------------------------------------------------------------------
+ * Regexps tested against the same subject are collected in a set, so
+ * the runtime can rule out most of them in one pass over the subject,
+ * see cache_vrt_re.c.  Identical regexps share a slot.
+ */
+
+struct re_set_member {
+	VTAILQ_ENTRY(re_set_member)	list;
+	const struct token		*t;
+};
+
+struct re_set {
+	VTAILQ_ENTRY(re_set)		list;
+	const char			*subject;
+	char				*name;
+	unsigned			n;
+	VTAILQ_HEAD(, re_set_member)	members;
+};
+
+char *
+vcc_regexp_set(struct vcc *tl, const char *subject, unsigned *idx)
+{
+	char buf[BUFSIZ];
+	struct re_set *rs;
+	struct re_set_member *rm;
+
+	if (!vcc_regexp_check(tl))
+		return (NULL);
+
+	VTAILQ_FOREACH(rs, &tl->re_sets, list)
+		if (!strcmp(rs->subject, subject))
+			break;
+	if (rs == NULL) {
+		rs = TlAlloc(tl, sizeof *rs);
+		rs->subject = TlDup(tl, subject);
+		sprintf(buf, "VGC_re_set_%u", tl->unique++);
+		rs->name = TlDup(tl, buf);
+		VTAILQ_INIT(&rs->members);
+		VTAILQ_INSERT_TAIL(&tl->re_sets, rs, list);
+		Fh(tl, 0, "static void *%s;\n", rs->name);
+	}
+
+	*idx = 0;
+	VTAILQ_FOREACH(rm, &rs->members, list) {
+		if (!strcmp(rm->t->dec, tl->t->dec))
+			return (rs->name);
+		(*idx)++;
+	}
+	rm = TlAlloc(tl, sizeof *rm);
+	rm->t = tl->t;
+	VTAILQ_INSERT_TAIL(&rs->members, rm, list);
+	rs->n++;
+	return (rs->name);
+}
+
+void
+vcc_regexp_emit(struct vcc *tl)
+{
+	struct re_set *rs;
+	struct re_set_member *rm;
+
+	VTAILQ_FOREACH(rs, &tl->re_sets, list) {
+		Fh(tl, 0, "\nstatic const char * const %s_re[%u] = {\n",
+		    rs->name, rs->n);
+		VTAILQ_FOREACH(rm, &rs->members, list) {
+			Fh(tl, 0, "\t");
+			EncToken(tl->fh, rm->t);
+			Fh(tl, 0, ",\n");
+		}
+		Fh(tl, 0, "};\n");
+		Fi(tl, 0, "\tVRT_re_set_init(&%s, %u, %s_re);\n",
+		    rs->name, rs->n, rs->name);
+		Ff(tl, 0, "\tVRT_re_set_fini(%s);\n", rs->name);
+	}
+}
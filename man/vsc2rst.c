@@ -54,6 +54,14 @@ int main(int argc, char **argv)
 #include "tbl/vsc_fields.h"
 #undef VSC_DO_SMF
 
+	P("");
+	P("PER SLAB STORAGE SIZE CLASS COUNTERS");
+	P("====================================");
+	P("");
+#define VSC_DO_SLAB
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SLAB
+
 	P("");
 	P("PER BACKEND COUNTERS");
 	P("====================");
@@ -62,6 +70,14 @@ int main(int argc, char **argv)
 #include "tbl/vsc_fields.h"
 #undef VSC_DO_VBE
 
+	P("");
+	P("PER BAN SHARD COUNTERS");
+	P("======================");
+	P("");
+#define VSC_DO_BAN
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_BAN
+
 	return (0);
 }
 